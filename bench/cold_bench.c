@@ -0,0 +1,217 @@
+/*
+ *  bench/cold_bench.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Cold cache walk in readdir and inode order, page cache is
+ * dropped before every run when the bench is allowed to do it
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "search.h"
+#include "synth.h"
+
+#define BENCH_ROUNDS    3
+#define BENCH_ARGS      8
+
+typedef struct bench_case_ {
+    const char *name;
+    const char *args[BENCH_ARGS];
+} bench_case_t;
+
+/* Verbose output stats every entry, so stat order is what differs */
+static const bench_case_t g_cases[] = {
+    { "readdir_order", { "-r", "-v", NULL } },
+    { "inode_order", { "-r", "-v", "--inode-order", NULL } }
+};
+
+/* Distance between inodes stated one after another stands in for seeks */
+static unsigned long long g_distance = 0;
+static unsigned long long g_last = 0;
+static long g_stats = 0;
+static int g_interrupted = 0;
+
+int __real_fstatat(int dir_fd, const char *path, struct stat *pstat, int flags);
+
+int __wrap_fstatat(int dir_fd, const char *path, struct stat *pstat, int flags)
+{
+    int status = __real_fstatat(dir_fd, path, pstat, flags);
+    if (status < 0) return status;
+
+    unsigned long long ino = (unsigned long long)pstat->st_ino;
+    g_distance += ino > g_last ? ino - g_last : g_last - ino;
+    g_last = ino;
+    g_stats++;
+    return status;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Needs root, in a VM or on a loop device mounted for the bench */
+static int bench_drop_caches(void)
+{
+    sync();
+
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd < 0) return -1;
+
+    int status = write(fd, "3", 1) == 1 ? 0 : -1;
+    close(fd);
+    return status;
+}
+
+static double bench_run(int argc, char *argv[])
+{
+    fsearch_cfg_t config;
+    config.interrupted = &g_interrupted;
+
+    /* Zero makes getopt drop state left by the previous run */
+    optind = 0;
+
+    if (!fsearch_parse_args(&config, argc, argv) ||
+        fsearch_output_open(&config.writer, config.output) < 0)
+    {
+        fsearch_config_destroy(&config);
+        return -1;
+    }
+
+    double start = bench_now();
+    int status = fsearch_search_files(&config, config.directory);
+
+    fsearch_output_close(&config.writer);
+    double elapsed = bench_now() - start;
+
+    fsearch_config_destroy(&config);
+    return status < 0 ? -1 : elapsed;
+}
+
+static int bench_case(const bench_case_t *pcase, const char *root, int rounds, int cold, int last)
+{
+    char *argv[BENCH_ARGS + 4] = { "fsearch", "-d", (char*)root };
+    int argc = 3, r, i;
+
+    for (i = 0; pcase->args[i] != NULL; i++) argv[argc++] = (char*)pcase->args[i];
+    argv[argc] = NULL;
+
+    /* Warm runs are measured after one which fills the caches */
+    if (bench_mute() < 0) return -1;
+    if (!cold && bench_run(argc, argv) < 0) { bench_unmute(); return -1; }
+
+    double total = 0, best = 0;
+    long stats = 0;
+
+    for (r = 0; r < rounds; r++)
+    {
+        if (cold) bench_drop_caches();
+        g_distance = g_last = 0;
+        g_stats = 0;
+
+        double elapsed = bench_run(argc, argv);
+        if (elapsed < 0) { bench_unmute(); return -1; }
+
+        if (!r || elapsed < best) best = elapsed;
+        total += elapsed;
+        stats = g_stats;
+    }
+
+    bench_unmute();
+    printf("    {\n      \"name\": \"%s\",\n", pcase->name);
+    printf("      \"seconds\": %.6f,\n", best);
+    printf("      \"mean_seconds\": %.6f,\n", total / rounds);
+    printf("      \"stats\": %ld,\n", stats);
+    printf("      \"inode_distance\": %llu,\n", g_distance);
+    printf("      \"inode_distance_per_stat\": %.1f\n    }%s\n",
+        stats ? (double)g_distance / stats : 0.0, last ? "" : ",");
+    return 0;
+}
+
+static void bench_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--fanout <n>] [--depth <n>] [--files <n>] [--seed <n>]\n", name);
+    fprintf(stderr, "       [--rounds <n>] [--root <path>] [--keep] [--dir <path>]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        { "fanout", required_argument, NULL, 'F' },
+        { "depth", required_argument, NULL, 'D' },
+        { "files", required_argument, NULL, 'f' },
+        { "seed", required_argument, NULL, 'S' },
+        { "rounds", required_argument, NULL, 'r' },
+        { "root", required_argument, NULL, 'R' },
+        { "keep", no_argument, NULL, 'k' },
+        { "dir", required_argument, NULL, 'd' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    fsearch_synth_t synth;
+    fsearch_synth_init(&synth);
+
+    char root[PATH_MAX];
+    snprintf(root, sizeof(root), "/tmp/fsearch_cold_%d", (int)getpid());
+    int opt, keep = 0, existing = 0, rounds = BENCH_ROUNDS;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'F': synth.fanout = (unsigned int)atoi(optarg); break;
+            case 'D': synth.depth = (unsigned int)atoi(optarg); break;
+            case 'f': synth.files = (unsigned int)atoi(optarg); break;
+            case 'S': synth.seed = (unsigned int)atoi(optarg); break;
+            case 'r': rounds = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'R': snprintf(root, sizeof(root), "%s", optarg); break;
+            case 'k': keep = 1; break;
+            case 'd':
+                snprintf(root, sizeof(root), "%s", optarg);
+                existing = keep = 1;
+                break;
+            default:
+                bench_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (!existing && fsearch_synth_create(&synth, root) < 0)
+    {
+        fprintf(stderr, "Can not create tree: %s (%s)\n", root, strerror(errno));
+        if (!keep) fsearch_synth_remove(root);
+        return 1;
+    }
+
+    /* Without permission the runs are warm, inode distance still tells the order */
+    int cold = bench_drop_caches() == 0;
+    if (!cold) fprintf(stderr, "Can not drop caches (%s), measuring warm runs\n", strerror(errno));
+
+    size_t i, count = sizeof(g_cases) / sizeof(g_cases[0]);
+    int status = 0;
+
+    printf("{\n  \"tree\": \"%s\",\n", existing ? root : "synthetic");
+    if (!existing) printf("  \"entries\": %zu,\n", synth.entries);
+    printf("  \"cold\": %s,\n  \"rounds\": %d,\n  \"cases\": [\n", cold ? "true" : "false", rounds);
+
+    for (i = 0; i < count && !status; i++)
+        status = bench_case(&g_cases[i], root, rounds, cold, i + 1 == count);
+
+    printf("  ]\n}\n");
+
+    if (status < 0) fprintf(stderr, "Benchmark case failed: %s\n", g_cases[i - 1].name);
+    if (!keep) fsearch_synth_remove(root);
+    return status < 0 ? 1 : 0;
+}
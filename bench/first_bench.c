@@ -0,0 +1,118 @@
+/*
+ *  bench/first_bench.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Time to first result (-m 1) for depth first, breadth
+ * first and parallel traversal, full search as baseline
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "config.h"
+#include "search.h"
+#include "worker.h"
+#include "synth.h"
+
+#define BENCH_ROUNDS    50
+#define BENCH_MODES     4
+
+static int g_interrupted = 0;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* With -m 1 search returns right after first match, so
+   elapsed time is the latency a caller waits for result */
+static double bench_run(int argc, char *argv[])
+{
+    fsearch_cfg_t config;
+    config.interrupted = &g_interrupted;
+
+    /* Zero makes getopt drop state left by the previous run */
+    optind = 0;
+
+    if (!fsearch_parse_args(&config, argc, argv) ||
+        fsearch_output_open(&config.writer, config.output) < 0)
+    {
+        fsearch_config_destroy(&config);
+        return -1;
+    }
+
+    double start = bench_now();
+    int status = (config.threads > 1 || config.bfs) ?
+        fsearch_search_parallel(&config, config.directory) :
+        fsearch_search_files(&config, config.directory);
+    double elapsed = bench_now() - start;
+
+    fsearch_output_close(&config.writer);
+    fsearch_config_destroy(&config);
+    return status < 0 ? -1 : elapsed;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static int bench_mode(const char *directory, const char *pattern, int mode, double *p50, double *p99)
+{
+    char *argv[] = { "fsearch", "-d", (char*)directory, "-r", "-f", (char*)pattern, "-m", "1", NULL, NULL, NULL };
+    double samples[BENCH_ROUNDS];
+    int r, argc = 8;
+
+    if (mode == 0) argc = 6;
+    else if (mode == 2) argv[argc++] = "--bfs";
+    else if (mode == 3) { argv[argc++] = "-j"; argv[argc++] = "4"; }
+
+    for (r = 0; r < BENCH_ROUNDS; r++)
+        if ((samples[r] = bench_run(argc, argv)) < 0) return -1;
+
+    qsort(samples, BENCH_ROUNDS, sizeof(double), bench_compare);
+    *p50 = samples[BENCH_ROUNDS / 2];
+    *p99 = samples[(BENCH_ROUNDS * 99) / 100];
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *modes[BENCH_MODES] = { "full", "dfs", "bfs", "-j 4" };
+    static const char *patterns[] = { "conf+", "stdio.h", "passwd", "qzx+jv" };
+    const char *directory = argc > 1 ? argv[1] : "/usr";
+    size_t p;
+    int m;
+
+    printf("time to first result in %s, p50/p99 ms of %d rounds\n", directory, BENCH_ROUNDS);
+    printf("%-10s", "pattern");
+    for (m = 0; m < BENCH_MODES; m++) printf(" %17s", modes[m]);
+    printf("\n");
+
+    for (p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++)
+    {
+        double p50[BENCH_MODES], p99[BENCH_MODES];
+
+        if (bench_mute() < 0) return 1;
+
+        for (m = 0; m < BENCH_MODES; m++)
+            if (bench_mode(directory, patterns[p], m, &p50[m], &p99[m]) < 0) break;
+
+        bench_unmute();
+        if (m < BENCH_MODES) return 1;
+
+        printf("%-10s", patterns[p]);
+        for (m = 0; m < BENCH_MODES; m++) printf(" %8.3f/%8.3f", p50[m] * 1000, p99[m] * 1000);
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ *  bench/index_bench.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Index query latency: trigram posting lists versus
+ * full record scan for patterns of different selectivity
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "index.h"
+
+#define BENCH_ROUNDS    5
+
+static int g_interrupted = 0;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_run(int argc, char *argv[], int query)
+{
+    fsearch_cfg_t config;
+    config.interrupted = &g_interrupted;
+
+    /* Zero makes getopt drop state left by the previous run */
+    optind = 0;
+
+    if (!fsearch_parse_args(&config, argc, argv) ||
+        fsearch_output_open(&config.writer, config.output) < 0)
+    {
+        fsearch_config_destroy(&config);
+        return -1;
+    }
+
+    int status = config.build_index ?
+        fsearch_index_build(&config, config.index) :
+        fsearch_index_search(&config, config.index);
+
+    fsearch_output_close(&config.writer);
+    fsearch_config_destroy(&config);
+    return status < 0 ? -1 : query;
+}
+
+/* Results go to a scratch file, its size tells if both modes agree */
+static double bench_query(const char *index, const char *pattern, const char *scratch, off_t *psize)
+{
+    char *argv[] = { "fsearch", "--index", (char*)index, "-r", "-f", (char*)pattern, NULL };
+    double best = 0;
+    int r;
+
+    for (r = 0; r < BENCH_ROUNDS; r++)
+    {
+        int fd = open(scratch, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return -1;
+
+        fflush(stdout);
+        int saved = dup(STDOUT_FILENO);
+        dup2(fd, STDOUT_FILENO);
+
+        double start = bench_now();
+        int status = bench_run(6, argv, 1);
+        double elapsed = bench_now() - start;
+
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+
+        struct stat statbuf;
+        fstat(fd, &statbuf);
+        *psize = statbuf.st_size;
+        close(fd);
+
+        if (status < 0) return -1;
+        if (!r || elapsed < best) best = elapsed;
+    }
+
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *patterns[] = { "e+", "lib+", "conf+", "stdio+", "xdr+std", "qzx+jv" };
+    const char *directory = argc > 1 ? argv[1] : "/usr";
+    char trigram_index[64], scan_index[64], scratch[64];
+    size_t p;
+
+    snprintf(trigram_index, sizeof(trigram_index), "/tmp/fsearch_bench_%d.idx", (int)getpid());
+    snprintf(scan_index, sizeof(scan_index), "/tmp/fsearch_bench_%d.scan.idx", (int)getpid());
+    snprintf(scratch, sizeof(scratch), "/tmp/fsearch_bench_%d.out", (int)getpid());
+
+    char *build[] = { "fsearch", "--build-index", trigram_index, "-d", (char*)directory, NULL };
+    char *build_scan[] = { "fsearch", "--no-trigrams", "--build-index", scan_index, "-d", (char*)directory, NULL };
+
+    double start = bench_now();
+    if (bench_run(5, build, 0) < 0) return 1;
+    double trigram_build = bench_now() - start;
+
+    start = bench_now();
+    if (bench_run(6, build_scan, 0) < 0) return 1;
+    double scan_build = bench_now() - start;
+
+    struct stat trigram_stat, scan_stat;
+    stat(trigram_index, &trigram_stat);
+    stat(scan_index, &scan_stat);
+
+    printf("index of %s: %lld bytes in %.2fs (%lld bytes in %.2fs without trigrams)\n", directory,
+        (long long)trigram_stat.st_size, trigram_build, (long long)scan_stat.st_size, scan_build);
+    printf("%-10s %12s %12s %8s %10s\n", "pattern", "trigram ms", "scan ms", "speedup", "out bytes");
+
+    for (p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++)
+    {
+        off_t trigram_size = 0, scan_size = 0;
+        double trigram = bench_query(trigram_index, patterns[p], scratch, &trigram_size);
+        double scan = bench_query(scan_index, patterns[p], scratch, &scan_size);
+        if (trigram < 0 || scan < 0) break;
+
+        printf("%-10s %12.3f %12.3f %7.2fx %10lld%s\n", patterns[p], trigram * 1000, scan * 1000,
+            scan / trigram, (long long)trigram_size, trigram_size != scan_size ? " MISMATCH" : "");
+    }
+
+    unlink(trigram_index);
+    unlink(scan_index);
+    unlink(scratch);
+    return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ *  bench/match_bench.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * Micro-benchmark of file name matching: legacy per-entry
+ * tokenizer versus compiled matcher (entries per second)
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "match.h"
+#include "regex.h"
+
+#define BENCH_NAMES     200000
+#define BENCH_ROUNDS    10
+
+/* Matcher as it was before compiling patterns, kept for comparison */
+static int legacy_check_name(const char *pattern, int use_regex, const char *entry)
+{
+    size_t name_len = strlen(pattern);
+    if (!name_len) return 1;
+
+    char file_name[name_len + 1];
+    strcpy(file_name, pattern);
+
+    size_t i, entry_len = strlen(entry);
+    char entry_name[entry_len + 1];
+
+    for (i = 0; i < entry_len; i++) entry_name[i] = tolower(entry[i]);
+
+    entry_name[entry_len] = '\0';
+    char *saveptr = NULL;
+
+    if (!use_regex) return !strcmp(pattern, entry_name);
+
+    char *token = strtok_r(file_name, "+", &saveptr);
+    if (token == NULL) return 0;
+
+    char *offset = strstr(entry_name, token);
+    if (offset == NULL) return 0;
+
+    while (token != NULL)
+    {
+        size_t token_len = strlen(token);
+        if (strncmp(offset, token, token_len)) return 0;
+
+        offset += token_len - 1;
+        char skip_char = *offset;
+        i = 0;
+
+        while (offset[i] == skip_char) i++;
+        offset += i;
+
+        token = strtok_r(NULL, "+", &saveptr);
+    }
+
+    return 1;
+}
+
+typedef struct bench_glob_ {
+    const char *glob;
+    const char *name;
+    int match;
+} bench_glob_t;
+
+/* Unterminated classes are literal brackets, they must not be read past the end */
+static const bench_glob_t g_globs[] = {
+    { "[]", "[]", 1 },
+    { "[!]", "[!]", 1 },
+    { "a[]", "a[]", 1 },
+    { "a[]", "a", 0 },
+    { "[]]", "]", 1 },
+    { "[!]]", "a", 1 },
+    { "[!]]", "]", 0 },
+    { "*.[ch]", "main.c", 1 },
+    { "*.[!ch]", "main.c", 0 },
+    { "*[[:digit:]].c", "file1.c", 1 },
+    { "*[[:digit:]].c", "file.c", 0 },
+    { "[![:alpha:]]*", "1st", 1 },
+    { "[![:alpha:]]*", "first", 0 },
+    { "[[:upper:]_]*", "_init", 1 },
+    { "x[[=a=]]", "xa", 1 },
+    { "x[[=a=]]", "x]", 0 },
+    { "x[[.].]]", "x]", 1 },
+    { "x[[.-.]a]", "x-", 1 },
+    { "[[:digit:]", "[d", 1 }
+};
+
+static int bench_check_globs(void)
+{
+    size_t i, count = sizeof(g_globs) / sizeof(g_globs[0]);
+    int failed = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        char error[128];
+        fsearch_regex_t *pregex = fsearch_regex_compile(g_globs[i].glob, 1, error, sizeof(error));
+        int match = pregex != NULL && fsearch_regex_match(pregex, g_globs[i].name, strlen(g_globs[i].name));
+
+        if (match != g_globs[i].match)
+        {
+            printf("glob '%s' on '%s': expected %d, got %d\n", g_globs[i].glob,
+                g_globs[i].name, g_globs[i].match, match);
+            failed = 1;
+        }
+
+        fsearch_regex_free(pregex);
+    }
+
+    return failed;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char** bench_make_names(size_t count)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-";
+    static const char *words[] = { "server", "Client", "lost", "FILE", "key", "data", "test", "main" };
+    char **names = (char**)malloc(count * sizeof(char*));
+    char *arena = (char*)malloc(count * FSEARCH_PATTERN_MAX);
+    size_t i, used = 0;
+
+    srand(1337);
+    for (i = 0; i < count; i++)
+    {
+        char name[FSEARCH_PATTERN_MAX];
+        size_t len = 4 + rand() % 40, pos = 0;
+
+        while (pos < len)
+        {
+            if (rand() % 4 == 0)
+            {
+                pos += snprintf(&name[pos], sizeof(name) - pos, "%s", words[rand() % 8]);
+                continue;
+            }
+
+            name[pos++] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+
+        /* Keep names packed like entries of a getdents batch */
+        name[pos] = '\0';
+        names[i] = memcpy(&arena[used], name, pos + 1);
+        used += pos + 1;
+    }
+
+    return names;
+}
+
+int main(void)
+{
+    static const char *patterns[] = { "server.key", "lost+file", "data", "te+st+key", "client" };
+    char **names = bench_make_names(BENCH_NAMES);
+    size_t lengths[BENCH_NAMES];
+    size_t i, p, r;
+
+    for (i = 0; i < BENCH_NAMES; i++) lengths[i] = strlen(names[i]);
+    if (bench_check_globs()) return 1;
+
+    printf("%-12s %14s %14s %8s %8s\n", "pattern", "legacy/s", "compiled/s", "speedup", "matches");
+
+    for (p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++)
+    {
+        fsearch_matcher_t matcher;
+        int use_regex = fsearch_matcher_compile(&matcher, patterns[p]);
+        size_t legacy_hits = 0, compiled_hits = 0, mismatch = 0;
+
+        double start = bench_now();
+        for (r = 0; r < BENCH_ROUNDS; r++)
+            for (i = 0; i < BENCH_NAMES; i++)
+                legacy_hits += legacy_check_name(patterns[p], use_regex, names[i]);
+        double legacy = bench_now() - start;
+
+        start = bench_now();
+        for (r = 0; r < BENCH_ROUNDS; r++)
+            for (i = 0; i < BENCH_NAMES; i++)
+                compiled_hits += fsearch_matcher_match(&matcher, names[i], lengths[i]);
+        double compiled = bench_now() - start;
+
+        /* Both implementations must agree on every name */
+        for (i = 0; i < BENCH_NAMES; i++)
+            if (legacy_check_name(patterns[p], use_regex, names[i]) !=
+                fsearch_matcher_match(&matcher, names[i], lengths[i])) mismatch++;
+
+        double total = (double)BENCH_NAMES * BENCH_ROUNDS;
+        printf("%-12s %14.0f %14.0f %7.2fx %8zu%s\n", patterns[p], total / legacy,
+            total / compiled, legacy / compiled, compiled_hits / BENCH_ROUNDS,
+            mismatch ? " MISMATCH" : "");
+
+        if (mismatch || legacy_hits != compiled_hits) return 1;
+    }
+
+    free(names[0]);
+    free(names);
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ *  bench/output_bench.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * Benchmark of result output: legacy fopen/fclose per 
+ * line versus buffered writer (lines per second), and
+ * machine readable formats versus printf formatting
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "output.h"
+#include "format.h"
+#include "synth.h"
+
+#ifndef LINE_MAX
+#define LINE_MAX 8192
+#endif
+
+#define BENCH_LINES     200000
+
+/* Output function as it was before buffered writer, kept for comparison */
+static void legacy_printf(const char *output, const char *pFmt, ...)
+{
+    va_list args;
+    char line[LINE_MAX];
+
+    va_start(args, pFmt);
+    vsnprintf(line, sizeof(line), pFmt, args);
+    va_end(args);
+
+    if (output[0] != '\0')
+    {
+        FILE *fp = fopen(output, "a");
+        if (fp != NULL)
+        {
+            fprintf(fp, "%s\n", line);
+            fclose(fp);
+        }
+    }
+
+    printf("%s\n", line);
+}
+
+static void buffered_printf(fsearch_output_t *pout, const char *pFmt, ...)
+{
+    va_list args;
+    va_start(args, pFmt);
+    fsearch_output_vline(pout, LINE_MAX, pFmt, args);
+    va_end(args);
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench_run(const char *output, int buffered)
+{
+    fsearch_output_t writer;
+    size_t i;
+
+    if (output[0] != '\0' && truncate(output, 0) < 0) return 0;
+    if (buffered && fsearch_output_open(&writer, output) < 0) return 0;
+
+    double start = bench_now();
+    for (i = 0; i < BENCH_LINES; i++)
+    {
+        if (buffered) buffered_printf(&writer, "./project/shared/cpr/test/data/file_%06zu.key", i);
+        else legacy_printf(output, "./project/shared/cpr/test/data/file_%06zu.key", i);
+    }
+
+    if (buffered) fsearch_output_close(&writer);
+    else fflush(stdout);
+
+    return BENCH_LINES / (bench_now() - start);
+}
+
+/* JSON line as printf would produce it, kept for comparison */
+static void printf_json(fsearch_output_t *pout, const char *path, const struct stat *pstat)
+{
+    buffered_printf(pout, "{\"path\":\"%s\",\"dev\":%llu,\"ino\":%llu,\"mode\":%u,\"nlink\":%llu,"
+        "\"uid\":%u,\"gid\":%u,\"rdev\":%llu,\"size\":%lld,\"blocks\":%lld,\"atime\":%lld,"
+        "\"atime_nsec\":%ld,\"mtime\":%lld,\"mtime_nsec\":%ld,\"ctime\":%lld,\"ctime_nsec\":%ld}",
+        path, (unsigned long long)pstat->st_dev, (unsigned long long)pstat->st_ino,
+        (unsigned)pstat->st_mode, (unsigned long long)pstat->st_nlink, (unsigned)pstat->st_uid,
+        (unsigned)pstat->st_gid, (unsigned long long)pstat->st_rdev, (long long)pstat->st_size,
+        (long long)pstat->st_blocks, (long long)pstat->st_atim.tv_sec, pstat->st_atim.tv_nsec,
+        (long long)pstat->st_mtim.tv_sec, pstat->st_mtim.tv_nsec,
+        (long long)pstat->st_ctim.tv_sec, pstat->st_ctim.tv_nsec);
+}
+
+/* Mode -1 is printf JSON, others are output formats */
+static double bench_format(int mode)
+{
+    fsearch_output_t writer;
+    char path[PATH_MAX];
+    struct stat statbuf;
+    size_t i;
+
+    if (fsearch_output_open(&writer, "") < 0 || stat("/", &statbuf) < 0) return 0;
+
+    double start = bench_now();
+    for (i = 0; i < BENCH_LINES; i++)
+    {
+        int length = snprintf(path, sizeof(path), "./project/shared/cpr/test/data/file_%06zu.key", i);
+        statbuf.st_size = (off_t)i * 4096;
+
+        if (mode < 0) printf_json(&writer, path, &statbuf);
+        else fsearch_format_record(&writer, (fsearch_format_e)mode, path, length, &statbuf);
+    }
+
+    fsearch_output_close(&writer);
+    return BENCH_LINES / (bench_now() - start);
+}
+
+int main(void)
+{
+    char output[] = "/tmp/fsearch_output_bench_XXXXXX";
+    int fd = mkstemp(output);
+    if (fd < 0) return 1;
+    close(fd);
+
+    if (bench_mute() < 0)
+    {
+        unlink(output);
+        return 1;
+    }
+
+    double legacy_stdout = bench_run("", 0);
+    double buffered_stdout = bench_run("", 1);
+    double legacy_file = bench_run(output, 0);
+    double buffered_file = bench_run(output, 1);
+    double json_printf = bench_format(-1);
+    double json = bench_format(FSEARCH_FORMAT_JSONL);
+    double binary = bench_format(FSEARCH_FORMAT_BINARY);
+    double nul = bench_format(FSEARCH_FORMAT_NUL);
+
+    unlink(output);
+    bench_unmute();
+
+    printf("%-16s %14s %14s %8s\n", "output", "legacy/s", "buffered/s", "speedup");
+    printf("%-16s %14.0f %14.0f %7.2fx\n", "stdout", legacy_stdout, buffered_stdout, buffered_stdout / legacy_stdout);
+    printf("%-16s %14.0f %14.0f %7.2fx\n", "stdout + file", legacy_file, buffered_file, buffered_file / legacy_file);
+
+    printf("\n%-16s %14s\n", "format", "records/s");
+    printf("%-16s %14.0f\n", "jsonl (printf)", json_printf);
+    printf("%-16s %14.0f\n", "jsonl", json);
+    printf("%-16s %14.0f\n", "binary", binary);
+    printf("%-16s %14.0f\n", "nul", nul);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ *  bench/synth.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Reproducible synthetic directory tree generator and
+ * stdout redirection shared by benchmarks
+ */
+
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "synth.h"
+
+#define FSEARCH_SYNTH_NAME_MAX  255
+
+static int g_console = -1;
+static const char g_name_chars[] = "abcdefghijklmnopqrstuvwxyz0123456789_";
+static const char *g_extensions[] = { "", ".c", ".h", ".txt", ".log", ".json" };
+
+void fsearch_synth_init(fsearch_synth_t *psynth)
+{
+    psynth->fanout = 8;
+    psynth->depth = 4;
+    psynth->files = 32;
+    psynth->symlinks = 2;
+    psynth->name_min = 4;
+    psynth->name_max = 24;
+    psynth->seed = 1;
+    psynth->directories = 0;
+    psynth->entries = 0;
+}
+
+/* Own generator keeps trees identical across libc versions */
+static unsigned int fsearch_synth_rand(unsigned int *pstate)
+{
+    unsigned int x = *pstate;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *pstate = x;
+}
+
+/* Unique prefix from index, random fill up to uniformly distributed length */
+static void fsearch_synth_name(fsearch_synth_t *psynth, unsigned int *pstate,
+    char *name, char kind, unsigned int index, int extension)
+{
+    unsigned int span = psynth->name_max - psynth->name_min + 1;
+    unsigned int length = psynth->name_min + fsearch_synth_rand(pstate) % span;
+    const char *ext = extension ? g_extensions[fsearch_synth_rand(pstate) % 6] : "";
+    size_t ext_len = strlen(ext);
+
+    int pos = snprintf(name, FSEARCH_SYNTH_NAME_MAX + 1, "%c%x_", kind, index);
+    while (pos + ext_len < length && pos < FSEARCH_SYNTH_NAME_MAX - (int)ext_len)
+        name[pos++] = g_name_chars[fsearch_synth_rand(pstate) % (sizeof(g_name_chars) - 1)];
+
+    memcpy(&name[pos], ext, ext_len + 1);
+}
+
+static int fsearch_synth_level(fsearch_synth_t *psynth, unsigned int *pstate, int dir_fd, unsigned int level)
+{
+    char name[FSEARCH_SYNTH_NAME_MAX + 1];
+    char first[FSEARCH_SYNTH_NAME_MAX + 1];
+    unsigned int i;
+
+    for (i = 0; i < psynth->files; i++)
+    {
+        fsearch_synth_name(psynth, pstate, name, 'f', i, 1);
+        if (!i) strcpy(first, name);
+
+        int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0) return -1;
+        close(fd);
+    }
+
+    /* Links to a sibling file and to parent directory, the latter makes loops */
+    for (i = 0; i < psynth->symlinks; i++)
+    {
+        fsearch_synth_name(psynth, pstate, name, 'l', i, 0);
+        if (symlinkat(((i & 1) || !psynth->files) ? ".." : first, dir_fd, name) < 0) return -1;
+    }
+
+    psynth->entries += psynth->files + psynth->symlinks;
+    if (level >= psynth->depth) return 0;
+
+    for (i = 0; i < psynth->fanout; i++)
+    {
+        fsearch_synth_name(psynth, pstate, name, 'd', i, 0);
+        if (mkdirat(dir_fd, name, 0755) < 0) return -1;
+
+        int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return -1;
+
+        int status = fsearch_synth_level(psynth, pstate, fd, level + 1);
+        close(fd);
+        if (status < 0) return -1;
+
+        psynth->directories++;
+        psynth->entries++;
+    }
+
+    return 0;
+}
+
+int fsearch_synth_create(fsearch_synth_t *psynth, const char *path)
+{
+    unsigned int state = psynth->seed ? psynth->seed : 1;
+    psynth->directories = psynth->entries = 0;
+
+    if (psynth->name_min < 1 || psynth->name_max < psynth->name_min ||
+        psynth->name_max > FSEARCH_SYNTH_NAME_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (mkdir(path, 0755) < 0) return -1;
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    int status = fsearch_synth_level(psynth, &state, fd, 0);
+    close(fd);
+    return status;
+}
+
+static int fsearch_synth_unlink(const char *path, const struct stat *pstat, int flag, struct FTW *pftw)
+{
+    (void)pstat;
+    (void)pftw;
+    return flag == FTW_DP ? rmdir(path) : unlink(path);
+}
+
+int fsearch_synth_remove(const char *path)
+{
+    return nftw(path, fsearch_synth_unlink, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+int bench_mute(void)
+{
+    fflush(stdout);
+    if (g_console < 0 && (g_console = dup(STDOUT_FILENO)) < 0) return -1;
+
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null < 0) return -1;
+
+    int status = dup2(null, STDOUT_FILENO) < 0 ? -1 : 0;
+    close(null);
+    return status;
+}
+
+void bench_unmute(void)
+{
+    fflush(stdout);
+    if (g_console >= 0) dup2(g_console, STDOUT_FILENO);
+}
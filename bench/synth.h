@@ -0,0 +1,38 @@
+/*
+ *  bench/synth.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Reproducible synthetic directory tree generator and
+ * stdout redirection shared by benchmarks
+ */
+
+#ifndef __FSEARCH_SYNTH_H__
+#define __FSEARCH_SYNTH_H__
+
+#include <stddef.h>
+
+typedef struct fsearch_synth_ {
+    unsigned int fanout;        // Sub directories per directory
+    unsigned int depth;         // Directory levels below root
+    unsigned int files;         // Regular files per directory
+    unsigned int symlinks;      // Symbolic links per directory
+    unsigned int name_min;      // Shortest generated name
+    unsigned int name_max;      // Longest generated name
+    unsigned int seed;          // Same seed gives same tree
+    size_t directories;         // Created directories, root excluded
+    size_t entries;             // All created entries, root excluded
+} fsearch_synth_t;
+
+void fsearch_synth_init(fsearch_synth_t *psynth);
+
+/* Creates the tree at path, which must not exist yet */
+int fsearch_synth_create(fsearch_synth_t *psynth, const char *path);
+int fsearch_synth_remove(const char *path);
+
+/* Sends results printed by search to /dev/null, report is printed unmuted */
+int bench_mute(void);
+void bench_unmute(void);
+
+#endif /* __FSEARCH_SYNTH_H__ */
@@ -0,0 +1,330 @@
+/*
+ *  bench/traverse_bench.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Traversal, matcher and output benchmark on a synthetic tree,
+ * reports entries/s, syscalls per entry and peak RSS as JSON
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include "config.h"
+#include "search.h"
+#include "worker.h"
+#include "synth.h"
+
+#define BENCH_ROUNDS    5
+#define BENCH_ARGS      16
+
+typedef struct bench_calls_ {
+    long openat;
+    long getdents;
+    long stat;
+    long close;
+    long read;
+    long write;
+    long other;
+} bench_calls_t;
+
+typedef struct bench_case_ {
+    const char *name;
+    const char *args[BENCH_ARGS];
+} bench_case_t;
+
+/* Every case walks whole tree, they differ in the work done per entry */
+static const bench_case_t g_cases[] = {
+    { "traverse", { "-r", "-t", "p", NULL } },
+    { "traverse_parallel", { "-r", "-t", "p", "-j", "0", NULL } },
+    { "match_name", { "-r", "-f", "a+b", NULL } },
+    { "match_glob", { "-r", "-g", "*_[0-9]*.[ch]", NULL } },
+    { "match_regex", { "-r", "-e", "^f.*[0-9]\\.(c|h)$", NULL } },
+    { "output", { "-r", NULL } },
+    { "output_verbose", { "-r", "-v", NULL } }
+};
+
+static bench_calls_t g_calls;
+static int g_interrupted = 0;
+
+/*
+    Counting wrappers, the bench is linked with -Wl,--wrap=<function>
+    so every call fsearch objects make lands here first
+*/
+int __real_openat(int dir_fd, const char *path, int flags, ...);
+int __real_open(const char *path, int flags, ...);
+int __real_fstat(int fd, struct stat *pstat);
+int __real_fstatat(int dir_fd, const char *path, struct stat *pstat, int flags);
+int __real_stat(const char *path, struct stat *pstat);
+int __real_lstat(const char *path, struct stat *pstat);
+int __real_close(int fd);
+ssize_t __real_read(int fd, void *buffer, size_t size);
+ssize_t __real_pread(int fd, void *buffer, size_t size, off_t offset);
+ssize_t __real_writev(int fd, const struct iovec *iov, int count);
+long __real_syscall(long number, ...);
+
+#define BENCH_COUNT(field) __sync_add_and_fetch(&g_calls.field, 1)
+
+int __wrap_openat(int dir_fd, const char *path, int flags, ...)
+{
+    va_list args;
+    va_start(args, flags);
+    mode_t mode = (flags & O_CREAT) ? (mode_t)va_arg(args, int) : 0;
+    va_end(args);
+
+    BENCH_COUNT(openat);
+    return __real_openat(dir_fd, path, flags, mode);
+}
+
+int __wrap_open(const char *path, int flags, ...)
+{
+    va_list args;
+    va_start(args, flags);
+    mode_t mode = (flags & O_CREAT) ? (mode_t)va_arg(args, int) : 0;
+    va_end(args);
+
+    BENCH_COUNT(openat);
+    return __real_open(path, flags, mode);
+}
+
+int __wrap_fstat(int fd, struct stat *pstat) { BENCH_COUNT(stat); return __real_fstat(fd, pstat); }
+int __wrap_stat(const char *path, struct stat *pstat) { BENCH_COUNT(stat); return __real_stat(path, pstat); }
+int __wrap_lstat(const char *path, struct stat *pstat) { BENCH_COUNT(stat); return __real_lstat(path, pstat); }
+int __wrap_close(int fd) { BENCH_COUNT(close); return __real_close(fd); }
+ssize_t __wrap_read(int fd, void *buffer, size_t size) { BENCH_COUNT(read); return __real_read(fd, buffer, size); }
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int count) { BENCH_COUNT(write); return __real_writev(fd, iov, count); }
+
+int __wrap_fstatat(int dir_fd, const char *path, struct stat *pstat, int flags)
+{
+    BENCH_COUNT(stat);
+    return __real_fstatat(dir_fd, path, pstat, flags);
+}
+
+ssize_t __wrap_pread(int fd, void *buffer, size_t size, off_t offset)
+{
+    BENCH_COUNT(read);
+    return __real_pread(fd, buffer, size, offset);
+}
+
+/* Raw syscalls have at most six register arguments */
+long __wrap_syscall(long number, ...)
+{
+    va_list args;
+    long a[6];
+    int i;
+
+    va_start(args, number);
+    for (i = 0; i < 6; i++) a[i] = va_arg(args, long);
+    va_end(args);
+
+    if (number == SYS_getdents64) BENCH_COUNT(getdents);
+    else BENCH_COUNT(other);
+
+    return __real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+static long bench_calls_total(const bench_calls_t *pcalls)
+{
+    return pcalls->openat + pcalls->getdents + pcalls->stat +
+        pcalls->close + pcalls->read + pcalls->write + pcalls->other;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Peak RSS is reset before every run, so it is not inherited from previous case */
+static void bench_reset_peak(void)
+{
+    FILE *pfile = fopen("/proc/self/clear_refs", "w");
+    if (pfile == NULL) return;
+
+    fputs("5", pfile);
+    fclose(pfile);
+}
+
+static long bench_peak_rss(void)
+{
+    FILE *pfile = fopen("/proc/self/status", "r");
+    char line[256];
+    long peak = -1;
+
+    if (pfile == NULL) return -1;
+
+    while (fgets(line, sizeof(line), pfile) != NULL)
+        if (sscanf(line, "VmHWM: %ld", &peak) == 1) break;
+
+    fclose(pfile);
+    return peak;
+}
+
+static double bench_run(int argc, char *argv[])
+{
+    fsearch_cfg_t config;
+    config.interrupted = &g_interrupted;
+
+    /* Zero makes getopt drop state left by the previous run */
+    optind = 0;
+
+    if (!fsearch_parse_args(&config, argc, argv) ||
+        fsearch_output_open(&config.writer, config.output) < 0)
+    {
+        fsearch_config_destroy(&config);
+        return -1;
+    }
+
+    double start = bench_now();
+    int status = (config.threads > 1 || config.bfs) ?
+        fsearch_search_parallel(&config, config.directory) :
+        fsearch_search_files(&config, config.directory);
+
+    fsearch_output_close(&config.writer);
+    double elapsed = bench_now() - start;
+
+    fsearch_config_destroy(&config);
+    return status < 0 ? -1 : elapsed;
+}
+
+static int bench_case(const bench_case_t *pcase, const char *root, size_t entries, int rounds, int last)
+{
+    char *argv[BENCH_ARGS + 4] = { "fsearch", "-d", (char*)root };
+    int argc = 3, r, i;
+
+    for (i = 0; pcase->args[i] != NULL; i++) argv[argc++] = (char*)pcase->args[i];
+    argv[argc] = NULL;
+
+    /* First run warms up dentry and inode caches */
+    if (bench_mute() < 0) return -1;
+    if (bench_run(argc, argv) < 0) { bench_unmute(); return -1; }
+
+    bench_calls_t calls = g_calls;
+    double best = 0;
+    long peak = 0;
+
+    for (r = 0; r < rounds; r++)
+    {
+        bench_reset_peak();
+        memset(&g_calls, 0, sizeof(g_calls));
+
+        double elapsed = bench_run(argc, argv);
+        if (elapsed < 0) { bench_unmute(); return -1; }
+
+        calls = g_calls;
+        long rss = bench_peak_rss();
+        if (rss > peak) peak = rss;
+        if (!r || elapsed < best) best = elapsed;
+    }
+
+    bench_unmute();
+    long total = bench_calls_total(&calls);
+    printf("    {\n      \"name\": \"%s\",\n      \"args\": \"", pcase->name);
+
+    for (i = 0; pcase->args[i] != NULL; i++)
+    {
+        const char *arg = pcase->args[i];
+        if (i) putchar(' ');
+        for (; *arg; arg++) printf((*arg == '\\' || *arg == '"') ? "\\%c" : "%c", *arg);
+    }
+
+    printf("\",\n      \"seconds\": %.6f,\n", best);
+    printf("      \"entries_per_sec\": %.0f,\n", entries / best);
+    printf("      \"syscalls\": %ld,\n", total);
+    printf("      \"syscalls_per_entry\": %.4f,\n", (double)total / entries);
+    printf("      \"calls\": { \"openat\": %ld, \"getdents\": %ld, \"stat\": %ld, \"close\": %ld, "
+        "\"read\": %ld, \"write\": %ld, \"other\": %ld },\n", calls.openat, calls.getdents,
+        calls.stat, calls.close, calls.read, calls.write, calls.other);
+    printf("      \"peak_rss_kb\": %ld\n    }%s\n", peak, last ? "" : ",");
+    return 0;
+}
+
+static void bench_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--fanout <n>] [--depth <n>] [--files <n>] [--symlinks <n>]\n", name);
+    fprintf(stderr, "       [--name-min <n>] [--name-max <n>] [--seed <n>] [--rounds <n>]\n");
+    fprintf(stderr, "       [--root <path>] [--keep]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        { "fanout", required_argument, NULL, 'F' },
+        { "depth", required_argument, NULL, 'D' },
+        { "files", required_argument, NULL, 'f' },
+        { "symlinks", required_argument, NULL, 's' },
+        { "name-min", required_argument, NULL, 'n' },
+        { "name-max", required_argument, NULL, 'N' },
+        { "seed", required_argument, NULL, 'S' },
+        { "rounds", required_argument, NULL, 'r' },
+        { "root", required_argument, NULL, 'R' },
+        { "keep", no_argument, NULL, 'k' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    fsearch_synth_t synth;
+    fsearch_synth_init(&synth);
+
+    char root[PATH_MAX];
+    snprintf(root, sizeof(root), "/tmp/fsearch_synth_%d", (int)getpid());
+    int opt, keep = 0, rounds = BENCH_ROUNDS;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'F': synth.fanout = (unsigned int)atoi(optarg); break;
+            case 'D': synth.depth = (unsigned int)atoi(optarg); break;
+            case 'f': synth.files = (unsigned int)atoi(optarg); break;
+            case 's': synth.symlinks = (unsigned int)atoi(optarg); break;
+            case 'n': synth.name_min = (unsigned int)atoi(optarg); break;
+            case 'N': synth.name_max = (unsigned int)atoi(optarg); break;
+            case 'S': synth.seed = (unsigned int)atoi(optarg); break;
+            case 'r': rounds = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'R': snprintf(root, sizeof(root), "%s", optarg); break;
+            case 'k': keep = 1; break;
+            default:
+                bench_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (fsearch_synth_create(&synth, root) < 0)
+    {
+        fprintf(stderr, "Can not create tree: %s (%s)\n", root, strerror(errno));
+        if (!keep) fsearch_synth_remove(root);
+        return 1;
+    }
+
+    size_t i, count = sizeof(g_cases) / sizeof(g_cases[0]);
+    int status = 0;
+
+    printf("{\n  \"tree\": {\n");
+    printf("    \"fanout\": %u, \"depth\": %u, \"files\": %u, \"symlinks\": %u,\n",
+        synth.fanout, synth.depth, synth.files, synth.symlinks);
+    printf("    \"name_min\": %u, \"name_max\": %u, \"seed\": %u,\n",
+        synth.name_min, synth.name_max, synth.seed);
+    printf("    \"directories\": %zu, \"entries\": %zu\n  },\n",
+        synth.directories, synth.entries);
+    printf("  \"rounds\": %d,\n  \"cases\": [\n", rounds);
+
+    for (i = 0; i < count && !status; i++)
+        status = bench_case(&g_cases[i], root, synth.entries, rounds, i + 1 == count);
+
+    printf("  ]\n}\n");
+
+    if (status < 0) fprintf(stderr, "Benchmark case failed: %s\n", g_cases[i - 1].name);
+    if (!keep) fsearch_synth_remove(root);
+    return status < 0 ? 1 : 0;
+}
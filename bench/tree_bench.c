@@ -0,0 +1,150 @@
+/*
+ *  bench/tree_bench.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Benchmark of indented (-i) output: legacy path tokenizing
+ * versus incremental tree renderer, flat output as baseline
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "config.h"
+#include "search.h"
+#include "synth.h"
+
+#define BENCH_MATCHES   1000000
+#define BENCH_FILES     100         // Files per directory
+#define BENCH_INDENT    3
+
+static char g_last_directory[PATH_MAX];
+
+static void bench_printf(fsearch_output_t *pout, const char *pFmt, ...)
+{
+    va_list args;
+    va_start(args, pFmt);
+    fsearch_output_vline(pout, LINE_MAX, pFmt, args);
+    va_end(args);
+}
+
+/* Tree drawing as it was before incremental renderer, kept for comparison */
+static size_t legacy_depth(const char *path)
+{
+    char *saveptr_found, *saveptr_last;
+    char found[FSEARCH_FULL_PATH_LEN];
+    char last[FSEARCH_FULL_PATH_LEN];
+    size_t depth = 0;
+
+    strcpy(last, g_last_directory);
+    strcpy(found, path);
+
+    char *foundptr = strtok_r(found, "/", &saveptr_found);
+    char *lastptr = strtok_r(last, "/", &saveptr_last);
+
+    while (foundptr != NULL && lastptr != NULL)
+    {
+        if (strcmp(foundptr, lastptr)) return depth;
+        depth += BENCH_INDENT;
+
+        foundptr = strtok_r(NULL, "/", &saveptr_found);
+        lastptr = strtok_r(NULL, "/", &saveptr_last);
+    }
+
+    return depth;
+}
+
+static void legacy_render(fsearch_output_t *pout, const char *path, size_t dir_len)
+{
+    size_t match_depth = legacy_depth(path);
+    char found[FSEARCH_FULL_PATH_LEN];
+    strcpy(found, path);
+
+    char *saveptr = NULL;
+    size_t i, tabs = 0;
+
+    char *ptr = strtok_r(found, "/", &saveptr);
+    while (ptr != NULL)
+    {
+        if ((!match_depth && tabs) || (match_depth && tabs >= match_depth))
+        {
+            char suffix[tabs + 1];
+            for (i = 0; i < tabs; i++) suffix[i] = '-';
+            suffix[tabs] = '\0';
+
+            char *next = strtok_r(NULL, "/", &saveptr);
+            if (next != NULL) bench_printf(pout, "|%s%s", suffix, ptr);
+            else bench_printf(pout, "|%s\033[1m%s\033[0m", suffix, ptr);
+
+            tabs += BENCH_INDENT;
+            ptr = next;
+            continue;
+        }
+        else if (!match_depth)
+        {
+            bench_printf(pout, "%s", ptr);
+        }
+
+        ptr = strtok_r(NULL, "/", &saveptr);
+        tabs += BENCH_INDENT;
+    }
+
+    snprintf(g_last_directory, sizeof(g_last_directory), "%.*s", (int)dir_len, path);
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Matches are files spread over a two level directory tree */
+static double bench_run(int mode)
+{
+    fsearch_tree_t *ptree = fsearch_tree_create(BENCH_INDENT);
+    fsearch_output_t writer;
+    char path[FSEARCH_FULL_PATH_LEN];
+    size_t i;
+
+    if (ptree == NULL || fsearch_output_open(&writer, "") < 0) return 0;
+    g_last_directory[0] = '\0';
+
+    double start = bench_now();
+    for (i = 0; i < BENCH_MATCHES; i++)
+    {
+        size_t dir = i / BENCH_FILES;
+        int dir_len = snprintf(path, sizeof(path), "./project/shared/dir_%03zu/sub_%03zu", dir / 100, dir % 100);
+        snprintf(&path[dir_len], sizeof(path) - dir_len, "/file_%06zu.key", i);
+
+        if (mode == 0) bench_printf(&writer, "%s", path);
+        else if (mode == 1) legacy_render(&writer, path, dir_len);
+        else fsearch_tree_render(ptree, &writer, path, dir_len, 0, 1);
+    }
+
+    fsearch_output_close(&writer);
+    fsearch_tree_destroy(ptree);
+    return bench_now() - start;
+}
+
+int main(void)
+{
+    if (bench_mute() < 0) return 1;
+
+    double flat = bench_run(0);
+    double legacy = bench_run(1);
+    double tree = bench_run(2);
+
+    bench_unmute();
+
+    printf("%-16s %12s %14s\n", "output", "seconds", "matches/s");
+    printf("%-16s %12.3f %14.0f\n", "flat", flat, BENCH_MATCHES / flat);
+    printf("%-16s %12.3f %14.0f\n", "legacy tree", legacy, BENCH_MATCHES / legacy);
+    printf("%-16s %12.3f %14.0f\n", "tree", tree, BENCH_MATCHES / tree);
+    return 0;
+}
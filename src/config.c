@@ -8,15 +8,82 @@
  */
 
 #include <stdio.h>
-#include <ctype.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <string.h>
+#include <getopt.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/resource.h>
 #include "config.h"
+#include "content.h"
 
 extern char *optarg;
 
+/* Long only options */
+enum {
+    FSEARCH_OPT_BUILD_INDEX = 256,
+    FSEARCH_OPT_INDEX,
+    FSEARCH_OPT_NO_TRIGRAMS,
+    FSEARCH_OPT_DAEMON,
+    FSEARCH_OPT_CLIENT,
+    FSEARCH_OPT_MTIME,
+    FSEARCH_OPT_ATIME,
+    FSEARCH_OPT_CTIME,
+    FSEARCH_OPT_EXCLUDE,
+    FSEARCH_OPT_MIN_DEPTH,
+    FSEARCH_OPT_MAX_DEPTH,
+    FSEARCH_OPT_IGNORE_FILES,
+    FSEARCH_OPT_FIRST,
+    FSEARCH_OPT_BFS,
+    FSEARCH_OPT_STATS,
+    FSEARCH_OPT_JSONL,
+    FSEARCH_OPT_BINARY,
+    FSEARCH_OPT_DUPLICATES,
+    FSEARCH_OPT_DU,
+    FSEARCH_OPT_TOP,
+    FSEARCH_OPT_UNIQUE_INODES,
+    FSEARCH_OPT_MAX_FDS,
+    FSEARCH_OPT_INODE_ORDER,
+    FSEARCH_OPT_DIFF
+};
+
+static const struct option g_long_options[] = {
+    { "build-index", required_argument, NULL, FSEARCH_OPT_BUILD_INDEX },
+    { "index", required_argument, NULL, FSEARCH_OPT_INDEX },
+    { "no-trigrams", no_argument, NULL, FSEARCH_OPT_NO_TRIGRAMS },
+    { "daemon", required_argument, NULL, FSEARCH_OPT_DAEMON },
+    { "client", required_argument, NULL, FSEARCH_OPT_CLIENT },
+    { "mtime", required_argument, NULL, FSEARCH_OPT_MTIME },
+    { "atime", required_argument, NULL, FSEARCH_OPT_ATIME },
+    { "ctime", required_argument, NULL, FSEARCH_OPT_CTIME },
+    { "exclude", required_argument, NULL, FSEARCH_OPT_EXCLUDE },
+    { "min-depth", required_argument, NULL, FSEARCH_OPT_MIN_DEPTH },
+    { "max-depth", required_argument, NULL, FSEARCH_OPT_MAX_DEPTH },
+    { "one-file-system", no_argument, NULL, 'x' },
+    { "follow", no_argument, NULL, 'L' },
+    { "unique-inodes", no_argument, NULL, FSEARCH_OPT_UNIQUE_INODES },
+    { "max-fds", required_argument, NULL, FSEARCH_OPT_MAX_FDS },
+    { "inode-order", no_argument, NULL, FSEARCH_OPT_INODE_ORDER },
+    { "diff", required_argument, NULL, FSEARCH_OPT_DIFF },
+    { "ignore-files", no_argument, NULL, FSEARCH_OPT_IGNORE_FILES },
+    { "max-results", required_argument, NULL, 'm' },
+    { "first", no_argument, NULL, FSEARCH_OPT_FIRST },
+    { "quiet", no_argument, NULL, 'q' },
+    { "bfs", no_argument, NULL, FSEARCH_OPT_BFS },
+    { "stats", no_argument, NULL, FSEARCH_OPT_STATS },
+    { "null", no_argument, NULL, '0' },
+    { "jsonl", no_argument, NULL, FSEARCH_OPT_JSONL },
+    { "binary", no_argument, NULL, FSEARCH_OPT_BINARY },
+    { "duplicates", no_argument, NULL, FSEARCH_OPT_DUPLICATES },
+    { "du", no_argument, NULL, FSEARCH_OPT_DU },
+    { "top", required_argument, NULL, FSEARCH_OPT_TOP },
+    { NULL, 0, NULL, 0 }
+};
+
 #define FSEARCH_VERSION_MAX     0
 #define FSEARCH_VERSION_MIN     1
 #define FSEARCH_BUILD_NUMBER    6
@@ -24,25 +91,64 @@ extern char *optarg;
 static void fsearch_config_init(fsearch_cfg_t *pcfg, const char *pname)
 {
     pcfg->exec_name = pname;
-    pcfg->last_directory[0] = '\0';
-    pcfg->file_name[0] = '\0';
-    pcfg->output[0] = '\0';
-
-    pcfg->directory[0] = '.';
-    pcfg->directory[1] = '/';
-    pcfg->directory[2] = '\0';
-
-    pcfg->permissions = 0;
-    pcfg->file_types = 0;
-    pcfg->link_count = -1;
-    pcfg->file_size = -1;
+    pcfg->index = NULL;
+    pcfg->diff = NULL;
+    pcfg->socket = NULL;
+    pcfg->content = NULL;
+    pcfg->content_len = 0;
+    pcfg->matcher.regex = NULL;
+    pcfg->writer.buffer = NULL;
+    pcfg->names = NULL;
+    pcfg->tree = NULL;
+    pcfg->stats = NULL;
+    pcfg->du = NULL;
+    pcfg->inodes = NULL;
+    pcfg->exclude_count = 0;
+    fsearch_matcher_compile(&pcfg->matcher, "");
+    pcfg->callback = NULL;
+    pcfg->ctx = NULL;
+    pcfg->output = NULL;
+    pcfg->directory = "./";
+    pthread_mutex_init(&pcfg->lock, NULL);
+
+    fsearch_filter_init(&pcfg->filter);
     pcfg->indentation = 0;
+    pcfg->threads = 0;
+    pcfg->min_depth = 0;
+    pcfg->max_depth = 0;
+    pcfg->fd_budget = 0;
+    pcfg->stopped = 0;
+    pcfg->max_results = 0;
+    pcfg->result_count = 0;
+    pcfg->top = 0;
 
     pcfg->recursive = 0;
-    pcfg->use_regex = 0;
     pcfg->is_found = 0;
     pcfg->criteria = 0;
     pcfg->verbose = 0;
+    pcfg->need_stat = 0;
+    pcfg->format = FSEARCH_FORMAT_TEXT;
+    pcfg->build_index = 0;
+    pcfg->trigrams = 1;
+    pcfg->daemon = 0;
+    pcfg->one_filesystem = 0;
+    pcfg->ignore_files = 0;
+    pcfg->quiet = 0;
+    pcfg->bfs = 0;
+    pcfg->duplicates = 0;
+    pcfg->follow = 0;
+    pcfg->unique_inodes = 0;
+    pcfg->inode_order = 0;
+}
+
+static void fsearch_analyze_criteria(fsearch_cfg_t *pcfg)
+{
+    fsearch_filter_compile(&pcfg->filter, &pcfg->matcher);
+
+    /* Name and type can be checked using directory entry only, 
+       anything else (or verbose and raw stat output) needs full stat info */
+    pcfg->need_stat = (pcfg->verbose || pcfg->du != NULL || pcfg->unique_inodes || pcfg->format >= FSEARCH_FORMAT_JSONL ||
+        pcfg->filter.count > pcfg->filter.entry_count) ? 1 : 0;
 }
 
 static int fsearch_get_ftypes(const char *pname, const char *ctypes)
@@ -106,22 +212,172 @@ static int fsearch_get_permissions(const char *pname, const char *chmod)
         return -1;
     }
 
-    char buff[FSEARCH_PERM_LEN + 1]; // +1 for null terminator
-    snprintf(buff, sizeof(buff), "%d%d%d", owner, group, others);
+    return (owner << 6) | (group << 3) | others;
+}
+
+/* Parses '[+|-]N[unit]' as more than, less than or exactly N */
+static int fsearch_parse_range(fsearch_range_t *prange, const char *arg,
+    const char *units, const long long *scales, long long *pscale)
+{
+    int sign = (*arg == '+' || *arg == '-') ? *arg++ : 0;
+    if (!isdigit((unsigned char)*arg)) return -1;
+
+    char *end = NULL;
+    errno = 0;
+
+    long long value = strtoll(arg, &end, 10);
+    if (errno == ERANGE) return -1;
+
+    if (*end != '\0')
+    {
+        const char *unit = strchr(units, *end);
+        if (unit == NULL || end[1] != '\0') return -1;
+        *pscale = scales[unit - units];
+    }
+
+    if (value > (LLONG_MAX - *pscale) / *pscale) return -1;
+    value *= *pscale;
+
+    prange->min = sign == '-' ? LLONG_MIN : (sign == '+' ? value + 1 : value);
+    prange->max = sign == '+' ? LLONG_MAX : (sign == '-' ? value - 1 : value);
+    return 0;
+}
+
+static int fsearch_get_range(fsearch_range_t *prange, const char *pname, const char *arg, int with_units)
+{
+    static const long long scales[] = { 1LL << 10, 1LL << 10, 1LL << 20, 1LL << 20,
+        1LL << 30, 1LL << 30, 1LL << 40, 1LL << 40 };
+
+    fsearch_range_t range;
+    long long scale = 1;
+
+    if (fsearch_parse_range(&range, arg, with_units ? "kKmMgGtT" : "", scales, &scale) < 0)
+    {
+        fprintf(stderr, "%s: '%s': Invalid range\n", pname, arg);
+        return -1;
+    }
+
+    fsearch_range_narrow(prange, &range);
+    return 0;
+}
+
+static int fsearch_get_window(fsearch_range_t *pwindow, const char *pname, const char *arg, time_t now)
+{
+    static const long long scales[] = { 1, 60, 3600, 86400, 604800 };
+    fsearch_range_t age, window;
+    long long scale = 86400;
+
+    if (fsearch_parse_range(&age, arg, "smhdw", scales, &scale) < 0)
+    {
+        fprintf(stderr, "%s: '%s': Invalid time\n", pname, arg);
+        return -1;
+    }
+
+    /* Exact age means within that unit (e.g. '2d' is 48 to 72 hours ago) */
+    if (age.min == age.max) age.max += scale - 1;
+
+    /* Convert age bounds to time stamp bounds */
+    window.min = age.max == LLONG_MAX ? LLONG_MIN : (long long)now - age.max;
+    window.max = age.min == LLONG_MIN ? LLONG_MAX : (long long)now - age.min;
 
-    return atoi(buff);
+    fsearch_range_narrow(pwindow, &window);
+    return 0;
 }
 
-static int fsearch_get_filename(fsearch_cfg_t *pcfg, const char *optarg)
+static int fsearch_get_pattern(fsearch_cfg_t *pcfg, const char *pname, const char *pattern, int is_glob)
 {
-    size_t i, length = strnlen(optarg, sizeof(pcfg->file_name));
+    char error[128];
 
-    /* Change file name to lowercase to support case sensitivity */
-    for (i = 0; i < length; i++) pcfg->file_name[i] = tolower(optarg[i]);
-    pcfg->file_name[length] = '\0';
+    if (fsearch_matcher_compile_regex(&pcfg->matcher, pattern, is_glob, error, sizeof(error)) < 0)
+    {
+        fprintf(stderr, "%s: '%s': %s\n", pname, pattern, error);
+        return -1;
+    }
 
-    /* Get regex usage flag only once */
-    return (strstr(pcfg->file_name, "+") != NULL) ? 1 : 0;
+    return 0;
+}
+
+static int fsearch_get_exclude(fsearch_cfg_t *pcfg, const char *pname, const char *glob)
+{
+    char error[128];
+
+    if (pcfg->exclude_count >= FSEARCH_EXCLUDE_MAX)
+    {
+        fprintf(stderr, "%s: '%s': Too many exclude patterns\n", pname, glob);
+        return -1;
+    }
+
+    fsearch_regex_t *pregex = fsearch_regex_compile(glob, 1, error, sizeof(error));
+    if (pregex == NULL)
+    {
+        fprintf(stderr, "%s: '%s': %s\n", pname, glob, error);
+        return -1;
+    }
+
+    pcfg->excludes[pcfg->exclude_count++] = pregex;
+    return 0;
+}
+
+static int fsearch_get_depth(const char *pname, const char *arg)
+{
+    char *end = NULL;
+    long depth = strtol(arg, &end, 10);
+
+    if (!isdigit((unsigned char)*arg) || *end != '\0' || depth < 1 || depth > INT_MAX)
+    {
+        fprintf(stderr, "%s: '%s': Invalid depth\n", pname, arg);
+        return -1;
+    }
+
+    return (int)depth;
+}
+
+static long long fsearch_get_count(const char *pname, const char *arg)
+{
+    char *end = NULL;
+    errno = 0;
+
+    long long count = strtoll(arg, &end, 10);
+    if (!isdigit((unsigned char)*arg) || *end != '\0' || errno == ERANGE || count < 1)
+    {
+        fprintf(stderr, "%s: '%s': Invalid count\n", pname, arg);
+        return -1;
+    }
+
+    return count;
+}
+
+static int fsearch_get_fd_budget(void)
+{
+    struct rlimit limit;
+
+    /* Leave most descriptors to output, content reads and workers */
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur == RLIM_INFINITY) return FSEARCH_FD_BUDGET;
+    rlim_t budget = limit.rlim_cur / 4;
+
+    return budget < 2 ? 2 : (budget > FSEARCH_FD_BUDGET ? FSEARCH_FD_BUDGET : (int)budget);
+}
+
+static int fsearch_get_cpus(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+static int fsearch_get_threads(const char *pname, const char *arg)
+{
+    char *end = NULL;
+    errno = 0;
+
+    long threads = strtol(arg, &end, 10);
+    if (!isdigit((unsigned char)*arg) || *end != '\0' || errno == ERANGE || threads > INT_MAX)
+    {
+        fprintf(stderr, "%s: '%s': Invalid thread count\n", pname, arg);
+        return -1;
+    }
+
+    /* Use all online processors if count is not specified */
+    return threads > 0 ? (int)threads : fsearch_get_cpus();
 }
 
 void fsearch_print_usage(const char *name)
@@ -138,18 +394,60 @@ void fsearch_print_usage(const char *name)
     whitespace[len] = 0;
 
     printf("Usage: %s [-i <indentation>] [-f <file_name>] [-b <file_size>]\n", name);
+    printf(" %s [-g <glob>] [-e <regex>] [-c <content>]\n", whitespace);
     printf(" %s [-p <permissions>] [-t <file_type>] [-o <file_path>]\n", whitespace);
-    printf(" %s [-d <target_path>] [-l <link_count>] [-r] [-v] [-h]\n\n", whitespace);
+    printf(" %s [-d <target_path>] [-l <link_count>] [-j <threads>]\n", whitespace);
+    printf(" %s [--build-index <index_file>] [--index <index_file>] [--no-trigrams]\n", whitespace);
+    printf(" %s [--mtime <age>] [--atime <age>] [--ctime <age>]\n", whitespace);
+    printf(" %s [--exclude <glob>] [--min-depth <n>] [--max-depth <n>]\n", whitespace);
+    printf(" %s [--daemon <socket>] [--client <socket>] [--diff <old_index> <new_index>]\n", whitespace);
+    printf(" %s [-m <count>] [--first] [--bfs] [-q] [--stats]\n", whitespace);
+    printf(" %s [-0] [--jsonl] [--binary] [--duplicates]\n", whitespace);
+    printf(" %s [--du] [--top <count>] [-L] [--unique-inodes] [--max-fds <count>]\n", whitespace);
+    printf(" %s [--ignore-files] [--inode-order] [-x] [-r] [-v] [-h]\n\n", whitespace);
 
     printf("Options are:\n");
     printf("  -d <target_path>    # Target directory path\n");
     printf("  -i <indentation>    # Ident using tabs with specified size\n");
     printf("  -o <file_path>      # Write output in a specified file\n");
     printf("  -f <file_name>      # Target file name (case insensitive)\n");
-    printf("  -b <file_size>      # Target file size in bytes\n");
+    printf("  -g <glob>           # Target file name glob (e.g. '*.[ch]')\n");
+    printf("  -e <regex>          # Target file name extended regex (e.g. '^lib.*\\.so$')\n");
+    printf("  -c <content>        # Regular files containing text (case sensitive)\n");
+    printf("  -b <file_size>      # Target file size in bytes or k/M/G/T (e.g. '+1G')\n");
     printf("  -t <file_type>      # Target file type (*)\n");
-    printf("  -l <link_count>     # Target file link count\n");
+    printf("  -l <link_count>     # Target file link count (e.g. '+1')\n");
     printf("  -p <permissions>    # Target file permissions (e.g. 'rwxr-xr--')\n");
+    printf("  --mtime <age>       # Modified within age in s/m/h/d/w (e.g. '-2h')\n");
+    printf("  --atime <age>       # Accessed within age, same format as --mtime\n");
+    printf("  --ctime <age>       # Status changed within age, same format as --mtime\n");
+    printf("  -j <threads>        # Search using parallel threads (0 = all CPUs)\n");
+    printf("  --build-index <f>   # Index target directory recursively into file\n");
+    printf("  --index <f>         # Search in index file instead of file system\n");
+    printf("  --no-trigrams       # Build index without trigram lookup section\n");
+    printf("  --daemon <socket>   # Keep target directory in memory and serve queries\n");
+    printf("  --client <socket>   # Send search to daemon listening on socket\n");
+    printf("  --diff <f1> <f2>    # Print entries added, removed or changed since index f1\n");
+    printf("  --exclude <glob>    # Skip matching entries and don't enter them\n");
+    printf("  --min-depth <n>     # Report entries at depth n and below\n");
+    printf("  --max-depth <n>     # Don't descend below depth n\n");
+    printf("  --ignore-files      # Skip entries listed in .gitignore and .fsearchignore\n");
+    printf("  -x                  # Don't descend into other file systems\n");
+    printf("  -L                  # Follow symbolic links, walk every directory once\n");
+    printf("  --unique-inodes     # Report one path of hard linked files\n");
+    printf("  --max-fds <count>   # Keep at most count directories open while walking\n");
+    printf("  --inode-order       # Read whole directory, then visit entries by inode number\n");
+    printf("  -m <count>          # Stop search after count results\n");
+    printf("  --first             # Stop search after first result, same as -m 1\n");
+    printf("  --bfs               # Search shallow directories first\n");
+    printf("  -q                  # Print nothing, exit status tells if found\n");
+    printf("  --stats             # Print search statistics to stderr at exit\n");
+    printf("  -0                  # Print paths terminated with NUL instead of newline\n");
+    printf("  --jsonl             # Print JSON object with path and raw stat per line\n");
+    printf("  --binary            # Print binary records (see src/format.h)\n");
+    printf("  --duplicates        # Print groups of matching files with equal content\n");
+    printf("  --du                # Print disk usage and size of matches per directory\n");
+    printf("  --top <count>       # Print only count directories with largest --du usage\n");
     printf("  -r                  # Recursive search target directory\n");
     printf("  -v                  # Display additional information (verbose) \n");
     printf("  -h                  # Displays version and usage information\n\n");
@@ -165,16 +463,58 @@ void fsearch_print_usage(const char *name)
 
     printf("Notes:\n");
     printf("   1) <filename> option is supporting the following regular expression: +\n");
-    printf("   2) <file_type> option is supporting one and more file types like: -t ldb\n\n");
+    printf("   2) <file_type> option is supporting one and more file types like: -t ldb\n");
+    printf("   3) <indentation> option keeps search single threaded and depth first,\n");
+    printf("      otherwise <content> search uses all CPUs unless -j is given\n");
+    printf("   4) <glob> and <regex> options are case sensitive, last of -f/-g/-e wins\n");
+    printf("   5) <target_path> limits --index search to indexed paths under it\n");
+    printf("   6) --index uses trigrams for -f patterns with 3+ character tokens\n");
+    printf("   7) --client searches whole daemon tree unless <target_path> is given\n");
+    printf("   8) <file_size>, <link_count> and <age> mean more than with '+', less than\n");
+    printf("      with '-', exactly otherwise, repeat option to set both bounds\n");
+    printf("   9) <age> without unit is in days, '3' means from 3 to 4 days ago\n");
+    printf("  10) --exclude, --max-depth and -x also limit --build-index\n");
+    printf("  11) <count> results are the first found, their order depends on -j and --bfs\n");
+    printf("  12) --stats phase times are summed over all threads\n");
+    printf("  13) -0, --jsonl and --binary ignore -v and -i, last of them wins\n");
+    printf("  14) --duplicates compares non empty regular files, hard links are shown\n");
+    printf("      with their group, <count> limits groups and -j also sets hash threads\n");
+    printf("  15) --du counts each inode once and directories in their parent, it draws\n");
+    printf("      a tree with -i, -m and -q do not apply to it\n");
+    printf("  16) -L reports link targets, only dangling links are reported as links,\n");
+    printf("      a directory reached by several paths is searched under the first one\n");
+    printf("  17) --max-fds defaults to a quarter of open file limit, at most %d\n", FSEARCH_FD_BUDGET);
+    printf("  18) --inode-order saves disk seeks on cold caches, results follow inode order\n");
+    printf("  19) --diff prefixes paths with +, - or ~ (size, mode, owner or mtime changed),\n");
+    printf("      it compares whole indexes and criteria select the reported entries\n\n");
     printf("Example: %s -d targetDirectoryPath -f lost+file -b 100 -t b\n\n", name);
 }
 
+void fsearch_config_destroy(fsearch_cfg_t *pcfg)
+{
+    fsearch_matcher_destroy(&pcfg->matcher);
+    while (pcfg->exclude_count) fsearch_regex_free(pcfg->excludes[--pcfg->exclude_count]);
+    fsearch_names_destroy(pcfg->names);
+    fsearch_tree_destroy(pcfg->tree);
+    fsearch_stats_destroy(pcfg->stats);
+    fsearch_du_destroy(pcfg->du);
+    fsearch_inodes_destroy(pcfg->inodes);
+    pthread_mutex_destroy(&pcfg->lock);
+    pcfg->names = NULL;
+    pcfg->tree = NULL;
+    pcfg->stats = NULL;
+    pcfg->du = NULL;
+    pcfg->inodes = NULL;
+}
+
 int fsearch_parse_args(fsearch_cfg_t *pcfg, int argc, char *argv[])
 {
     fsearch_config_init(pcfg, argv[0]);
+    fsearch_filter_t *pfilter = &pcfg->filter;
+    time_t now = time(NULL);
     int opt = 0;
 
-    while ((opt = getopt(argc, argv, "d:i:o:b:l:t:p:f:r1:v1:h1")) != -1) 
+    while ((opt = getopt_long(argc, argv, "d:i:o:b:l:t:p:f:g:e:c:j:m:qxL0r1:v1:h1", g_long_options, NULL)) != -1) 
     {
         switch (opt)
         {
@@ -182,35 +522,184 @@ int fsearch_parse_args(fsearch_cfg_t *pcfg, int argc, char *argv[])
                 pcfg->indentation = atol(optarg);
                 break;
             case 'b':
-                pcfg->file_size = atol(optarg);
+                if (fsearch_get_range(&pfilter->size, argv[0], optarg, 1) < 0) return 0;
+                pfilter->active |= fsearch_filter_size;
                 pcfg->criteria++;
                 break;
             case 'l':
-                pcfg->link_count = atol(optarg);
+                if (fsearch_get_range(&pfilter->links, argv[0], optarg, 0) < 0) return 0;
+                pfilter->active |= fsearch_filter_links;
                 pcfg->criteria++;
                 break;
             case 'd':
-                snprintf(pcfg->directory, sizeof(pcfg->directory), "%s", optarg);
+                if (strlen(optarg) >= PATH_MAX)
+                {
+                    fprintf(stderr, "%s: '%s': %s\n", argv[0], optarg, strerror(ENAMETOOLONG));
+                    return 0;
+                }
+
+                pcfg->directory = optarg;
                 pcfg->criteria++;
                 break;
             case 'o':
-                snprintf(pcfg->output, sizeof(pcfg->output), "%s", optarg);
+                pcfg->output = optarg;
                 break;
             case 't':
-                pcfg->file_types = fsearch_get_ftypes(argv[0], optarg);
+                if ((pfilter->types = fsearch_get_ftypes(argv[0], optarg)) < 0) return 0;
+                pfilter->active |= fsearch_filter_type;
                 pcfg->criteria++;
                 break;
             case 'p':
-                pcfg->permissions = fsearch_get_permissions(argv[0], optarg);
+            {
+                int perm = fsearch_get_permissions(argv[0], optarg);
+                if (perm < 0) return 0;
+
+                pfilter->perm = (mode_t)perm;
+                pfilter->active |= fsearch_filter_perm;
+                pcfg->criteria++;
+                break;
+            }
+            case FSEARCH_OPT_MTIME:
+                if (fsearch_get_window(&pfilter->mtime, argv[0], optarg, now) < 0) return 0;
+                pfilter->active |= fsearch_filter_mtime;
+                pcfg->criteria++;
+                break;
+            case FSEARCH_OPT_ATIME:
+                if (fsearch_get_window(&pfilter->atime, argv[0], optarg, now) < 0) return 0;
+                pfilter->active |= fsearch_filter_atime;
+                pcfg->criteria++;
+                break;
+            case FSEARCH_OPT_CTIME:
+                if (fsearch_get_window(&pfilter->ctime, argv[0], optarg, now) < 0) return 0;
+                pfilter->active |= fsearch_filter_ctime;
                 pcfg->criteria++;
                 break;
             case 'f':
-                pcfg->use_regex = fsearch_get_filename(pcfg, optarg);
+                fsearch_matcher_compile(&pcfg->matcher, optarg);
+                pcfg->criteria++;
+                break;
+            case 'g':
+            case 'e':
+                if (fsearch_get_pattern(pcfg, argv[0], optarg, opt == 'g') < 0) return 0;
+                pcfg->criteria++;
+                break;
+            case 'c':
+                pcfg->content = optarg;
+                pcfg->content_len = strlen(optarg);
                 pcfg->criteria++;
                 break;
+            case 'j':
+                pcfg->threads = fsearch_get_threads(argv[0], optarg);
+                if (pcfg->threads < 0) return 0;
+                break;
             case 'r':
                 pcfg->recursive = 1;
                 break;
+            case 'x':
+                pcfg->one_filesystem = 1;
+                break;
+            case 'L':
+                pcfg->follow = 1;
+                break;
+            case FSEARCH_OPT_UNIQUE_INODES:
+                pcfg->unique_inodes = 1;
+                break;
+            case FSEARCH_OPT_INODE_ORDER:
+                pcfg->inode_order = 1;
+                break;
+            case FSEARCH_OPT_DIFF:
+                pcfg->diff = optarg;
+                break;
+            case FSEARCH_OPT_MAX_FDS:
+            {
+                long long count = fsearch_get_count(argv[0], optarg);
+                if (count < 0) return 0;
+
+                /* Parent stays open while its child is opened */
+                pcfg->fd_budget = count < 2 ? 2 : (count > INT_MAX ? INT_MAX : (int)count);
+                break;
+            }
+            case 'm':
+            {
+                long long count = fsearch_get_count(argv[0], optarg);
+                if (count < 0) return 0;
+                pcfg->max_results = (size_t)count;
+                break;
+            }
+            case FSEARCH_OPT_FIRST:
+                pcfg->max_results = 1;
+                break;
+            case 'q':
+                pcfg->quiet = 1;
+                break;
+            case FSEARCH_OPT_BFS:
+                pcfg->bfs = 1;
+                break;
+            case '0':
+                pcfg->format = FSEARCH_FORMAT_NUL;
+                break;
+            case FSEARCH_OPT_JSONL:
+                pcfg->format = FSEARCH_FORMAT_JSONL;
+                break;
+            case FSEARCH_OPT_BINARY:
+                pcfg->format = FSEARCH_FORMAT_BINARY;
+                break;
+            case FSEARCH_OPT_DUPLICATES:
+                pcfg->duplicates = 1;
+                break;
+            case FSEARCH_OPT_TOP:
+            {
+                long long count = fsearch_get_count(argv[0], optarg);
+                if (count < 0) return 0;
+                pcfg->top = (size_t)count;
+            }
+                /* --top implies --du */
+                __attribute__((fallthrough));
+            case FSEARCH_OPT_DU:
+                if (pcfg->du == NULL && (pcfg->du = fsearch_du_create()) == NULL)
+                {
+                    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+                    return 0;
+                }
+                break;
+            case FSEARCH_OPT_STATS:
+                if (pcfg->stats == NULL && (pcfg->stats = fsearch_stats_create()) == NULL)
+                {
+                    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+                    return 0;
+                }
+                break;
+            case FSEARCH_OPT_EXCLUDE:
+                if (fsearch_get_exclude(pcfg, argv[0], optarg) < 0) return 0;
+                break;
+            case FSEARCH_OPT_MIN_DEPTH:
+                if ((pcfg->min_depth = fsearch_get_depth(argv[0], optarg)) < 0) return 0;
+                break;
+            case FSEARCH_OPT_MAX_DEPTH:
+                if ((pcfg->max_depth = fsearch_get_depth(argv[0], optarg)) < 0) return 0;
+                break;
+            case FSEARCH_OPT_IGNORE_FILES:
+                pcfg->ignore_files = 1;
+                break;
+            case FSEARCH_OPT_BUILD_INDEX:
+                pcfg->index = optarg;
+                pcfg->build_index = 1;
+                break;
+            case FSEARCH_OPT_INDEX:
+                pcfg->index = optarg;
+                pcfg->build_index = 0;
+                break;
+            case FSEARCH_OPT_NO_TRIGRAMS:
+                pcfg->trigrams = 0;
+                break;
+            case FSEARCH_OPT_DAEMON:
+                pcfg->socket = optarg;
+                pcfg->daemon = 1;
+                break;
+            case FSEARCH_OPT_CLIENT:
+                pcfg->socket = optarg;
+                pcfg->daemon = 0;
+                break;
             case 'v':
                 pcfg->verbose = 1;
                 break;
@@ -221,9 +710,110 @@ int fsearch_parse_args(fsearch_cfg_t *pcfg, int argc, char *argv[])
     }
 
     /* Validate opts */
-    if (pcfg->permissions < 0 || 
-        pcfg->file_types < 0) 
+    if (pcfg->content_len > FSEARCH_CONTENT_BUFFER / 2)
+    {
+        fprintf(stderr, "%s: '%s': Pattern is too long\n", argv[0], pcfg->content);
+        return 0;
+    }
+
+    /* Duplicates and totals are found in the file system only */
+    if (pcfg->duplicates && (pcfg->index != NULL || pcfg->socket != NULL))
+    {
+        fprintf(stderr, "%s: --duplicates can not be used with --index, --daemon or --client\n", argv[0]);
+        return 0;
+    }
+
+    if (pcfg->du != NULL && (pcfg->duplicates || pcfg->index != NULL || pcfg->socket != NULL))
+    {
+        fprintf(stderr, "%s: --du can not be used with --duplicates, --index, --daemon or --client\n", argv[0]);
+        return 0;
+    }
+
+    /* Old index is the option argument, new one the only operand */
+    if (pcfg->diff != NULL)
+    {
+        if (pcfg->content != NULL || pcfg->duplicates || pcfg->du != NULL ||
+            pcfg->index != NULL || pcfg->socket != NULL)
+        {
+            fprintf(stderr, "%s: --diff can not be used with -c, --duplicates, --du, --index, "
+                "--build-index, --daemon or --client\n", argv[0]);
+            return 0;
+        }
+
+        if (optind + 1 != argc)
+        {
+            fprintf(stderr, "%s: --diff needs old and new index file\n", argv[0]);
             return 0;
+        }
+
+        /* Changes are marked at line start, records carry no tree */
+        pcfg->index = argv[optind];
+        if (pcfg->format > FSEARCH_FORMAT_NUL) pcfg->format = FSEARCH_FORMAT_TEXT;
+        pcfg->indentation = 0;
+    }
+
+    /* Totals are printed as text, -i draws them as tree after search */
+    if (pcfg->du != NULL)
+    {
+        pcfg->format = FSEARCH_FORMAT_TEXT;
+        pcfg->max_results = 0;
+        pcfg->quiet = 0;
+    }
+
+    /* Only non empty regular files can be duplicates, output is grouped text */
+    if (pcfg->duplicates)
+    {
+        fsearch_range_t size = { 1, LLONG_MAX };
+        fsearch_range_narrow(&pfilter->size, &size);
+        pfilter->types = (pfilter->active & fsearch_filter_type) ?
+            (pfilter->types & fsearch_regular_file) : fsearch_regular_file;
+
+        pfilter->active |= fsearch_filter_type | fsearch_filter_size;
+        pcfg->format = FSEARCH_FORMAT_TEXT;
+        pcfg->indentation = 0;
+    }
+
+    /* Exit status is known after first result, nothing is printed */
+    if (pcfg->quiet && !pcfg->max_results) pcfg->max_results = 1;
+    if (pcfg->quiet) pcfg->verbose = 0;
+
+    /* Other formats carry their own fields and are not drawn as tree */
+    if (pcfg->format != FSEARCH_FORMAT_TEXT)
+    {
+        pcfg->indentation = 0;
+        pcfg->verbose = 0;
+    }
+
+    fsearch_analyze_criteria(pcfg);
+
+    /* One set serves both, directory and file inodes never clash */
+    if ((pcfg->follow || pcfg->unique_inodes) && (pcfg->inodes = fsearch_inodes_create()) == NULL)
+    {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+        return 0;
+    }
+
+    /* Verbose output resolves owners, cache names for the whole run */
+    if (pcfg->verbose) pcfg->names = fsearch_names_create();
+
+    if (!pcfg->fd_budget) pcfg->fd_budget = fsearch_get_fd_budget();
+
+    /* Content search and hashing are I/O bound, spread them over all CPUs by default */
+    if (!pcfg->threads) pcfg->threads = (pcfg->content != NULL || pcfg->duplicates) ? fsearch_get_cpus() : 1;
+
+    /* Tree drawing depends on traversal order */
+    if (pcfg->indentation > 0 && pcfg->du == NULL)
+    {
+        pcfg->tree = fsearch_tree_create(pcfg->indentation);
+        if (pcfg->tree == NULL)
+        {
+            fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+            return 0;
+        }
+
+        pcfg->threads = 1;
+        pcfg->bfs = 0;
+    }
 
     return 1;
 }
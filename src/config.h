@@ -11,6 +11,17 @@
 #define __FSEARCH_CONFIG_H__
 
 #include <sys/types.h>
+#include <pthread.h>
+#include "query.h"
+#include "match.h"
+#include "filter.h"
+#include "output.h"
+#include "names.h"
+#include "tree.h"
+#include "stats.h"
+#include "format.h"
+#include "du.h"
+#include "inodes.h"
 
 #ifdef __linux__ 
 #include <linux/limits.h>
@@ -32,43 +43,68 @@
 #define FSEARCH_TIME_LEN 12
 #define FSEARCH_SIZE_LEN 10
 #define FSEARCH_PERM_LEN 9
-
-typedef enum {
-    fsearch_regular_file = (1 << 0),
-    fsearch_block_device = (1 << 1),
-    fsearch_char_device = (1 << 2),
-    fsearch_directory = (1 << 3),
-    fsearch_symlink = (1 << 4),
-    fsearch_socket = (1 << 5),
-    fsearch_pipe = (1 << 6)
-} fsearch_type_e;
+#define FSEARCH_EXCLUDE_MAX 32
+#define FSEARCH_FD_BUDGET 64
 
 typedef struct fsearch_cfg_ 
 {
     /* FSearch context */
-    char last_directory[PATH_MAX];  // Last printed directory path
-    char directory[PATH_MAX];       // Target directory path
-    char file_name[NAME_MAX];       // Needed file name (First regex token if using regex)
-    char output[PATH_MAX];          // Output file path
+    const char *directory;          // Target directory path
+    const char *output;             // Output file path
     const char *exec_name;          // Name of executable file (same as argv[0])
+    const char *index;              // Index file to search or build
+    const char *diff;               // Older index compared with index by --diff
+    const char *socket;             // Daemon socket to serve or query
+    const char *content;            // Pattern searched in file contents
+    size_t content_len;
+    fsearch_matcher_t matcher;      // Compiled file name pattern
+    fsearch_output_t writer;        // Buffered result output
+    fsearch_names_t *names;         // User and group name cache
+    fsearch_tree_t *tree;           // Tree renderer for indented output
+    fsearch_stats_t *stats;         // Statistics printed with --stats
+    fsearch_du_t *du;               // Directory totals collected with --du
+    fsearch_inodes_t *inodes;       // Visited directories (-L) and reported files
+    fsearch_match_cb_t callback;    // Receives matches instead of output
+    void *ctx;                      // Callback context
+    pthread_mutex_t lock;           // Serializes reported matches
+    fsearch_regex_t *excludes[FSEARCH_EXCLUDE_MAX]; // Pruned entry name globs
+    size_t exclude_count;
 
     /* Search criteria */
-    int permissions;                // Needed file permissions
-    int link_count;                 // Needed file link count
-    int file_types;                 // Needed file types
-    int file_size;                  // Needed file size
+    fsearch_filter_t filter;        // Compiled entry predicates
     int criteria;                   // Count of search criteria
 
     /* Flags */
+    fsearch_format_e format;        // Output format of matches
     int *interrupted;               // Interrupt flag
+    int stopped;                    // Result limit reached
+    int is_found;                   // Status flag, set by workers so not a bit field
+    size_t max_results;             // Stop after this many results (0 = all)
+    size_t result_count;            // Count of reported results
+    size_t top;                     // Print only largest directories with --du
     int indentation;                // Ident using tabs
+    int threads;                    // Worker thread count
+    int min_depth;                  // Report entries from this depth
+    int max_depth;                  // Don't descend deeper (0 = unlimited)
+    int fd_budget;                  // Open directories of sequential walk
     int recursive:1;                // Recursive search
-    int use_regex:1;                // Regex flag
-    int is_found:1;                 // Status flag
     int verbose:1;                  // Verbose flag
+    int need_stat:1;                // Criteria or output needs full stat
+    int build_index:1;              // Build index instead of search
+    int trigrams:1;                 // Write trigram section into index
+    int daemon:1;                   // Serve queries instead of sending one
+    int one_filesystem:1;           // Don't descend into other file systems
+    int ignore_files:1;             // Apply .gitignore and .fsearchignore rules
+    int quiet:1;                    // Report result with exit status only
+    int bfs:1;                      // Visit shallow directories first
+    int duplicates:1;               // Report groups of equal regular files
+    int follow:1;                   // Follow symbolic links (-L)
+    int unique_inodes:1;            // Report one path of hard linked files
+    int inode_order:1;              // Visit directory entries by inode number
 } fsearch_cfg_t;
 
 int fsearch_parse_args(fsearch_cfg_t *pcfg, int argc, char *argv[]);
+void fsearch_config_destroy(fsearch_cfg_t *pcfg);
 void fsearch_print_usage(const char *name);
 
 #endif /* __FSEARCH_CONFIG_H__ */
\ No newline at end of file
@@ -0,0 +1,220 @@
+/*
+ *  src/content.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * File content search with vectorized substring kernels
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "content.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define FSEARCH_USE_SIMD
+#include <immintrin.h>
+#endif
+
+typedef const char*(*fsearch_find_fn_t)(const char*, size_t, const char*, size_t);
+
+/* Small files are read here, reused by every file of the thread */
+static __thread char g_buffer[FSEARCH_CONTENT_BUFFER];
+
+static const char* fsearch_content_scalar(const char *haystack, size_t length, const char *needle, size_t needle_len)
+{
+    const char *end = haystack + length - needle_len + 1;
+    const char *pos = haystack;
+
+    /* memchr is vectorized by libc, verify the rest on every hit */
+    while (pos < end && (pos = (const char*)memchr(pos, needle[0], (size_t)(end - pos))) != NULL)
+    {
+        if (!memcmp(pos + 1, needle + 1, needle_len - 1)) return pos;
+        pos++;
+    }
+
+    return NULL;
+}
+
+#ifdef FSEARCH_USE_SIMD
+static const char* fsearch_content_sse2(const char *haystack, size_t length, const char *needle, size_t needle_len)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+    size_t i = 0;
+
+    /* First and last needle bytes filter 16 positions at once */
+    for (; i + needle_len - 1 + 16 <= length; i += 16)
+    {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)&haystack[i]);
+        __m128i block_last = _mm_loadu_si128((const __m128i*)&haystack[i + needle_len - 1]);
+
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(block_first, first),
+            _mm_cmpeq_epi8(block_last, last)));
+
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+            if (!memcmp(&haystack[i + bit + 1], &needle[1], needle_len - 2))
+                return &haystack[i + bit];
+
+            mask &= mask - 1;
+        }
+    }
+
+    if (i + needle_len > length) return NULL;
+    return fsearch_content_scalar(&haystack[i], length - i, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+static const char* fsearch_content_avx2(const char *haystack, size_t length, const char *needle, size_t needle_len)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+    size_t i = 0;
+
+    /* Two blocks per round keep both load ports busy on long files */
+    for (; i + needle_len - 1 + 64 <= length; i += 64)
+    {
+        __m256i eq0 = _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&haystack[i]), first),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&haystack[i + needle_len - 1]), last));
+
+        __m256i eq1 = _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&haystack[i + 32]), first),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&haystack[i + 32 + needle_len - 1]), last));
+
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(eq0) |
+            ((uint64_t)(uint32_t)_mm256_movemask_epi8(eq1) << 32);
+
+        while (mask)
+        {
+            int bit = __builtin_ctzll(mask);
+            const char *pos = &haystack[i + bit];
+            size_t j;
+
+            /* Inline compare, calling out would mix AVX and SSE code */
+            for (j = 1; j + 1 < needle_len && pos[j] == needle[j]; j++);
+            if (j + 1 >= needle_len)
+            {
+                _mm256_zeroupper();
+                return pos;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+
+    /* Avoid AVX to SSE transition penalty in the tail kernel */
+    _mm256_zeroupper();
+    if (i + needle_len > length) return NULL;
+    return fsearch_content_sse2(&haystack[i], length - i, needle, needle_len);
+}
+#endif
+
+static fsearch_find_fn_t fsearch_content_kernel(void)
+{
+    static fsearch_find_fn_t kernel = NULL;
+    fsearch_find_fn_t current = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+    if (current != NULL) return current;
+
+#ifdef FSEARCH_USE_SIMD
+    __builtin_cpu_init();
+    current = __builtin_cpu_supports("avx2") ? fsearch_content_avx2 : fsearch_content_sse2;
+#else
+    current = fsearch_content_scalar;
+#endif
+
+    __atomic_store_n(&kernel, current, __ATOMIC_RELAXED);
+    return current;
+}
+
+const char* fsearch_content_find(const char *haystack, size_t length, const char *needle, size_t needle_len)
+{
+    if (!needle_len) return haystack;
+    if (needle_len > length) return NULL;
+
+    /* Single byte needle is what memchr does best */
+    if (needle_len == 1) return (const char*)memchr(haystack, needle[0], length);
+    return fsearch_content_kernel()(haystack, length, needle, needle_len);
+}
+
+static int fsearch_content_mapped(int fd, size_t size, const char *pattern, size_t length)
+{
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return -1;
+
+    /* Read ahead aggressively, pages are touched once */
+    madvise(data, size, MADV_SEQUENTIAL);
+    int found = fsearch_content_find((const char*)data, size, pattern, length) != NULL;
+
+    munmap(data, size);
+    return found;
+}
+
+static int fsearch_content_read(int fd, const char *pattern, size_t length)
+{
+    size_t keep = 0;
+    off_t offset = 0;
+
+    /* Pattern must fit next to the carried over tail */
+    if (length > FSEARCH_CONTENT_BUFFER / 2)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (;;)
+    {
+        ssize_t count = pread(fd, &g_buffer[keep], FSEARCH_CONTENT_BUFFER - keep, offset);
+        if (count < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        if (!count) return 0;
+        offset += count;
+
+        size_t used = keep + (size_t)count;
+        if (fsearch_content_find(g_buffer, used, pattern, length) != NULL) return 1;
+
+        /* Keep last bytes, match may continue in the next chunk */
+        keep = length > 1 ? (used < length - 1 ? used : length - 1) : 0;
+        memmove(g_buffer, &g_buffer[used - keep], keep);
+    }
+}
+
+int fsearch_content_match(int dir_fd, const char *name, const char *pattern, size_t length)
+{
+    int fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat statbuf;
+    int found = -1;
+
+    if (fstat(fd, &statbuf) == 0)
+    {
+        if (!S_ISREG(statbuf.st_mode)) found = 0;
+        else if (!length) found = 1;
+        else if (statbuf.st_size >= FSEARCH_CONTENT_MMAP)
+        {
+            /* Map failure (e.g. special file systems) falls back to reads */
+            found = fsearch_content_mapped(fd, (size_t)statbuf.st_size, pattern, length);
+            if (found < 0) found = fsearch_content_read(fd, pattern, length);
+        }
+        else found = fsearch_content_read(fd, pattern, length);
+    }
+
+    int error = errno;
+    close(fd);
+    errno = error;
+    return found;
+}
@@ -0,0 +1,24 @@
+/*
+ *  src/content.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * File content search with vectorized substring kernels
+ */
+
+#ifndef __FSEARCH_CONTENT_H__
+#define __FSEARCH_CONTENT_H__
+
+#include <stddef.h>
+
+#define FSEARCH_CONTENT_BUFFER  (64 * 1024)     // Per thread read buffer
+#define FSEARCH_CONTENT_MMAP    (256 * 1024)    // Larger files are mapped
+
+/* Case sensitive, returns first occurrence or NULL */
+const char* fsearch_content_find(const char *haystack, size_t length, const char *needle, size_t needle_len);
+
+/* Returns 1 on first occurrence in file, 0 if there is none, -1 on error */
+int fsearch_content_match(int dir_fd, const char *name, const char *pattern, size_t length);
+
+#endif /* __FSEARCH_CONTENT_H__ */
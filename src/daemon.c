@@ -0,0 +1,1221 @@
+/*
+ *  src/daemon.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * In memory file tree kept up to date with file system
+ * notifications and queried over a local Unix socket
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // name_to_handle_at(), accept4()
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+#include "search.h"
+#include "dir.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/fanotify.h>
+
+/* File system wide marks need FID reporting with directory and name */
+#ifdef FAN_REPORT_DFID_NAME
+#define FSEARCH_USE_FANOTIFY
+#endif
+
+#define FSEARCH_DAEMON_MAGIC    0x46534451  // "FSDQ"
+#define FSEARCH_EVENT_BUFFER    (64 * 1024)
+#define FSEARCH_REQUEST_MAX     (64 * 1024)
+#define FSEARCH_REQUEST_ARGS    256
+#define FSEARCH_MOVES_MAX       64
+
+#define FSEARCH_INOTIFY_MASK    (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+    IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_DONT_FOLLOW | IN_EXCL_UNLINK | IN_ONLYDIR)
+
+#define FSEARCH_FANOTIFY_MASK   (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | \
+    FAN_ATTRIB | FAN_MODIFY | FAN_CLOSE_WRITE | FAN_ONDIR)
+
+typedef struct fsearch_node_ {
+    struct fsearch_node_ *parent;
+    struct fsearch_node_ *child;        // First child
+    struct fsearch_node_ *next;         // Next sibling
+    struct fsearch_node_ *prev;         // Previous sibling
+    struct fsearch_node_ *lnext;        // Next node in lookup bucket
+    struct fsearch_node_ *hnext;        // Next node in handle bucket
+    struct file_handle *handle;         // Directory handle (fanotify)
+    struct stat stat;
+    struct timespec synced;             // Directory mtime when it was last read
+    char *name;
+    size_t name_len;
+    unsigned int generation;            // Last directory sync that saw the node
+    int wd;                             // Watch descriptor (inotify)
+} fsearch_node_t;
+
+typedef struct fsearch_table_ {
+    fsearch_node_t **buckets;
+    size_t size;                        // Power of two
+    size_t count;
+} fsearch_table_t;
+
+typedef struct fsearch_move_ {
+    fsearch_node_t *pnode;              // Detached rename source
+    uint32_t cookie;
+} fsearch_move_t;
+
+typedef struct fsearch_daemon_ {
+    fsearch_cfg_t *pcfg;
+    fsearch_names_t *names;             // Owner names shared by queries
+    fsearch_node_t *root;
+    fsearch_table_t lookup;             // (parent, name) -> node
+    fsearch_table_t handles;            // Directory handle -> node
+    fsearch_node_t **watches;           // Watch descriptor -> node
+    size_t watch_size;
+    fsearch_move_t moves[FSEARCH_MOVES_MAX];
+    size_t move_count;
+    size_t nodes;
+    char root_path[PATH_MAX];           // Normalized, empty for "/"
+    size_t root_len;
+    unsigned int generation;
+    int watch_error;                    // Watch limit was already reported
+    int fanotify;
+    int notify_fd;
+    int listen_fd;
+} fsearch_daemon_t;
+
+typedef struct fsearch_request_ {
+    uint32_t magic;
+    uint32_t argc;                      // Arguments after working directory
+    uint32_t length;                    // Payload length
+} fsearch_request_t;
+
+typedef struct fsearch_reply_ {
+    int32_t status;
+    int32_t error;                      // errno when status is negative
+    int32_t found;
+} fsearch_reply_t;
+
+static int fsearch_daemon_sync(fsearch_daemon_t *pd, fsearch_node_t *pdir, int parent_fd,
+    const char *name, char *path, size_t length);
+
+static uint64_t fsearch_hash_bytes(uint64_t hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static uint64_t fsearch_lookup_hash(const fsearch_node_t *parent, const char *name, size_t length)
+{
+    uintptr_t key = (uintptr_t)parent;
+    uint64_t hash = fsearch_hash_bytes(14695981039346656037ULL, &key, sizeof(key));
+    return fsearch_hash_bytes(hash, name, length);
+}
+
+static uint64_t fsearch_handle_hash(const struct file_handle *handle)
+{
+    uint64_t hash = fsearch_hash_bytes(14695981039346656037ULL, &handle->handle_type, sizeof(handle->handle_type));
+    return fsearch_hash_bytes(hash, handle->f_handle, handle->handle_bytes);
+}
+
+static uint64_t fsearch_node_key(const fsearch_node_t *pnode, int handles)
+{
+    return handles ? fsearch_handle_hash(pnode->handle) :
+        fsearch_lookup_hash(pnode->parent, pnode->name, pnode->name_len);
+}
+
+static fsearch_node_t** fsearch_node_chain(fsearch_node_t *pnode, int handles)
+{
+    return handles ? &pnode->hnext : &pnode->lnext;
+}
+
+static int fsearch_table_insert(fsearch_table_t *ptable, fsearch_node_t *pnode, int handles)
+{
+    if (ptable->count >= ptable->size)
+    {
+        size_t i, size = ptable->size ? ptable->size * 2 : 1024;
+        fsearch_node_t **buckets = (fsearch_node_t**)calloc(size, sizeof(fsearch_node_t*));
+        if (buckets == NULL) return -1;
+
+        for (i = 0; i < ptable->size; i++)
+        {
+            fsearch_node_t *pentry = ptable->buckets[i];
+
+            while (pentry != NULL)
+            {
+                fsearch_node_t **pchain = fsearch_node_chain(pentry, handles);
+                fsearch_node_t *pnext = *pchain;
+                size_t slot = fsearch_node_key(pentry, handles) & (size - 1);
+
+                *pchain = buckets[slot];
+                buckets[slot] = pentry;
+                pentry = pnext;
+            }
+        }
+
+        free(ptable->buckets);
+        ptable->buckets = buckets;
+        ptable->size = size;
+    }
+
+    size_t slot = fsearch_node_key(pnode, handles) & (ptable->size - 1);
+    *fsearch_node_chain(pnode, handles) = ptable->buckets[slot];
+    ptable->buckets[slot] = pnode;
+    ptable->count++;
+    return 0;
+}
+
+static void fsearch_table_remove(fsearch_table_t *ptable, fsearch_node_t *pnode, int handles)
+{
+    if (!ptable->size) return;
+
+    /* Key depends on parent and name, remove before changing them */
+    fsearch_node_t **pchain = &ptable->buckets[fsearch_node_key(pnode, handles) & (ptable->size - 1)];
+    while (*pchain != NULL && *pchain != pnode) pchain = fsearch_node_chain(*pchain, handles);
+    if (*pchain == NULL) return;
+
+    *pchain = *fsearch_node_chain(pnode, handles);
+    ptable->count--;
+}
+
+static fsearch_node_t* fsearch_node_find(fsearch_daemon_t *pd, fsearch_node_t *parent, const char *name, size_t length)
+{
+    if (!pd->lookup.size) return NULL;
+    fsearch_node_t *pnode = pd->lookup.buckets[fsearch_lookup_hash(parent, name, length) & (pd->lookup.size - 1)];
+
+    for (; pnode != NULL; pnode = pnode->lnext)
+        if (pnode->parent == parent && pnode->name_len == length &&
+            !memcmp(pnode->name, name, length)) return pnode;
+
+    return NULL;
+}
+
+static fsearch_node_t* fsearch_handle_find(fsearch_daemon_t *pd, const struct file_handle *handle)
+{
+    if (!pd->handles.size) return NULL;
+    fsearch_node_t *pnode = pd->handles.buckets[fsearch_handle_hash(handle) & (pd->handles.size - 1)];
+
+    for (; pnode != NULL; pnode = pnode->hnext)
+        if (pnode->handle->handle_type == handle->handle_type &&
+            pnode->handle->handle_bytes == handle->handle_bytes &&
+            !memcmp(pnode->handle->f_handle, handle->f_handle, handle->handle_bytes)) return pnode;
+
+    return NULL;
+}
+
+static int fsearch_node_attach(fsearch_daemon_t *pd, fsearch_node_t *parent, fsearch_node_t *pnode)
+{
+    pnode->parent = parent;
+
+    if (fsearch_table_insert(&pd->lookup, pnode, 0) < 0)
+    {
+        pnode->parent = NULL;
+        return -1;
+    }
+
+    pnode->prev = NULL;
+    pnode->next = parent->child;
+
+    if (parent->child != NULL) parent->child->prev = pnode;
+    parent->child = pnode;
+    return 0;
+}
+
+static void fsearch_node_detach(fsearch_daemon_t *pd, fsearch_node_t *pnode)
+{
+    if (pnode->parent == NULL) return;
+    fsearch_table_remove(&pd->lookup, pnode, 0);
+
+    if (pnode->prev != NULL) pnode->prev->next = pnode->next;
+    else pnode->parent->child = pnode->next;
+    if (pnode->next != NULL) pnode->next->prev = pnode->prev;
+
+    pnode->parent = pnode->next = pnode->prev = NULL;
+}
+
+static fsearch_node_t* fsearch_node_create(fsearch_daemon_t *pd, fsearch_node_t *parent,
+    const char *name, size_t length, const struct stat *pstat)
+{
+    fsearch_node_t *pnode = (fsearch_node_t*)calloc(1, sizeof(fsearch_node_t));
+    if (pnode == NULL) return NULL;
+
+    pnode->name = (char*)malloc(length + 1);
+    if (pnode->name == NULL)
+    {
+        free(pnode);
+        return NULL;
+    }
+
+    memcpy(pnode->name, name, length);
+    pnode->name[length] = '\0';
+    pnode->name_len = length;
+    pnode->stat = *pstat;
+    pnode->wd = -1;
+
+    if (parent != NULL && fsearch_node_attach(pd, parent, pnode) < 0)
+    {
+        free(pnode->name);
+        free(pnode);
+        return NULL;
+    }
+
+    pd->nodes++;
+    return pnode;
+}
+
+static void fsearch_node_unwatch(fsearch_daemon_t *pd, fsearch_node_t *pnode)
+{
+    if (pnode->wd >= 0)
+    {
+        inotify_rm_watch(pd->notify_fd, pnode->wd);
+        if ((size_t)pnode->wd < pd->watch_size && pd->watches[pnode->wd] == pnode) pd->watches[pnode->wd] = NULL;
+        pnode->wd = -1;
+    }
+
+    if (pnode->handle != NULL)
+    {
+        fsearch_table_remove(&pd->handles, pnode, 1);
+        free(pnode->handle);
+        pnode->handle = NULL;
+    }
+}
+
+static void fsearch_node_destroy(fsearch_daemon_t *pd, fsearch_node_t *pnode)
+{
+    while (pnode->child != NULL) fsearch_node_destroy(pd, pnode->child);
+
+    fsearch_node_unwatch(pd, pnode);
+    fsearch_node_detach(pd, pnode);
+
+    free(pnode->name);
+    free(pnode);
+    pd->nodes--;
+}
+
+static void fsearch_node_watch(fsearch_daemon_t *pd, fsearch_node_t *pnode, int dir_fd, const char *path)
+{
+    if (pd->fanotify)
+    {
+        if (pnode->handle != NULL) return;
+        int mount_id;
+
+        struct file_handle *handle = (struct file_handle*)malloc(sizeof(struct file_handle) + MAX_HANDLE_SZ);
+        if (handle == NULL) return;
+        handle->handle_bytes = MAX_HANDLE_SZ;
+
+        /* Events name the parent directory by its file handle */
+        if (name_to_handle_at(dir_fd, "", handle, &mount_id, AT_EMPTY_PATH) < 0)
+        {
+            free(handle);
+            return;
+        }
+
+        pnode->handle = handle;
+        if (fsearch_table_insert(&pd->handles, pnode, 1) < 0)
+        {
+            free(handle);
+            pnode->handle = NULL;
+        }
+
+        return;
+    }
+
+    if (pnode->wd >= 0) return;
+    int wd = inotify_add_watch(pd->notify_fd, path, FSEARCH_INOTIFY_MASK);
+
+    if (wd < 0)
+    {
+        /* Usually max_user_watches, report it once */
+        if (!pd->watch_error) fsearch_log_error(pd->pcfg, path);
+        pd->watch_error = 1;
+        return;
+    }
+
+    if ((size_t)wd >= pd->watch_size)
+    {
+        size_t size = pd->watch_size ? pd->watch_size : 1024;
+        while (size <= (size_t)wd) size *= 2;
+
+        fsearch_node_t **watches = (fsearch_node_t**)realloc(pd->watches, size * sizeof(fsearch_node_t*));
+        if (watches == NULL)
+        {
+            inotify_rm_watch(pd->notify_fd, wd);
+            return;
+        }
+
+        memset(&watches[pd->watch_size], 0, (size - pd->watch_size) * sizeof(fsearch_node_t*));
+        pd->watches = watches;
+        pd->watch_size = size;
+    }
+
+    pd->watches[wd] = pnode;
+    pnode->wd = wd;
+}
+
+static size_t fsearch_node_path(fsearch_daemon_t *pd, const fsearch_node_t *pnode, char *path, size_t size)
+{
+    if (pnode == pd->root)
+    {
+        size_t length = pnode->name_len;
+        if (length >= size) return 0;
+
+        memcpy(path, pnode->name, length + 1);
+        return length;
+    }
+
+    /* Detached rename sources have no path */
+    if (pnode->parent == NULL) return 0;
+
+    size_t length = fsearch_node_path(pd, pnode->parent, path, size);
+    if (!length) return 0;
+
+    if (path[length - 1] != '/') path[length++] = '/';
+    if (length + pnode->name_len >= size) return 0;
+
+    memcpy(&path[length], pnode->name, pnode->name_len + 1);
+    return length + pnode->name_len;
+}
+
+static int fsearch_node_same(const fsearch_node_t *pnode, const struct stat *pstat)
+{
+    return pnode->stat.st_ino == pstat->st_ino &&
+        pnode->stat.st_dev == pstat->st_dev &&
+        (pnode->stat.st_mode & S_IFMT) == (pstat->st_mode & S_IFMT);
+}
+
+/*
+    Bring one entry of a directory in sync with the file system.
+    Name NULL refreshes directory attributes only.
+*/
+static void fsearch_daemon_update(fsearch_daemon_t *pd, fsearch_node_t *pdir, const char *name)
+{
+    char path[FSEARCH_FULL_PATH_LEN];
+    size_t length = fsearch_node_path(pd, pdir, path, sizeof(path));
+    if (!length) return;
+
+    struct stat statbuf;
+    if (lstat(path, &statbuf) == 0) pdir->stat = statbuf;
+    if (name == NULL) return;
+
+    size_t name_len = strlen(name);
+    size_t offset = path[length - 1] == '/' ? length : length + 1;
+    if (offset + name_len >= sizeof(path)) return;
+
+    path[offset - 1] = '/';
+    memcpy(&path[offset], name, name_len + 1);
+
+    fsearch_node_t *pnode = fsearch_node_find(pd, pdir, name, name_len);
+
+    /* Event order does not matter, file system has the last word */
+    if (lstat(path, &statbuf) < 0)
+    {
+        if (pnode != NULL) fsearch_node_destroy(pd, pnode);
+        return;
+    }
+
+    if (pnode != NULL && fsearch_node_same(pnode, &statbuf))
+    {
+        pnode->stat = statbuf;
+        return;
+    }
+
+    /* Entry is new or was replaced by another file */
+    if (pnode != NULL) fsearch_node_destroy(pd, pnode);
+    pnode = fsearch_node_create(pd, pdir, name, name_len, &statbuf);
+
+    if (pnode != NULL && S_ISDIR(statbuf.st_mode) &&
+        fsearch_daemon_sync(pd, pnode, AT_FDCWD, path, path, offset + name_len) < 0)
+        fsearch_log_error(pd->pcfg, path);
+}
+
+static void fsearch_daemon_moves_flush(fsearch_daemon_t *pd)
+{
+    /* Sources without a target were moved out of the tree */
+    while (pd->move_count > 0) fsearch_node_destroy(pd, pd->moves[--pd->move_count].pnode);
+}
+
+static void fsearch_daemon_move_from(fsearch_daemon_t *pd, fsearch_node_t *pdir, const char *name, uint32_t cookie)
+{
+    fsearch_node_t *pnode = fsearch_node_find(pd, pdir, name, strlen(name));
+
+    if (pnode != NULL)
+    {
+        if (pd->move_count == FSEARCH_MOVES_MAX) fsearch_daemon_moves_flush(pd);
+
+        /* Keep subtree and its watches until the target shows up */
+        fsearch_node_detach(pd, pnode);
+        pd->moves[pd->move_count].pnode = pnode;
+        pd->moves[pd->move_count].cookie = cookie;
+        pd->move_count++;
+    }
+
+    fsearch_daemon_update(pd, pdir, NULL);
+}
+
+static int fsearch_daemon_move_to(fsearch_daemon_t *pd, fsearch_node_t *pdir, const char *name, uint32_t cookie)
+{
+    size_t i, name_len = strlen(name);
+
+    for (i = 0; i < pd->move_count; i++)
+        if (pd->moves[i].cookie == cookie) break;
+
+    if (i == pd->move_count) return 0;
+    fsearch_node_t *pnode = pd->moves[i].pnode;
+    pd->moves[i] = pd->moves[--pd->move_count];
+
+    char *new_name = (char*)malloc(name_len + 1);
+    if (new_name == NULL)
+    {
+        fsearch_node_destroy(pd, pnode);
+        return 0;
+    }
+
+    /* Overwritten target goes away, renamed node keeps its subtree */
+    fsearch_node_t *ptarget = fsearch_node_find(pd, pdir, name, name_len);
+    if (ptarget != NULL) fsearch_node_destroy(pd, ptarget);
+
+    memcpy(new_name, name, name_len + 1);
+    free(pnode->name);
+    pnode->name = new_name;
+    pnode->name_len = name_len;
+
+    if (fsearch_node_attach(pd, pdir, pnode) < 0)
+    {
+        fsearch_node_destroy(pd, pnode);
+        return 0;
+    }
+
+    fsearch_daemon_update(pd, pdir, name);
+    return 1;
+}
+
+static int fsearch_daemon_sync(fsearch_daemon_t *pd, fsearch_node_t *pdir, int parent_fd,
+    const char *name, char *path, size_t length)
+{
+    fsearch_dir_t dir;
+    if (fsearch_dir_open(&dir, parent_fd, name, parent_fd == AT_FDCWD) < 0) return -1;
+
+    /* Watch first, changes made while reading are not lost */
+    fsearch_node_watch(pd, pdir, dir.fd, path);
+
+    struct stat statbuf;
+    if (fstat(dir.fd, &statbuf) == 0) pdir->synced = statbuf.st_mtim;
+
+    size_t offset = (length && path[length - 1] == '/') ? length : length + 1;
+    unsigned int generation = ++pd->generation;
+    const fsearch_entry_t *entry = NULL;
+
+    while ((entry = fsearch_dir_read(&dir)) != NULL)
+    {
+        if (fsearch_dir_stat(&dir, entry->name, &statbuf, 0) < 0) continue;
+        fsearch_node_t *pnode = fsearch_node_find(pd, pdir, entry->name, entry->name_len);
+        if (pnode != NULL && fsearch_node_same(pnode, &statbuf))
+        {
+            pnode->stat = statbuf;
+            pnode->generation = generation;
+            continue;
+        }
+
+        if (pnode != NULL) fsearch_node_destroy(pd, pnode);
+        pnode = fsearch_node_create(pd, pdir, entry->name, entry->name_len, &statbuf);
+        if (pnode == NULL) continue;
+
+        pnode->generation = generation;
+        if (!S_ISDIR(statbuf.st_mode) || offset + entry->name_len >= FSEARCH_FULL_PATH_LEN) continue;
+
+        path[offset - 1] = '/';
+        memcpy(&path[offset], entry->name, entry->name_len + 1);
+
+        /* New directories are read completely */
+        if (fsearch_daemon_sync(pd, pnode, dir.fd, entry->name, path, offset + entry->name_len) < 0)
+            fsearch_log_error(pd->pcfg, path);
+
+        path[length] = '\0';
+    }
+
+    fsearch_dir_close(&dir);
+    fsearch_node_t *pnode = pdir->child;
+
+    while (pnode != NULL)
+    {
+        fsearch_node_t *pnext = pnode->next;
+        if (pnode->generation != generation) fsearch_node_destroy(pd, pnode);
+        pnode = pnext;
+    }
+
+    return 0;
+}
+
+/*
+    Events were lost, walk directories and read again only those
+    whose modification time changed since they were last read.
+    Events applied before the overflow do not count as a read.
+*/
+static void fsearch_daemon_revalidate(fsearch_daemon_t *pd, fsearch_node_t *pdir, char *path, size_t length)
+{
+    struct stat statbuf;
+
+    if (lstat(path, &statbuf) < 0 || !S_ISDIR(statbuf.st_mode))
+    {
+        if (pdir != pd->root) fsearch_node_destroy(pd, pdir);
+        return;
+    }
+
+    int changed = !fsearch_node_same(pdir, &statbuf) ||
+        pdir->synced.tv_sec != statbuf.st_mtim.tv_sec ||
+        pdir->synced.tv_nsec != statbuf.st_mtim.tv_nsec;
+
+    pdir->stat = statbuf;
+    if (changed && fsearch_daemon_sync(pd, pdir, AT_FDCWD, path, path, length) < 0) return;
+
+    size_t offset = path[length - 1] == '/' ? length : length + 1;
+    fsearch_node_t *pnode = pdir->child;
+
+    while (pnode != NULL)
+    {
+        fsearch_node_t *pnext = pnode->next;
+
+        if (S_ISDIR(pnode->stat.st_mode) && offset + pnode->name_len < FSEARCH_FULL_PATH_LEN)
+        {
+            path[offset - 1] = '/';
+            memcpy(&path[offset], pnode->name, pnode->name_len + 1);
+            fsearch_daemon_revalidate(pd, pnode, path, offset + pnode->name_len);
+            path[length] = '\0';
+        }
+
+        pnode = pnext;
+    }
+}
+
+static void fsearch_daemon_overflow(fsearch_daemon_t *pd)
+{
+    char path[FSEARCH_FULL_PATH_LEN];
+    size_t length = fsearch_node_path(pd, pd->root, path, sizeof(path));
+    if (length) fsearch_daemon_revalidate(pd, pd->root, path, length);
+}
+
+static void fsearch_daemon_inotify(fsearch_daemon_t *pd)
+{
+    char buffer[FSEARCH_EVENT_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int overflow = 0;
+
+    for (;;)
+    {
+        ssize_t length = read(pd->notify_fd, buffer, sizeof(buffer));
+        if (length <= 0) break;
+
+        const char *pos = buffer;
+        const char *end = buffer + length;
+
+        while (pos < end)
+        {
+            const struct inotify_event *event = (const struct inotify_event*)pos;
+            pos += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                overflow = 1;
+                continue;
+            }
+
+            fsearch_node_t *pdir = (event->wd >= 0 && (size_t)event->wd < pd->watch_size) ?
+                pd->watches[event->wd] : NULL;
+            if (pdir == NULL) continue;
+
+            if (event->mask & IN_IGNORED)
+            {
+                /* Directory is gone, its parent gets the delete event */
+                pd->watches[event->wd] = NULL;
+                pdir->wd = -1;
+                continue;
+            }
+
+            const char *name = event->len ? event->name : NULL;
+            if (name != NULL && (event->mask & IN_MOVED_FROM)) fsearch_daemon_move_from(pd, pdir, name, event->cookie);
+            else if (name == NULL || !(event->mask & IN_MOVED_TO) ||
+                !fsearch_daemon_move_to(pd, pdir, name, event->cookie)) fsearch_daemon_update(pd, pdir, name);
+        }
+
+        fsearch_daemon_moves_flush(pd);
+    }
+
+    if (overflow) fsearch_daemon_overflow(pd);
+}
+
+#ifdef FSEARCH_USE_FANOTIFY
+static void fsearch_daemon_fanotify(fsearch_daemon_t *pd)
+{
+    char buffer[FSEARCH_EVENT_BUFFER] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+    int overflow = 0;
+
+    for (;;)
+    {
+        ssize_t length = read(pd->notify_fd, buffer, sizeof(buffer));
+        if (length <= 0) break;
+
+        const struct fanotify_event_metadata *meta = (const struct fanotify_event_metadata*)buffer;
+
+        for (; FAN_EVENT_OK(meta, length); meta = FAN_EVENT_NEXT(meta, length))
+        {
+            if (meta->fd >= 0) close(meta->fd);
+
+            if (meta->mask & FAN_Q_OVERFLOW)
+            {
+                overflow = 1;
+                continue;
+            }
+
+            const struct fanotify_event_info_fid *fid = (const struct fanotify_event_info_fid*)(meta + 1);
+            if (meta->event_len < sizeof(*meta) + sizeof(*fid) ||
+                fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) continue;
+
+            /* Parent directory handle followed by entry name */
+            const struct file_handle *handle = (const struct file_handle*)fid->handle;
+            const char *name = (const char*)handle->f_handle + handle->handle_bytes;
+
+            /* Marks cover the whole file system, skip other trees */
+            fsearch_node_t *pdir = fsearch_handle_find(pd, handle);
+            if (pdir != NULL) fsearch_daemon_update(pd, pdir, strcmp(name, ".") ? name : NULL);
+        }
+    }
+
+    if (overflow) fsearch_daemon_overflow(pd);
+}
+#endif
+
+static int fsearch_daemon_notify(fsearch_daemon_t *pd, const char *root)
+{
+#ifdef FSEARCH_USE_FANOTIFY
+    /* Single mark for the whole file system, needs CAP_SYS_ADMIN */
+    pd->notify_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_CLOEXEC);
+    if (pd->notify_fd >= 0)
+    {
+        if (!fanotify_mark(pd->notify_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FSEARCH_FANOTIFY_MASK, AT_FDCWD, root))
+        {
+            pd->fanotify = 1;
+            return 0;
+        }
+
+        close(pd->notify_fd);
+    }
+#else
+    (void)root;
+#endif
+
+    pd->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return pd->notify_fd < 0 ? -1 : 0;
+}
+
+static size_t fsearch_path_normalize(const char *path, char *output, size_t size)
+{
+    size_t length = 0;
+
+    while (*path)
+    {
+        while (*path == '/') path++;
+        const char *start = path;
+
+        while (*path && *path != '/') path++;
+        size_t part = (size_t)(path - start);
+
+        if (!part || (part == 1 && start[0] == '.')) continue;
+
+        if (part == 2 && start[0] == '.' && start[1] == '.')
+        {
+            while (length > 0 && output[length - 1] != '/') length--;
+            if (length > 0) length--;
+            continue;
+        }
+
+        if (length + part + 2 > size) return (size_t)-1;
+        output[length++] = '/';
+        memcpy(&output[length], start, part);
+        length += part;
+    }
+
+    /* Root directory is an empty string */
+    output[length] = '\0';
+    return length;
+}
+
+static fsearch_node_t* fsearch_daemon_resolve(fsearch_daemon_t *pd, const char *cwd, const char *directory)
+{
+    char path[FSEARCH_FULL_PATH_LEN], normal[FSEARCH_FULL_PATH_LEN];
+    int length = directory[0] == '/' ?
+        snprintf(path, sizeof(path), "%s", directory) :
+        snprintf(path, sizeof(path), "%s/%s", cwd, directory);
+
+    if (length < 0 || (size_t)length >= sizeof(path)) return NULL;
+    size_t normal_len = fsearch_path_normalize(path, normal, sizeof(normal));
+
+    if (normal_len == (size_t)-1 || normal_len < pd->root_len ||
+        memcmp(normal, pd->root_path, pd->root_len) ||
+        (normal[pd->root_len] != '/' && normal[pd->root_len] != '\0')) return NULL;
+
+    fsearch_node_t *pnode = pd->root;
+    const char *pos = &normal[pd->root_len];
+
+    while (*pos && pnode != NULL)
+    {
+        const char *start = ++pos;
+        while (*pos && *pos != '/') pos++;
+        pnode = fsearch_node_find(pd, pnode, start, (size_t)(pos - start));
+    }
+
+    return pnode;
+}
+
+static void fsearch_daemon_walk(fsearch_cfg_t *pcfg, fsearch_node_t *pdir, char *path, size_t length)
+{
+    size_t offset = (length && path[length - 1] == '/') ? length : length + 1;
+    fsearch_node_t *pnode;
+
+    for (pnode = pdir->child; pnode != NULL; pnode = pnode->next)
+    {
+        if (fsearch_search_stopped(pcfg)) break;
+        if (offset + pnode->name_len >= FSEARCH_FULL_PATH_LEN) continue;
+
+        path[offset - 1] = '/';
+        memcpy(&path[offset], pnode->name, pnode->name_len + 1);
+
+        if (fsearch_check_entry(pcfg, pnode->name, pnode->name_len, &pnode->stat) &&
+            fsearch_check_content(pcfg, AT_FDCWD, path, path, &pnode->stat))
+            fsearch_report_match(pcfg, &pnode->stat, path, length);
+
+        if (pcfg->recursive && pnode->child != NULL)
+            fsearch_daemon_walk(pcfg, pnode, path, offset + pnode->name_len);
+
+        path[length] = '\0';
+    }
+}
+
+/* Answer a query from memory, results go to descriptors of the client */
+static int fsearch_daemon_search(fsearch_daemon_t *pd, const char *cwd, int argc, char *argv[],
+    const int *fds, int fd_count, fsearch_reply_t *preply)
+{
+    fsearch_cfg_t config;
+    config.interrupted = pd->pcfg->interrupted;
+
+    /* Zero makes getopt drop state left by the previous query */
+    optind = 0;
+
+    if (!fsearch_parse_args(&config, argc, argv) ||
+        fsearch_output_attach(&config.writer, fds, fd_count) < 0)
+    {
+        int i;
+        for (i = 0; i < fd_count; i++) close(fds[i]);
+
+        fsearch_config_destroy(&config);
+        preply->error = EINVAL;
+        return -1;
+    }
+
+    /* Owner names stay cached between queries */
+    if (config.names != NULL)
+    {
+        if (pd->names == NULL) pd->names = config.names;
+        else fsearch_names_destroy(config.names);
+        config.names = pd->names;
+    }
+
+    fsearch_node_t *pscope = pd->root;
+    char path[FSEARCH_FULL_PATH_LEN];
+    size_t length = 0;
+    int status = -1;
+
+    if (strcmp(config.directory, "./")) pscope = fsearch_daemon_resolve(pd, cwd, config.directory);
+
+    if (pscope == NULL) preply->error = ENOENT;
+    else if (!S_ISDIR(pscope->stat.st_mode)) preply->error = ENOTDIR;
+    else if (!(length = fsearch_node_path(pd, pscope, path, sizeof(path)))) preply->error = ENAMETOOLONG;
+    else
+    {
+        fsearch_daemon_walk(&config, pscope, path, length);
+        status = 1;
+    }
+
+    preply->found = config.is_found ? 1 : 0;
+    config.names = NULL;
+
+    fsearch_output_close(&config.writer);
+    fsearch_config_destroy(&config);
+    return status;
+}
+
+static int fsearch_daemon_receive(int fd, fsearch_request_t *prequest, int *fds, int *pcount)
+{
+    char control[CMSG_SPACE(sizeof(int) * FSEARCH_OUTPUT_FDS)];
+    struct iovec iov = { prequest, sizeof(fsearch_request_t) };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t length = recvmsg(fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    struct cmsghdr *cmsg;
+
+    *pcount = 0;
+    if (length < 0) return -1;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        if (count > FSEARCH_OUTPUT_FDS) count = FSEARCH_OUTPUT_FDS;
+
+        memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+        *pcount = count;
+    }
+
+    if (length != (ssize_t)sizeof(fsearch_request_t) || (msg.msg_flags & MSG_CTRUNC) ||
+        prequest->magic != FSEARCH_DAEMON_MAGIC || !prequest->argc ||
+        prequest->argc > FSEARCH_REQUEST_ARGS || prequest->length > FSEARCH_REQUEST_MAX) return -1;
+
+    return 0;
+}
+
+static void fsearch_daemon_serve(fsearch_daemon_t *pd)
+{
+    int fd = accept4(pd->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) return;
+
+    /* Stalled client must not block file system events */
+    struct timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    fsearch_reply_t reply = { -1, EPROTO, 0 };
+    fsearch_request_t request;
+    char *payload = NULL;
+    int fds[FSEARCH_OUTPUT_FDS];
+    int i, fd_count = 0;
+
+    if (fsearch_daemon_receive(fd, &request, fds, &fd_count) == 0 && fd_count > 0 &&
+        (payload = (char*)malloc(request.length + 1)) != NULL &&
+        recv(fd, payload, request.length, MSG_WAITALL) == (ssize_t)request.length)
+    {
+        /* Working directory followed by argv, all NUL terminated */
+        char *argv[FSEARCH_REQUEST_ARGS + 1];
+        char *pos = payload, *end = payload + request.length;
+        int argc = -1;
+
+        payload[request.length] = '\0';
+        const char *cwd = pos;
+        pos += strlen(pos) + 1;
+
+        while (pos < end && argc + 1 < (int)request.argc)
+        {
+            argv[++argc] = pos;
+            pos += strlen(pos) + 1;
+        }
+
+        if (++argc == (int)request.argc && pos == end)
+        {
+            argv[argc] = NULL;
+            reply.status = fsearch_daemon_search(pd, cwd, argc, argv, fds, fd_count, &reply);
+            fd_count = 0;
+        }
+    }
+
+    for (i = 0; i < fd_count; i++) close(fds[i]);
+    send(fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+
+    free(payload);
+    close(fd);
+}
+
+static int fsearch_daemon_listen(fsearch_daemon_t *pd, const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    pd->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (pd->listen_fd < 0) return -1;
+
+    /* Replace stale socket, but not one of a running daemon */
+    if (!connect(pd->listen_fd, (struct sockaddr*)&addr, sizeof(addr)))
+    {
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    if (errno == ECONNREFUSED) unlink(path);
+    close(pd->listen_fd);
+
+    pd->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (pd->listen_fd < 0) return -1;
+
+    if (bind(pd->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(pd->listen_fd, SOMAXCONN) < 0) return -1;
+
+    return 0;
+}
+
+static int fsearch_daemon_start(fsearch_daemon_t *pd, const char *path)
+{
+    char root[PATH_MAX];
+    struct stat statbuf;
+
+    if (realpath(pd->pcfg->directory, root) == NULL || stat(root, &statbuf) < 0)
+    {
+        fsearch_log_error(pd->pcfg, pd->pcfg->directory);
+        return -1;
+    }
+
+    if (!S_ISDIR(statbuf.st_mode))
+    {
+        errno = ENOTDIR;
+        fsearch_log_error(pd->pcfg, pd->pcfg->directory);
+        return -1;
+    }
+
+    pd->root_len = fsearch_path_normalize(root, pd->root_path, sizeof(pd->root_path));
+    pd->root = fsearch_node_create(pd, NULL, root, strlen(root), &statbuf);
+
+    if (pd->root == NULL || fsearch_daemon_notify(pd, root) < 0)
+    {
+        fsearch_log_error(pd->pcfg, root);
+        return -1;
+    }
+
+    char buffer[FSEARCH_FULL_PATH_LEN];
+    memcpy(buffer, root, strlen(root) + 1);
+
+    if (fsearch_daemon_sync(pd, pd->root, AT_FDCWD, root, buffer, strlen(root)) < 0)
+    {
+        fsearch_log_error(pd->pcfg, root);
+        return -1;
+    }
+
+    if (fsearch_daemon_listen(pd, path) < 0)
+    {
+        fsearch_log_error(pd->pcfg, path);
+        return -1;
+    }
+
+    printf("Watching %zu entries in %s (%s), listening on %s\n", pd->nodes - 1,
+        root, pd->fanotify ? "fanotify" : "inotify", path);
+
+    fflush(stdout);
+    return 0;
+}
+
+int fsearch_daemon_run(fsearch_cfg_t *pcfg, const char *path)
+{
+    fsearch_daemon_t daemon;
+    memset(&daemon, 0, sizeof(daemon));
+    daemon.pcfg = pcfg;
+    daemon.notify_fd = -1;
+    daemon.listen_fd = -1;
+
+    /* Clients may go away while results are written */
+    signal(SIGPIPE, SIG_IGN);
+    int status = fsearch_daemon_start(&daemon, path);
+
+    struct pollfd pfds[2];
+    pfds[0].fd = daemon.notify_fd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = daemon.listen_fd;
+    pfds[1].events = POLLIN;
+
+    while (!status && !__sync_add_and_fetch(pcfg->interrupted, 0))
+    {
+        if (poll(pfds, 2, -1) < 0)
+        {
+            if (errno == EINTR) continue;
+            fsearch_log_error(pcfg, path);
+            status = -1;
+            break;
+        }
+
+        /* Apply pending changes before answering queries */
+        if (pfds[0].revents & POLLIN)
+        {
+#ifdef FSEARCH_USE_FANOTIFY
+            if (daemon.fanotify) fsearch_daemon_fanotify(&daemon);
+            else
+#endif
+            fsearch_daemon_inotify(&daemon);
+        }
+
+        if (pfds[1].revents & POLLIN) fsearch_daemon_serve(&daemon);
+    }
+
+    if (daemon.listen_fd >= 0)
+    {
+        close(daemon.listen_fd);
+        if (!status) unlink(path);
+    }
+
+    fsearch_daemon_moves_flush(&daemon);
+    if (daemon.root != NULL) fsearch_node_destroy(&daemon, daemon.root);
+    if (daemon.notify_fd >= 0) close(daemon.notify_fd);
+
+    fsearch_names_destroy(daemon.names);
+    free(daemon.lookup.buckets);
+    free(daemon.handles.buckets);
+    free(daemon.watches);
+
+    if (status < 0) return -1;
+    pcfg->is_found = 1;
+    return 1;
+}
+
+int fsearch_daemon_query(fsearch_cfg_t *pcfg, const char *path, int argc, char *argv[])
+{
+    char *payload = (char*)malloc(FSEARCH_REQUEST_MAX);
+    if (payload == NULL)
+    {
+        fsearch_log_error(pcfg, path);
+        return -1;
+    }
+
+    /* Relative target paths are resolved by daemon */
+    size_t length = 0;
+    int i;
+
+    if (getcwd(payload, FSEARCH_REQUEST_MAX) == NULL)
+    {
+        fsearch_log_error(pcfg, ".");
+        free(payload);
+        return -1;
+    }
+
+    length = strlen(payload) + 1;
+
+    for (i = 0; i < argc; i++)
+    {
+        size_t arg_len = strlen(argv[i]) + 1;
+
+        if (argc > FSEARCH_REQUEST_ARGS || length + arg_len > FSEARCH_REQUEST_MAX)
+        {
+            errno = E2BIG;
+            fsearch_log_error(pcfg, path);
+            free(payload);
+            return -1;
+        }
+
+        memcpy(&payload[length], argv[i], arg_len);
+        length += arg_len;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || strlen(path) >= sizeof(addr.sun_path) ||
+        connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        if (strlen(path) >= sizeof(addr.sun_path)) errno = ENAMETOOLONG;
+        fsearch_log_error(pcfg, path);
+        if (fd >= 0) close(fd);
+        free(payload);
+        return -1;
+    }
+
+    fsearch_request_t request;
+    request.magic = FSEARCH_DAEMON_MAGIC;
+    request.argc = (uint32_t)argc;
+    request.length = (uint32_t)length;
+
+    /* Daemon writes results straight to our stdout and output file */
+    char control[CMSG_SPACE(sizeof(int) * FSEARCH_OUTPUT_FDS)];
+    struct iovec iov[2] = { { &request, sizeof(request) }, { payload, length } };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * pcfg->writer.count);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * pcfg->writer.count);
+    memcpy(CMSG_DATA(cmsg), pcfg->writer.fds, sizeof(int) * pcfg->writer.count);
+
+    fsearch_reply_t reply;
+    ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    free(payload);
+
+    if (sent != (ssize_t)(sizeof(request) + length) ||
+        recv(fd, &reply, sizeof(reply), MSG_WAITALL) != (ssize_t)sizeof(reply))
+    {
+        if (sent >= 0) errno = EPROTO;
+        fsearch_log_error(pcfg, path);
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+
+    if (reply.status < 0)
+    {
+        errno = reply.error;
+        fsearch_log_error(pcfg, pcfg->directory);
+        return -1;
+    }
+
+    pcfg->is_found = reply.found;
+    return 1;
+}
+
+#else
+
+int fsearch_daemon_run(fsearch_cfg_t *pcfg, const char *path)
+{
+    /* File system notifications are only implemented for Linux */
+    errno = ENOSYS;
+    fsearch_log_error(pcfg, path);
+    return -1;
+}
+
+int fsearch_daemon_query(fsearch_cfg_t *pcfg, const char *path, int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+    errno = ENOSYS;
+    fsearch_log_error(pcfg, path);
+    return -1;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,19 @@
+/*
+ *  src/daemon.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * In memory file tree kept up to date with file system
+ * notifications and queried over a local Unix socket
+ */
+
+#ifndef __FSEARCH_DAEMON_H__
+#define __FSEARCH_DAEMON_H__
+
+#include "config.h"
+
+int fsearch_daemon_run(fsearch_cfg_t *pcfg, const char *path);
+int fsearch_daemon_query(fsearch_cfg_t *pcfg, const char *path, int argc, char *argv[]);
+
+#endif /* __FSEARCH_DAEMON_H__ */
@@ -0,0 +1,316 @@
+/*
+ *  src/dir.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * Directory reader working relative to open
+ * descriptors with batched entry reading
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "dir.h"
+
+#ifdef __linux__
+/* Raw record layout returned by getdents64 */
+struct fsearch_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+static int fsearch_dir_skip(const char *name)
+{
+    /* Ignore . and .. entries */
+    return name[0] == '.' && (name[1] == '\0' ||
+        (name[1] == '.' && name[2] == '\0'));
+}
+
+int fsearch_dir_open(fsearch_dir_t *pdir, int parent_fd, const char *name, int follow)
+{
+    int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+
+    /* Entry may be replaced by a link after it was checked with lstat */
+    if (!follow) flags |= O_NOFOLLOW;
+
+    int fd = openat(parent_fd, name, flags);
+    if (fd < 0) return -1;
+
+#ifdef __linux__
+    pdir->buffer = (char*)malloc(FSEARCH_DIR_BUFFER_SIZE);
+    if (pdir->buffer == NULL)
+    {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pdir->offset = pdir->length = 0;
+#else
+    pdir->pdir = fdopendir(fd);
+    if (pdir->pdir == NULL)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+#endif
+
+    pdir->fd = fd;
+    pdir->position = 0;
+    pdir->sorted = NULL;
+    pdir->names = NULL;
+    return 0;
+}
+
+const fsearch_entry_t* fsearch_dir_read(fsearch_dir_t *pdir)
+{
+    if (pdir->fd < 0) return NULL;
+
+    if (pdir->sorted != NULL)
+    {
+        if (pdir->sorted_next >= pdir->sorted_count) return NULL;
+        pdir->entry = pdir->sorted[pdir->sorted_next++];
+        return &pdir->entry;
+    }
+
+#ifdef __linux__
+    for (;;)
+    {
+        if (pdir->offset >= pdir->length)
+        {
+            /* Read next batch of entries with a single syscall */
+            long length = syscall(SYS_getdents64, pdir->fd, pdir->buffer, FSEARCH_DIR_BUFFER_SIZE);
+            if (length <= 0) return NULL;
+
+            pdir->length = (size_t)length;
+            pdir->offset = 0;
+        }
+
+        struct fsearch_dirent64 *pent = (struct fsearch_dirent64*)&pdir->buffer[pdir->offset];
+        pdir->offset += pent->d_reclen;
+        pdir->position = (long)pent->d_off;
+        if (fsearch_dir_skip(pent->d_name)) continue;
+
+        pdir->entry.name = pent->d_name;
+        pdir->entry.name_len = strlen(pent->d_name);
+        pdir->entry.inode = (ino_t)pent->d_ino;
+        pdir->entry.type = pent->d_type;
+        return &pdir->entry;
+    }
+#else
+    struct dirent *pent;
+
+    while ((pent = readdir(pdir->pdir)) != NULL)
+    {
+        if (fsearch_dir_skip(pent->d_name)) continue;
+
+        pdir->entry.name = pent->d_name;
+        pdir->entry.name_len = strlen(pent->d_name);
+        pdir->entry.inode = pent->d_ino;
+#ifdef DT_UNKNOWN
+        pdir->entry.type = pent->d_type;
+#else
+        pdir->entry.type = 0;
+#endif
+        return &pdir->entry;
+    }
+
+    return NULL;
+#endif
+}
+
+mode_t fsearch_entry_mode(const fsearch_entry_t *pentry)
+{
+    /* Translate d_type to st_mode format bits, zero if unknown */
+    switch (pentry->type)
+    {
+#ifdef DT_UNKNOWN
+        case DT_BLK: return S_IFBLK;
+        case DT_CHR: return S_IFCHR;
+        case DT_DIR: return S_IFDIR;
+        case DT_FIFO: return S_IFIFO;
+        case DT_LNK: return S_IFLNK;
+        case DT_REG: return S_IFREG;
+        case DT_SOCK: return S_IFSOCK;
+#endif
+        default: break;
+    }
+
+    return 0;
+}
+
+int fsearch_dir_stat(fsearch_dir_t *pdir, const char *name, struct stat *pstat, int follow)
+{
+    /* Kernel resolves only the last component relative to our descriptor */
+    return fstatat(pdir->fd, name, pstat, follow ? 0 : AT_SYMLINK_NOFOLLOW);
+}
+
+static void fsearch_dir_release(fsearch_dir_t *pdir)
+{
+    if (pdir->fd < 0) return;
+
+#ifdef __linux__
+    free(pdir->buffer);
+    close(pdir->fd);
+#else
+    closedir(pdir->pdir);
+#endif
+
+    pdir->fd = -1;
+}
+
+void fsearch_dir_close(fsearch_dir_t *pdir)
+{
+    fsearch_dir_release(pdir);
+    free(pdir->sorted);
+    free(pdir->names);
+    pdir->sorted = NULL;
+    pdir->names = NULL;
+}
+
+static int fsearch_dir_cmp_inode(const void *a, const void *b)
+{
+    const fsearch_entry_t *x = (const fsearch_entry_t*)a, *y = (const fsearch_entry_t*)b;
+    if (x->inode != y->inode) return x->inode < y->inode ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+int fsearch_dir_sort(fsearch_dir_t *pdir)
+{
+    size_t count = 0, capacity = 0, used = 0, size = 0, i;
+    fsearch_entry_t *entries = NULL;
+    const fsearch_entry_t *entry;
+    char *names = NULL;
+
+    while ((entry = fsearch_dir_read(pdir)) != NULL)
+    {
+        if (count >= capacity)
+        {
+            size_t grown = capacity ? capacity * 2 : 64;
+            fsearch_entry_t *pentries = (fsearch_entry_t*)realloc(entries, grown * sizeof(fsearch_entry_t));
+            if (pentries == NULL) break;
+
+            entries = pentries;
+            capacity = grown;
+        }
+
+        if (used + entry->name_len + 1 > size)
+        {
+            size_t grown = size ? size * 2 : 1024;
+            while (grown < used + entry->name_len + 1) grown *= 2;
+
+            char *pnames = (char*)realloc(names, grown);
+            if (pnames == NULL) break;
+
+            names = pnames;
+            size = grown;
+        }
+
+        /* Names move while arena grows, they are pointed to when done */
+        memcpy(&names[used], entry->name, entry->name_len + 1);
+        used += entry->name_len + 1;
+        entries[count++] = *entry;
+    }
+
+    if (entry != NULL)
+    {
+        free(entries);
+        free(names);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (i = 0, used = 0; i < count; i++)
+    {
+        entries[i].name = &names[used];
+        used += entries[i].name_len + 1;
+    }
+
+    if (count > 1) qsort(entries, count, sizeof(fsearch_entry_t), fsearch_dir_cmp_inode);
+
+    pdir->sorted = entries;
+    pdir->sorted_count = count;
+    pdir->sorted_next = 0;
+    pdir->names = names;
+    return 0;
+}
+
+void fsearch_dir_suspend(fsearch_dir_t *pdir)
+{
+    struct stat statbuf;
+    if (pdir->fd < 0) return;
+
+    /* Unknown identity never matches, resume falls back to path */
+    pdir->dev = 0;
+    pdir->ino = 0;
+
+    if (fstat(pdir->fd, &statbuf) == 0)
+    {
+        pdir->dev = statbuf.st_dev;
+        pdir->ino = statbuf.st_ino;
+    }
+
+#ifndef __linux__
+    pdir->position = telldir(pdir->pdir);
+#endif
+
+    /* Batched entries not read yet are read again after resume */
+    fsearch_dir_release(pdir);
+}
+
+int fsearch_dir_resume(fsearch_dir_t *pdir, int parent_fd, const char *name)
+{
+    struct stat statbuf;
+    int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    if (fstat(fd, &statbuf) < 0 || !pdir->ino ||
+        statbuf.st_dev != pdir->dev || statbuf.st_ino != pdir->ino)
+    {
+        close(fd);
+        errno = ESTALE;
+        return -1;
+    }
+
+#ifdef __linux__
+    pdir->buffer = (char*)malloc(FSEARCH_DIR_BUFFER_SIZE);
+    if (pdir->buffer == NULL || lseek(fd, (off_t)pdir->position, SEEK_SET) < 0)
+    {
+        int error = pdir->buffer == NULL ? ENOMEM : errno;
+        free(pdir->buffer);
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    pdir->offset = pdir->length = 0;
+#else
+    pdir->pdir = fdopendir(fd);
+    if (pdir->pdir == NULL)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    seekdir(pdir->pdir, pdir->position);
+#endif
+
+    pdir->fd = fd;
+    return 0;
+}
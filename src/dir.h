@@ -0,0 +1,64 @@
+/*
+ *  src/dir.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * Directory reader working relative to open
+ * descriptors with batched entry reading
+ */
+
+#ifndef __FSEARCH_DIR_H__
+#define __FSEARCH_DIR_H__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#ifdef __linux__
+#define FSEARCH_DIR_BUFFER_SIZE (32 * 1024)
+#endif
+
+typedef struct fsearch_entry_ {
+    const char *name;               // Entry name (points into reader buffer)
+    size_t name_len;                // Entry name length
+    ino_t inode;                    // Inode number from directory entry
+    unsigned char type;             // DT_* type or DT_UNKNOWN
+} fsearch_entry_t;
+
+typedef struct fsearch_dir_ {
+    fsearch_entry_t entry;          // Last read entry
+    int fd;                         // Open directory descriptor, -1 if suspended
+    dev_t dev;                      // Identity checked when resumed
+    ino_t ino;
+    long position;                  // Position after last read entry
+    fsearch_entry_t *sorted;        // Entries ordered by inode, NULL if not sorted
+    size_t sorted_count;
+    size_t sorted_next;             // Next sorted entry to return
+    char *names;                    // Names of sorted entries
+#ifdef __linux__
+    char *buffer;                   // Batch of raw getdents64 records
+    size_t offset;                  // Next record offset in batch
+    size_t length;                  // Valid bytes in batch
+#else
+    DIR *pdir;
+#endif
+} fsearch_dir_t;
+
+/* Link as last component of name is opened only with follow */
+int fsearch_dir_open(fsearch_dir_t *pdir, int parent_fd, const char *name, int follow);
+const fsearch_entry_t* fsearch_dir_read(fsearch_dir_t *pdir);
+mode_t fsearch_entry_mode(const fsearch_entry_t *pentry);
+int fsearch_dir_stat(fsearch_dir_t *pdir, const char *name, struct stat *pstat, int follow);
+void fsearch_dir_close(fsearch_dir_t *pdir);
+
+/* Reads the rest of directory at once, following reads return
+   it ordered by inode number. Sorted entries survive suspend. */
+int fsearch_dir_sort(fsearch_dir_t *pdir);
+
+/* Closes descriptor and frees buffer, reading continues after resume.
+   Resume fails if name does not lead to the same directory again. */
+void fsearch_dir_suspend(fsearch_dir_t *pdir);
+int fsearch_dir_resume(fsearch_dir_t *pdir, int parent_fd, const char *name);
+
+#endif /* __FSEARCH_DIR_H__ */
@@ -0,0 +1,319 @@
+/*
+ *  src/du.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Disk usage totals (--du) collected per thread during
+ * search and folded into directory totals when it is done
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "du.h"
+
+static unsigned int g_du_id = 0;
+
+/* Hot path never locks, each thread finds its block here */
+static __thread fsearch_du_local_t *t_local = NULL;
+static __thread unsigned int t_du_id = 0;
+
+fsearch_du_t* fsearch_du_create(void)
+{
+    fsearch_du_t *pdu = (fsearch_du_t*)malloc(sizeof(fsearch_du_t));
+    if (pdu == NULL) return NULL;
+
+    if (pthread_mutex_init(&pdu->lock, NULL))
+    {
+        free(pdu);
+        return NULL;
+    }
+
+    pdu->id = __sync_add_and_fetch(&g_du_id, 1);
+    pdu->locals = NULL;
+    pdu->failed = 0;
+    return pdu;
+}
+
+void fsearch_du_destroy(fsearch_du_t *pdu)
+{
+    if (pdu == NULL) return;
+    fsearch_du_local_t *plocal = pdu->locals;
+
+    while (plocal != NULL)
+    {
+        fsearch_du_local_t *next = plocal->next;
+        size_t i;
+
+        for (i = 0; i < plocal->dir_count; i++) free(plocal->dirs[i]);
+        free(plocal->dirs);
+        free(plocal->links);
+        free(plocal);
+        plocal = next;
+    }
+
+    pthread_mutex_destroy(&pdu->lock);
+    free(pdu);
+}
+
+static fsearch_du_local_t* fsearch_du_local(fsearch_du_t *pdu)
+{
+    if (t_du_id == pdu->id) return t_local;
+
+    /* Block outlives the thread, it is folded after search */
+    fsearch_du_local_t *plocal = (fsearch_du_local_t*)calloc(1, sizeof(fsearch_du_local_t));
+    if (plocal == NULL) return NULL;
+
+    pthread_mutex_lock(&pdu->lock);
+    plocal->next = pdu->locals;
+    pdu->locals = plocal;
+    pthread_mutex_unlock(&pdu->lock);
+
+    t_local = plocal;
+    t_du_id = pdu->id;
+    return plocal;
+}
+
+static int fsearch_du_grow(void **items, size_t *capacity, size_t count, size_t size)
+{
+    if (count < *capacity) return 0;
+
+    size_t grown = *capacity ? *capacity * 2 : 256;
+    void *pitems = realloc(*items, grown * size);
+    if (pitems == NULL) return -1;
+
+    *items = pitems;
+    *capacity = grown;
+    return 0;
+}
+
+fsearch_du_dir_t* fsearch_du_enter(fsearch_du_t *pdu, const char *path, size_t length)
+{
+    if (pdu == NULL) return NULL;
+    fsearch_du_local_t *plocal = fsearch_du_local(pdu);
+
+    fsearch_du_dir_t *pdir = (fsearch_du_dir_t*)calloc(1, sizeof(fsearch_du_dir_t) + length + 1);
+    if (plocal == NULL || pdir == NULL || fsearch_du_grow((void**)&plocal->dirs,
+        &plocal->dir_capacity, plocal->dir_count, sizeof(fsearch_du_dir_t*)) < 0)
+    {
+        __sync_lock_test_and_set(&pdu->failed, 1);
+        free(pdir);
+        return NULL;
+    }
+
+    memcpy(pdir->path, path, length);
+    pdir->path[length] = '\0';
+    pdir->length = length;
+
+    plocal->dirs[plocal->dir_count++] = pdir;
+    return pdir;
+}
+
+void fsearch_du_add(fsearch_du_t *pdu, fsearch_du_dir_t *pdir, const struct stat *pstat)
+{
+    if (pdir == NULL) return;
+
+    /* Other paths of the inode may be found by any thread, decide later */
+    if (pstat->st_nlink > 1 && !S_ISDIR(pstat->st_mode))
+    {
+        fsearch_du_local_t *plocal = t_local;
+
+        if (fsearch_du_grow((void**)&plocal->links, &plocal->link_capacity,
+            plocal->link_count, sizeof(fsearch_du_link_t)) < 0)
+        {
+            __sync_lock_test_and_set(&pdu->failed, 1);
+            return;
+        }
+
+        fsearch_du_link_t *plink = &plocal->links[plocal->link_count++];
+        plink->dev = (uint64_t)pstat->st_dev;
+        plink->ino = (uint64_t)pstat->st_ino;
+        plink->blocks = (uint64_t)pstat->st_blocks;
+        plink->size = (uint64_t)pstat->st_size;
+        plink->dir = pdir;
+        return;
+    }
+
+    pdir->own.blocks += (uint64_t)pstat->st_blocks;
+    pdir->own.size += (uint64_t)pstat->st_size;
+    pdir->own.entries++;
+}
+
+/* Slash sorts before any other byte, so directories come right before their contents */
+static int fsearch_du_cmp_path(const void *a, const void *b)
+{
+    const unsigned char *x = (const unsigned char*)(*(fsearch_du_dir_t* const*)a)->path;
+    const unsigned char *y = (const unsigned char*)(*(fsearch_du_dir_t* const*)b)->path;
+
+    while (*x && *x == *y) { x++; y++; }
+    int cx = *x == '/' ? 1 : (*x ? *x + 1 : 0);
+    int cy = *y == '/' ? 1 : (*y ? *y + 1 : 0);
+    return cx - cy;
+}
+
+static int fsearch_du_cmp_total(const void *a, const void *b)
+{
+    const fsearch_du_dir_t *x = *(fsearch_du_dir_t* const*)a, *y = *(fsearch_du_dir_t* const*)b;
+    if (x->total.blocks != y->total.blocks) return x->total.blocks > y->total.blocks ? -1 : 1;
+    return fsearch_du_cmp_path(a, b);
+}
+
+static int fsearch_du_cmp_link(const void *a, const void *b)
+{
+    const fsearch_du_link_t *x = (const fsearch_du_link_t*)a, *y = (const fsearch_du_link_t*)b;
+    if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino) return x->ino < y->ino ? -1 : 1;
+    return fsearch_du_cmp_path(&x->dir, &y->dir);
+}
+
+static int fsearch_du_is_parent(const fsearch_du_dir_t *pparent, const fsearch_du_dir_t *pdir)
+{
+    return pdir->length > pparent->length && !memcmp(pdir->path, pparent->path, pparent->length) &&
+        (pparent->path[pparent->length - 1] == '/' || pdir->path[pparent->length] == '/');
+}
+
+/* Inode is counted in directory of its first path in sorted order */
+static int fsearch_du_links(fsearch_du_t *pdu, size_t count)
+{
+    fsearch_du_link_t *links = (fsearch_du_link_t*)malloc((count + 1) * sizeof(fsearch_du_link_t));
+    if (links == NULL) return -1;
+
+    const fsearch_du_local_t *plocal;
+    size_t i, used = 0;
+
+    for (plocal = pdu->locals; plocal != NULL; plocal = plocal->next)
+    {
+        if (!plocal->link_count) continue;
+        memcpy(&links[used], plocal->links, plocal->link_count * sizeof(fsearch_du_link_t));
+        used += plocal->link_count;
+    }
+
+    qsort(links, used, sizeof(fsearch_du_link_t), fsearch_du_cmp_link);
+
+    for (i = 0; i < used; i++)
+    {
+        if (i && links[i].dev == links[i - 1].dev && links[i].ino == links[i - 1].ino) continue;
+        links[i].dir->own.blocks += links[i].blocks;
+        links[i].dir->own.size += links[i].size;
+        links[i].dir->own.entries++;
+    }
+
+    free(links);
+    return 0;
+}
+
+static void fsearch_du_line(fsearch_output_t *pout, const char *pFmt, ...)
+{
+    va_list args;
+
+    va_start(args, pFmt);
+    fsearch_output_vline(pout, LINE_MAX, pFmt, args);
+    va_end(args);
+}
+
+static void fsearch_du_print_dir(fsearch_output_t *pout, const fsearch_du_dir_t *pdir, size_t indentation)
+{
+    unsigned long long usage = (unsigned long long)pdir->total.blocks * 512;
+    unsigned long long size = (unsigned long long)pdir->total.size;
+
+    if (!indentation || pdir->parent == NULL)
+    {
+        /* Path is written as it is, it may be longer than a line */
+        char line[64];
+        int length = snprintf(line, sizeof(line), "%*llu  %*llu  ", FSEARCH_SIZE_LEN, usage, FSEARCH_SIZE_LEN, size);
+        fsearch_output_write(pout, line, length);
+        fsearch_output_write(pout, pdir->path, pdir->length);
+        fsearch_output_write(pout, "\n", 1);
+        return;
+    }
+
+    /* Name follows the parent path and its slash */
+    const char *name = &pdir->path[pdir->parent->length];
+    while (*name == '/') name++;
+
+    char dashes[LINE_MAX / 2];
+    size_t count = pdir->depth * indentation;
+    if (count >= sizeof(dashes)) count = sizeof(dashes) - 1;
+    memset(dashes, '-', count);
+    dashes[count] = '\0';
+
+    fsearch_du_line(pout, "%*llu  %*llu  |%s%s", FSEARCH_SIZE_LEN, usage, FSEARCH_SIZE_LEN, size, dashes, name);
+}
+
+long long fsearch_du_print(fsearch_du_t *pdu, fsearch_output_t *pout, size_t indentation, size_t top)
+{
+    const fsearch_du_local_t *plocal;
+    size_t i, count = 0, links = 0, depth = 0;
+
+    for (plocal = pdu->locals; plocal != NULL; plocal = plocal->next)
+    {
+        count += plocal->dir_count;
+        links += plocal->link_count;
+    }
+
+    fsearch_du_dir_t **dirs = (fsearch_du_dir_t**)malloc((count + 1) * sizeof(fsearch_du_dir_t*));
+    fsearch_du_dir_t **stack = (fsearch_du_dir_t**)malloc((count + 1) * sizeof(fsearch_du_dir_t*));
+
+    if (dirs == NULL || stack == NULL || fsearch_du_links(pdu, links) < 0)
+    {
+        free(dirs);
+        free(stack);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (count = 0, plocal = pdu->locals; plocal != NULL; plocal = plocal->next)
+    {
+        if (!plocal->dir_count) continue;
+        memcpy(&dirs[count], plocal->dirs, plocal->dir_count * sizeof(fsearch_du_dir_t*));
+        count += plocal->dir_count;
+    }
+
+    qsort(dirs, count, sizeof(fsearch_du_dir_t*), fsearch_du_cmp_path);
+
+    /* Sub directories follow their parent, so the parent is on the stack */
+    for (i = 0; i < count; i++)
+    {
+        while (depth && !fsearch_du_is_parent(stack[depth - 1], dirs[i])) depth--;
+        dirs[i]->parent = depth ? stack[depth - 1] : NULL;
+        dirs[i]->depth = depth;
+        dirs[i]->total = dirs[i]->own;
+        stack[depth++] = dirs[i];
+    }
+
+    /* Backwards every directory is complete before it is added to parent */
+    uint64_t entries = 0;
+    for (i = count; i > 0; i--)
+    {
+        fsearch_du_dir_t *pdir = dirs[i - 1];
+        if (pdir->parent == NULL)
+        {
+            entries += pdir->total.entries;
+            continue;
+        }
+
+        pdir->parent->total.blocks += pdir->total.blocks;
+        pdir->parent->total.size += pdir->total.size;
+        pdir->parent->total.entries += pdir->total.entries;
+    }
+
+    if (top)
+    {
+        qsort(dirs, count, sizeof(fsearch_du_dir_t*), fsearch_du_cmp_total);
+        if (count > top) count = top;
+        indentation = 0;
+    }
+
+    for (i = 0; i < count; i++) fsearch_du_print_dir(pout, dirs[i], indentation);
+
+    free(dirs);
+    free(stack);
+
+    if (!__sync_add_and_fetch(&pdu->failed, 0)) return (long long)entries;
+    errno = ENOMEM;
+    return -1;
+}
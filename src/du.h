@@ -0,0 +1,73 @@
+/*
+ *  src/du.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Disk usage totals (--du) collected per thread during
+ * search and folded into directory totals when it is done
+ */
+
+#ifndef __FSEARCH_DU_H__
+#define __FSEARCH_DU_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "output.h"
+
+typedef struct fsearch_usage_ {
+    uint64_t blocks;                    // Allocated 512 byte blocks (st_blocks)
+    uint64_t size;                      // Apparent size in bytes (st_size)
+    uint64_t entries;                   // Counted entries
+} fsearch_usage_t;
+
+/* Scanned directory, written only by the thread which scans it */
+typedef struct fsearch_du_dir_ {
+    struct fsearch_du_dir_ *parent;     // Found when totals are folded
+    fsearch_usage_t own;                // Matching entries directly inside
+    fsearch_usage_t total;              // Own and all sub directories
+    size_t depth;                       // Count of ancestors
+    size_t length;
+    char path[];
+} fsearch_du_dir_t;
+
+/* Inode with more links, counted once after search */
+typedef struct fsearch_du_link_ {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t blocks;
+    uint64_t size;
+    fsearch_du_dir_t *dir;              // Directory of this path
+} fsearch_du_link_t;
+
+typedef struct fsearch_du_local_ {
+    struct fsearch_du_local_ *next;     // Blocks of other threads
+    fsearch_du_dir_t **dirs;
+    size_t dir_count;
+    size_t dir_capacity;
+    fsearch_du_link_t *links;
+    size_t link_count;
+    size_t link_capacity;
+} fsearch_du_local_t;
+
+typedef struct fsearch_du_ {
+    pthread_mutex_t lock;               // Protects list of thread blocks
+    fsearch_du_local_t *locals;         // One block per thread which took part
+    unsigned int id;                    // Tells thread cached blocks apart
+    int failed;                         // Some totals are missing (no memory)
+} fsearch_du_t;
+
+fsearch_du_t* fsearch_du_create(void);
+void fsearch_du_destroy(fsearch_du_t *pdu);
+
+/* Record of directory being scanned, NULL without --du */
+fsearch_du_dir_t* fsearch_du_enter(fsearch_du_t *pdu, const char *path, size_t length);
+void fsearch_du_add(fsearch_du_t *pdu, fsearch_du_dir_t *pdir, const struct stat *pstat);
+
+/* Prints totals flat, as tree with indentation or only top largest,
+   returns count of entries in totals or -1 if some were lost */
+long long fsearch_du_print(fsearch_du_t *pdu, fsearch_output_t *pout, size_t indentation, size_t top);
+
+#endif /* __FSEARCH_DU_H__ */
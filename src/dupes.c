@@ -0,0 +1,420 @@
+/*
+ *  src/dupes.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Duplicate file finder (--duplicates): size groups, then
+ * hash of file edges, then full hash on a thread pool
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "search.h"
+#include "worker.h"
+#include "dupes.h"
+#include "hash.h"
+
+#define FSEARCH_DUPES_BLOCK     (256 * 1024)    // Path storage block size
+
+typedef struct fsearch_file_ {
+    const char *path;               // Points into path blocks
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t hash[2];               // Edge hash first, full hash later
+    size_t links;                   // Following paths of the same inode
+    int failed;                     // File could not be read
+} fsearch_file_t;
+
+typedef struct fsearch_block_ {
+    struct fsearch_block_ *next;
+    size_t used;
+    char data[];
+} fsearch_block_t;
+
+typedef struct fsearch_dupes_ {
+    fsearch_file_t *files;          // Collected regular files
+    size_t count;
+    size_t capacity;
+    fsearch_block_t *blocks;        // Path storage, newest block first
+    int failed;                     // Out of memory while collecting
+} fsearch_dupes_t;
+
+typedef struct fsearch_hasher_ {
+    fsearch_cfg_t *pcfg;
+    fsearch_file_t **files;         // Inodes to hash, one path each
+    size_t count;
+    size_t next;                    // Next job, taken atomically
+    int full;                       // Hash whole files instead of edges
+} fsearch_hasher_t;
+
+/* Reads until buffer is full or file ends */
+static ssize_t fsearch_read_full(int fd, char *buffer, size_t size, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < size)
+    {
+        ssize_t count = pread(fd, &buffer[done], size - done, offset + done);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) return -1;
+        if (count == 0) break;
+        done += (size_t)count;
+    }
+
+    return (ssize_t)done;
+}
+
+/* Returns 1 if file is not the one found by the walk anymore */
+static int fsearch_hash_file(fsearch_hasher_t *phasher, fsearch_file_t *pfile, char *buffer)
+{
+    /* Path may have been replaced by a link since it was found */
+    int fd = open(pfile->path, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) return errno == ELOOP ? 1 : -1;
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) < 0)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    if (!S_ISREG(statbuf.st_mode) || (uint64_t)statbuf.st_dev != pfile->dev ||
+        (uint64_t)statbuf.st_ino != pfile->ino || (uint64_t)statbuf.st_size != pfile->size)
+    {
+        close(fd);
+        return 1;
+    }
+
+    fsearch_murmur_t state;
+    fsearch_murmur_init(&state, pfile->size);
+    uint64_t total = 0;
+    ssize_t count = 0;
+
+    if (!phasher->full && pfile->size > 2 * FSEARCH_DUPES_EDGE)
+    {
+        /* Headers and trailers tell most different files of same size apart */
+        count = fsearch_read_full(fd, buffer, FSEARCH_DUPES_EDGE, 0);
+        if (count == FSEARCH_DUPES_EDGE) count = fsearch_read_full(fd, &buffer[FSEARCH_DUPES_EDGE],
+            FSEARCH_DUPES_EDGE, (off_t)(pfile->size - FSEARCH_DUPES_EDGE));
+
+        if (count == FSEARCH_DUPES_EDGE)
+        {
+            fsearch_murmur_final(&state, (const uint8_t*)buffer, 2 * FSEARCH_DUPES_EDGE, pfile->hash);
+            total = pfile->size;
+        }
+    }
+    else
+    {
+        off_t offset = 0;
+
+        /* Full chunks keep the stream block aligned, the short one is last */
+        while ((count = fsearch_read_full(fd, buffer, FSEARCH_DUPES_CHUNK, offset)) == FSEARCH_DUPES_CHUNK)
+        {
+            fsearch_murmur_update(&state, (const uint8_t*)buffer, FSEARCH_DUPES_CHUNK);
+            offset += FSEARCH_DUPES_CHUNK;
+        }
+
+        if (count >= 0)
+        {
+            fsearch_murmur_final(&state, (const uint8_t*)buffer, count, pfile->hash);
+            total = (uint64_t)offset + (uint64_t)count;
+        }
+    }
+
+    int error = errno;
+    close(fd);
+    errno = error;
+
+    /* Short read means file was truncated while it was read */
+    if (count < 0) return -1;
+    return total != pfile->size ? 1 : 0;
+}
+
+static void* fsearch_hasher_thread(void *ctx)
+{
+    fsearch_hasher_t *phasher = (fsearch_hasher_t*)ctx;
+    fsearch_cfg_t *pcfg = phasher->pcfg;
+
+    char *buffer = (char*)malloc(FSEARCH_DUPES_CHUNK);
+    if (buffer == NULL) return NULL;
+
+    while (!__sync_add_and_fetch(pcfg->interrupted, 0))
+    {
+        size_t i = __sync_fetch_and_add(&phasher->next, 1);
+        if (i >= phasher->count) break;
+
+        /* Changed file is left out of its group, it is not what was found */
+        fsearch_file_t *pfile = phasher->files[i];
+        int status = fsearch_hash_file(phasher, pfile, buffer);
+        if (status < 0) fsearch_log_error(pcfg, pfile->path);
+        if (status) pfile->failed = 1;
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+static void fsearch_hash_files(fsearch_cfg_t *pcfg, fsearch_file_t **files, size_t count, int full)
+{
+    fsearch_hasher_t hasher;
+    hasher.pcfg = pcfg;
+    hasher.files = files;
+    hasher.count = count;
+    hasher.next = 0;
+    hasher.full = full;
+
+    int i, started = 0;
+    size_t threads = pcfg->threads > 1 ? (size_t)pcfg->threads : 1;
+    if (threads > count) threads = count;
+
+    pthread_t *tids = threads > 1 ? (pthread_t*)calloc(threads - 1, sizeof(pthread_t)) : NULL;
+    if (tids == NULL) threads = 1;
+
+    /* Calling thread takes part, it also finishes the jobs if no thread starts */
+    for (i = 0; (size_t)i + 1 < threads; i++)
+        if (!pthread_create(&tids[started], NULL, fsearch_hasher_thread, &hasher)) started++;
+
+    fsearch_hasher_thread(&hasher);
+    for (i = 0; i < started; i++) pthread_join(tids[i], NULL);
+    free(tids);
+}
+
+static int fsearch_dupes_collect(void *ctx, const char *path, size_t dir_len, const struct stat *pstat)
+{
+    fsearch_dupes_t *pdupes = (fsearch_dupes_t*)ctx;
+    size_t length = strlen(path) + 1;
+    (void)dir_len;
+
+    if (!S_ISREG(pstat->st_mode)) return 0;
+    fsearch_block_t *pblock = pdupes->blocks;
+
+    if (pblock == NULL || pblock->used + length > FSEARCH_DUPES_BLOCK)
+    {
+        size_t size = length > FSEARCH_DUPES_BLOCK ? length : FSEARCH_DUPES_BLOCK;
+        pblock = (fsearch_block_t*)malloc(sizeof(fsearch_block_t) + size);
+        if (pblock == NULL) { pdupes->failed = 1; return 1; }
+
+        pblock->next = pdupes->blocks;
+        pblock->used = 0;
+        pdupes->blocks = pblock;
+    }
+
+    if (pdupes->count == pdupes->capacity)
+    {
+        size_t capacity = pdupes->capacity ? pdupes->capacity * 2 : 1024;
+        fsearch_file_t *files = (fsearch_file_t*)realloc(pdupes->files, capacity * sizeof(fsearch_file_t));
+        if (files == NULL) { pdupes->failed = 1; return 1; }
+
+        pdupes->files = files;
+        pdupes->capacity = capacity;
+    }
+
+    fsearch_file_t *pfile = &pdupes->files[pdupes->count++];
+    memset(pfile, 0, sizeof(fsearch_file_t));
+
+    pfile->path = memcpy(&pblock->data[pblock->used], path, length);
+    pfile->dev = (uint64_t)pstat->st_dev;
+    pfile->ino = (uint64_t)pstat->st_ino;
+    pfile->size = (uint64_t)pstat->st_size;
+    pblock->used += length;
+    return 0;
+}
+
+#define FSEARCH_CMP(a, b) if ((a) != (b)) return (a) < (b) ? -1 : 1
+
+/* Same inode ends up next to each other, paths keep output stable */
+static int fsearch_cmp_inode(const void *a, const void *b)
+{
+    const fsearch_file_t *x = (const fsearch_file_t*)a, *y = (const fsearch_file_t*)b;
+    FSEARCH_CMP(x->size, y->size);
+    FSEARCH_CMP(x->dev, y->dev);
+    FSEARCH_CMP(x->ino, y->ino);
+    return strcmp(x->path, y->path);
+}
+
+static int fsearch_cmp_hash(const void *a, const void *b)
+{
+    const fsearch_file_t *x = *(const fsearch_file_t**)a, *y = *(const fsearch_file_t**)b;
+    FSEARCH_CMP(x->size, y->size);
+    FSEARCH_CMP(x->failed, y->failed);
+    FSEARCH_CMP(x->hash[0], y->hash[0]);
+    FSEARCH_CMP(x->hash[1], y->hash[1]);
+    return strcmp(x->path, y->path);
+}
+
+static int fsearch_same_hash(const fsearch_file_t *x, const fsearch_file_t *y)
+{
+    return x->size == y->size && !x->failed && !y->failed &&
+        x->hash[0] == y->hash[0] && x->hash[1] == y->hash[1];
+}
+
+/* Keeps only files which have at least one equal file left, returns new count */
+static size_t fsearch_keep_groups(fsearch_file_t **files, size_t count)
+{
+    size_t i, start, kept = 0;
+    qsort(files, count, sizeof(fsearch_file_t*), fsearch_cmp_hash);
+
+    for (start = 0; start < count; start = i)
+    {
+        for (i = start + 1; i < count && fsearch_same_hash(files[start], files[i]); i++);
+        if (i - start < 2 || files[start]->failed) continue;
+
+        memmove(&files[kept], &files[start], (i - start) * sizeof(fsearch_file_t*));
+        kept += i - start;
+    }
+
+    return kept;
+}
+
+static void fsearch_dupes_line(fsearch_output_t *pout, const char *path, const char *link)
+{
+    fsearch_output_write(pout, path, strlen(path));
+
+    if (link != NULL)
+    {
+        fsearch_output_write(pout, " (link to ", 10);
+        fsearch_output_write(pout, link, strlen(link));
+        fsearch_output_write(pout, ")", 1);
+    }
+
+    fsearch_output_write(pout, "\n", 1);
+}
+
+static void fsearch_dupes_report(fsearch_cfg_t *pcfg, fsearch_file_t **files, size_t count)
+{
+    size_t i, start, j;
+
+    for (start = 0; start < count; start = i)
+    {
+        for (i = start + 1; i < count && fsearch_same_hash(files[start], files[i]); i++);
+        if (pcfg->max_results && pcfg->result_count == pcfg->max_results) break;
+
+        pcfg->result_count++;
+        if (pcfg->quiet) { pcfg->is_found = 1; continue; }
+
+        if (pcfg->is_found) fsearch_output_write(&pcfg->writer, "\n", 1);
+        pcfg->is_found = 1;
+
+        if (pcfg->verbose)
+        {
+            char line[64];
+            int length = snprintf(line, sizeof(line), "%llu bytes each:\n", (unsigned long long)files[start]->size);
+            fsearch_output_write(&pcfg->writer, line, length);
+        }
+
+        /* Other paths of an inode are links, they were not hashed */
+        for (j = start; j < i; j++)
+        {
+            const fsearch_file_t *pfile = files[j];
+            size_t k;
+
+            fsearch_dupes_line(&pcfg->writer, pfile->path, NULL);
+            for (k = 1; k <= pfile->links; k++) fsearch_dupes_line(&pcfg->writer, pfile[k].path, pfile->path);
+        }
+    }
+}
+
+static int fsearch_dupes_run(fsearch_cfg_t *pcfg, fsearch_dupes_t *pdupes)
+{
+    fsearch_file_t *files = pdupes->files;
+    size_t i, j, count = 0;
+
+    qsort(files, pdupes->count, sizeof(fsearch_file_t), fsearch_cmp_inode);
+
+    fsearch_file_t **jobs = (fsearch_file_t**)malloc((pdupes->count + 1) * sizeof(fsearch_file_t*));
+    if (jobs == NULL) return -1;
+
+    /* One path per inode, sizes with a single inode can not have duplicates */
+    for (i = 0; i < pdupes->count; i = j)
+    {
+        size_t start = count;
+
+        for (j = i; j < pdupes->count && files[j].size == files[i].size; j++)
+        {
+            if (j > i && files[j].dev == files[j - 1].dev && files[j].ino == files[j - 1].ino)
+            {
+                jobs[count - 1]->links++;
+                continue;
+            }
+
+            jobs[count++] = &files[j];
+        }
+
+        if (count - start < 2) count = start;
+    }
+
+    /* Edge hash covers small files completely */
+    fsearch_hash_files(pcfg, jobs, count, 0);
+    count = fsearch_keep_groups(jobs, count);
+
+    fsearch_file_t **large = (fsearch_file_t**)malloc((count + 1) * sizeof(fsearch_file_t*));
+    if (large == NULL)
+    {
+        free(jobs);
+        return -1;
+    }
+
+    /* Same edges are common (e.g. disk images), those are read to the end */
+    size_t remaining = 0;
+    for (i = 0; i < count; i++) if (jobs[i]->size > 2 * FSEARCH_DUPES_EDGE) large[remaining++] = jobs[i];
+    fsearch_hash_files(pcfg, large, remaining, 1);
+
+    count = fsearch_keep_groups(jobs, count);
+    if (!__sync_add_and_fetch(pcfg->interrupted, 0)) fsearch_dupes_report(pcfg, jobs, count);
+
+    free(large);
+    free(jobs);
+    return 0;
+}
+
+int fsearch_find_duplicates(fsearch_cfg_t *pcfg, const char *pdirectory)
+{
+    fsearch_dupes_t dupes;
+    memset(&dupes, 0, sizeof(dupes));
+
+    /* Traversal reports files to collector instead of output, -m counts groups */
+    size_t max_groups = pcfg->max_results;
+    pcfg->max_results = 0;
+    pcfg->callback = fsearch_dupes_collect;
+    pcfg->ctx = &dupes;
+
+    int status = pcfg->threads > 1 ?
+        fsearch_search_parallel(pcfg, pdirectory) :
+        fsearch_search_files(pcfg, pdirectory);
+
+    pcfg->callback = NULL;
+    pcfg->is_found = 0;
+    pcfg->result_count = 0;
+
+    pcfg->max_results = max_groups;
+
+    if (dupes.failed)
+    {
+        errno = ENOMEM;
+        status = -1;
+    }
+
+    if (status >= 0 && fsearch_dupes_run(pcfg, &dupes) < 0) status = -1;
+
+    while (dupes.blocks != NULL)
+    {
+        fsearch_block_t *next = dupes.blocks->next;
+        free(dupes.blocks);
+        dupes.blocks = next;
+    }
+
+    int error = errno;
+    free(dupes.files);
+    errno = error;
+    return status;
+}
@@ -0,0 +1,21 @@
+/*
+ *  src/dupes.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Duplicate file finder (--duplicates): size groups, then
+ * hash of file edges, then full hash on a thread pool
+ */
+
+#ifndef __FSEARCH_DUPES_H__
+#define __FSEARCH_DUPES_H__
+
+#include "config.h"
+
+#define FSEARCH_DUPES_EDGE      4096            // Bytes hashed from both ends first
+#define FSEARCH_DUPES_CHUNK     (1024 * 1024)   // Read size of full hash
+
+int fsearch_find_duplicates(fsearch_cfg_t *pcfg, const char *pdirectory);
+
+#endif /* __FSEARCH_DUPES_H__ */
@@ -0,0 +1,154 @@
+/*
+ *  src/filter.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Search criteria compiled into a cost ordered predicate array
+ */
+
+#include <limits.h>
+#include "filter.h"
+
+#define FSEARCH_IN_RANGE(range, value) \
+    ((long long)(value) >= (range).min && (long long)(value) <= (range).max)
+
+static int fsearch_pred_type(const fsearch_filter_t *pfilter, const char *name, size_t length, const struct stat *pstat)
+{
+    int type = 0;
+
+    switch (pstat->st_mode & S_IFMT)
+    {
+        case S_IFREG: type = fsearch_regular_file; break;
+        case S_IFDIR: type = fsearch_directory; break;
+        case S_IFLNK: type = fsearch_symlink; break;
+        case S_IFBLK: type = fsearch_block_device; break;
+        case S_IFCHR: type = fsearch_char_device; break;
+        case S_IFIFO: type = fsearch_pipe; break;
+        case S_IFSOCK: type = fsearch_socket; break;
+        default: break;
+    }
+
+    return (pfilter->types & type) != 0;
+}
+
+static int fsearch_pred_name(const fsearch_filter_t *pfilter, const char *name, size_t length, const struct stat *pstat)
+{
+    return fsearch_matcher_match(pfilter->matcher, name, length);
+}
+
+static int fsearch_pred_size(const fsearch_filter_t *pfilter, const char *name, size_t length, const struct stat *pstat)
+{
+    return FSEARCH_IN_RANGE(pfilter->size, pstat->st_size);
+}
+
+static int fsearch_pred_links(const fsearch_filter_t *pfilter, const char *name, size_t length, const struct stat *pstat)
+{
+    return FSEARCH_IN_RANGE(pfilter->links, pstat->st_nlink);
+}
+
+static int fsearch_pred_perm(const fsearch_filter_t *pfilter, const char *name, size_t length, const struct stat *pstat)
+{
+    return (pstat->st_mode & 0777) == pfilter->perm;
+}
+
+static int fsearch_pred_mtime(const fsearch_filter_t *pfilter, const char *name, size_t length, const struct stat *pstat)
+{
+    return FSEARCH_IN_RANGE(pfilter->mtime, pstat->st_mtime);
+}
+
+static int fsearch_pred_atime(const fsearch_filter_t *pfilter, const char *name, size_t length, const struct stat *pstat)
+{
+    return FSEARCH_IN_RANGE(pfilter->atime, pstat->st_atime);
+}
+
+static int fsearch_pred_ctime(const fsearch_filter_t *pfilter, const char *name, size_t length, const struct stat *pstat)
+{
+    return FSEARCH_IN_RANGE(pfilter->ctime, pstat->st_ctime);
+}
+
+static int fsearch_name_cost(const fsearch_matcher_t *pmatcher)
+{
+    /* Exact name is mostly rejected by length, tokens and DFA walk the name */
+    if (pmatcher->regex != NULL) return 8;
+    return pmatcher->use_regex ? 6 : 2;
+}
+
+void fsearch_filter_init(fsearch_filter_t *pfilter)
+{
+    fsearch_range_t all = { LLONG_MIN, LLONG_MAX };
+    pfilter->size = pfilter->links = all;
+    pfilter->mtime = pfilter->atime = pfilter->ctime = all;
+    pfilter->matcher = NULL;
+    pfilter->entry_count = 0;
+    pfilter->count = 0;
+    pfilter->types = 0;
+    pfilter->perm = 0;
+    pfilter->active = 0;
+}
+
+void fsearch_range_narrow(fsearch_range_t *prange, const fsearch_range_t *pother)
+{
+    if (pother->min > prange->min) prange->min = pother->min;
+    if (pother->max < prange->max) prange->max = pother->max;
+}
+
+static void fsearch_filter_add(fsearch_filter_t *pfilter, fsearch_pred_fn_t check, int cost, int need_stat)
+{
+    size_t i = pfilter->count++;
+
+    /* Insertion sort, entry only checks first, then cheaper ones */
+    while (i > 0 && (pfilter->preds[i - 1].need_stat > need_stat ||
+        (pfilter->preds[i - 1].need_stat == need_stat && pfilter->preds[i - 1].cost > cost)))
+    {
+        pfilter->preds[i] = pfilter->preds[i - 1];
+        i--;
+    }
+
+    pfilter->preds[i].check = check;
+    pfilter->preds[i].cost = cost;
+    pfilter->preds[i].need_stat = need_stat;
+    if (!need_stat) pfilter->entry_count++;
+}
+
+void fsearch_filter_compile(fsearch_filter_t *pfilter, const fsearch_matcher_t *pmatcher)
+{
+    pfilter->matcher = pmatcher;
+    pfilter->entry_count = 0;
+    pfilter->count = 0;
+
+    if (pmatcher->length || pmatcher->regex != NULL) pfilter->active |= fsearch_filter_name;
+    else pfilter->active &= ~fsearch_filter_name;
+
+    /* Directory entry type is a single mask test, rejects before any string work */
+    if (pfilter->active & fsearch_filter_type) fsearch_filter_add(pfilter, fsearch_pred_type, 1, 0);
+    if (pfilter->active & fsearch_filter_name) fsearch_filter_add(pfilter, fsearch_pred_name, fsearch_name_cost(pmatcher), 0);
+
+    /* Stat checks cost the same, order by how many entries they usually reject */
+    if (pfilter->active & fsearch_filter_size) fsearch_filter_add(pfilter, fsearch_pred_size, 1, 1);
+    if (pfilter->active & fsearch_filter_mtime) fsearch_filter_add(pfilter, fsearch_pred_mtime, 2, 1);
+    if (pfilter->active & fsearch_filter_ctime) fsearch_filter_add(pfilter, fsearch_pred_ctime, 2, 1);
+    if (pfilter->active & fsearch_filter_atime) fsearch_filter_add(pfilter, fsearch_pred_atime, 3, 1);
+    if (pfilter->active & fsearch_filter_perm) fsearch_filter_add(pfilter, fsearch_pred_perm, 3, 1);
+    if (pfilter->active & fsearch_filter_links) fsearch_filter_add(pfilter, fsearch_pred_links, 4, 1);
+}
+
+int fsearch_filter_entry(const fsearch_filter_t *pfilter, const char *name, size_t length, const struct stat *pstat)
+{
+    size_t i;
+
+    for (i = 0; i < pfilter->entry_count; i++)
+        if (!pfilter->preds[i].check(pfilter, name, length, pstat)) return 0;
+
+    return 1;
+}
+
+int fsearch_filter_stat(const fsearch_filter_t *pfilter, const char *name, size_t length, const struct stat *pstat)
+{
+    size_t i;
+
+    for (i = pfilter->entry_count; i < pfilter->count; i++)
+        if (!pfilter->preds[i].check(pfilter, name, length, pstat)) return 0;
+
+    return 1;
+}
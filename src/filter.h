@@ -0,0 +1,79 @@
+/*
+ *  src/filter.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Search criteria compiled into a cost ordered predicate array
+ */
+
+#ifndef __FSEARCH_FILTER_H__
+#define __FSEARCH_FILTER_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "match.h"
+
+#define FSEARCH_PRED_MAX        8
+
+typedef enum {
+    fsearch_regular_file = (1 << 0),
+    fsearch_block_device = (1 << 1),
+    fsearch_char_device = (1 << 2),
+    fsearch_directory = (1 << 3),
+    fsearch_symlink = (1 << 4),
+    fsearch_socket = (1 << 5),
+    fsearch_pipe = (1 << 6)
+} fsearch_type_e;
+
+typedef enum {
+    fsearch_filter_type = (1 << 0),
+    fsearch_filter_name = (1 << 1),
+    fsearch_filter_size = (1 << 2),
+    fsearch_filter_links = (1 << 3),
+    fsearch_filter_perm = (1 << 4),
+    fsearch_filter_mtime = (1 << 5),
+    fsearch_filter_atime = (1 << 6),
+    fsearch_filter_ctime = (1 << 7)
+} fsearch_filter_e;
+
+/* Inclusive bounds, repeated options narrow the range */
+typedef struct fsearch_range_ {
+    long long min;
+    long long max;
+} fsearch_range_t;
+
+struct fsearch_filter_;
+typedef int(*fsearch_pred_fn_t)(const struct fsearch_filter_*, const char*, size_t, const struct stat*);
+
+typedef struct fsearch_pred_ {
+    fsearch_pred_fn_t check;        // Returns non zero if entry passes
+    int cost;                       // Estimated cost, lower runs first
+    int need_stat;                  // Needs more than directory entry type
+} fsearch_pred_t;
+
+typedef struct fsearch_filter_ {
+    fsearch_pred_t preds[FSEARCH_PRED_MAX];     // Compiled predicates in run order
+    size_t entry_count;                         // Leading predicates checked without stat
+    size_t count;                               // Count of compiled predicates
+    const fsearch_matcher_t *matcher;           // File name matcher
+    fsearch_range_t size;                       // File size in bytes
+    fsearch_range_t links;                      // Hard link count
+    fsearch_range_t mtime;                      // Modification time window
+    fsearch_range_t atime;                      // Access time window
+    fsearch_range_t ctime;                      // Status change time window
+    mode_t perm;                                // Exact permission bits
+    int types;                                  // Accepted fsearch_type_e mask
+    int active;                                 // Used fsearch_filter_e criteria
+} fsearch_filter_t;
+
+void fsearch_filter_init(fsearch_filter_t *pfilter);
+void fsearch_filter_compile(fsearch_filter_t *pfilter, const fsearch_matcher_t *pmatcher);
+void fsearch_range_narrow(fsearch_range_t *prange, const fsearch_range_t *pother);
+
+/* Entry checks need file type in st_mode, stat checks need full stat */
+int fsearch_filter_entry(const fsearch_filter_t *pfilter, const char *name, size_t length, const struct stat *pstat);
+int fsearch_filter_stat(const fsearch_filter_t *pfilter, const char *name, size_t length, const struct stat *pstat);
+
+#endif /* __FSEARCH_FILTER_H__ */
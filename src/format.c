@@ -0,0 +1,246 @@
+/*
+ *  src/format.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Machine readable output formats (-0, --jsonl, --binary)
+ * written straight into output buffer without printf
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "format.h"
+
+/* Every path byte takes at most six bytes escaped, fields take less than this */
+#define FSEARCH_JSON_FIELDS     640
+
+#define FSEARCH_PUT(pos, str) (memcpy(pos, str, sizeof(str) - 1), (pos) + sizeof(str) - 1)
+
+static const char g_hex[] = "0123456789abcdef";
+static const char g_base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static char* fsearch_format_uint(char *pos, uint64_t value)
+{
+    char digits[20];
+    int count = 0;
+
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    while (value);
+
+    while (count) *pos++ = digits[--count];
+    return pos;
+}
+
+static char* fsearch_format_int(char *pos, int64_t value)
+{
+    if (value >= 0) return fsearch_format_uint(pos, (uint64_t)value);
+
+    *pos++ = '-';
+    return fsearch_format_uint(pos, (uint64_t)0 - (uint64_t)value);
+}
+
+/* Length of valid UTF-8 sequence at data, 0 if it is not valid */
+static size_t fsearch_utf8_length(const unsigned char *data, size_t left)
+{
+    unsigned char c = data[0];
+    unsigned char min = 0x80, max = 0xBF;
+    size_t i, length;
+
+    if (c < 0x80) return 1;
+    else if (c >= 0xC2 && c <= 0xDF) length = 2;
+    else if (c >= 0xE0 && c <= 0xEF) length = 3;
+    else if (c >= 0xF0 && c <= 0xF4) length = 4;
+    else return 0;
+
+    /* Overlong forms, surrogates and code points above U+10FFFF */
+    if (c == 0xE0) min = 0xA0;
+    else if (c == 0xED) max = 0x9F;
+    else if (c == 0xF0) min = 0x90;
+    else if (c == 0xF4) max = 0x8F;
+
+    if (length > left || data[1] < min || data[1] > max) return 0;
+    for (i = 2; i < length; i++) if (data[i] < 0x80 || data[i] > 0xBF) return 0;
+    return length;
+}
+
+/* Writes escaped string, NULL if it is not valid UTF-8 */
+static char* fsearch_format_string(char *pos, const char *str, size_t length)
+{
+    const unsigned char *data = (const unsigned char*)str;
+    size_t i = 0;
+
+    while (i < length)
+    {
+        unsigned char c = data[i];
+
+        if (c >= 0x80)
+        {
+            size_t count = fsearch_utf8_length(&data[i], length - i);
+            if (!count) return NULL;
+
+            memcpy(pos, &data[i], count);
+            pos += count;
+            i += count;
+            continue;
+        }
+
+        if (c == '"' || c == '\\') { *pos++ = '\\'; *pos++ = (char)c; }
+        else if (c == '\n') pos = FSEARCH_PUT(pos, "\\n");
+        else if (c == '\t') pos = FSEARCH_PUT(pos, "\\t");
+        else if (c == '\r') pos = FSEARCH_PUT(pos, "\\r");
+        else if (c < 0x20)
+        {
+            pos = FSEARCH_PUT(pos, "\\u00");
+            *pos++ = g_hex[c >> 4];
+            *pos++ = g_hex[c & 15];
+        }
+        else *pos++ = (char)c;
+
+        i++;
+    }
+
+    return pos;
+}
+
+static char* fsearch_format_base64(char *pos, const char *str, size_t length)
+{
+    const unsigned char *data = (const unsigned char*)str;
+    size_t i;
+
+    for (i = 0; i + 2 < length; i += 3)
+    {
+        uint32_t bits = (uint32_t)data[i] << 16 | (uint32_t)data[i + 1] << 8 | data[i + 2];
+        *pos++ = g_base64[bits >> 18 & 63];
+        *pos++ = g_base64[bits >> 12 & 63];
+        *pos++ = g_base64[bits >> 6 & 63];
+        *pos++ = g_base64[bits & 63];
+    }
+
+    if (i < length)
+    {
+        uint32_t bits = (uint32_t)data[i] << 16;
+        if (i + 1 < length) bits |= (uint32_t)data[i + 1] << 8;
+
+        *pos++ = g_base64[bits >> 18 & 63];
+        *pos++ = g_base64[bits >> 12 & 63];
+        *pos++ = i + 1 < length ? g_base64[bits >> 6 & 63] : '=';
+        *pos++ = '=';
+    }
+
+    return pos;
+}
+
+static char* fsearch_format_json(char *line, const char *path, size_t length, const struct stat *pstat)
+{
+    char *pos = FSEARCH_PUT(line, "{\"path\":\"");
+    char *end = fsearch_format_string(pos, path, length);
+
+    /* JSON strings can not carry arbitrary bytes, such names go as base64 */
+    if (end == NULL)
+    {
+        pos = FSEARCH_PUT(line, "{\"path_base64\":\"");
+        end = fsearch_format_base64(pos, path, length);
+    }
+
+    pos = FSEARCH_PUT(end, "\",\"dev\":");
+    pos = fsearch_format_uint(pos, (uint64_t)pstat->st_dev);
+    pos = FSEARCH_PUT(pos, ",\"ino\":");
+    pos = fsearch_format_uint(pos, (uint64_t)pstat->st_ino);
+    pos = FSEARCH_PUT(pos, ",\"mode\":");
+    pos = fsearch_format_uint(pos, (uint64_t)pstat->st_mode);
+    pos = FSEARCH_PUT(pos, ",\"nlink\":");
+    pos = fsearch_format_uint(pos, (uint64_t)pstat->st_nlink);
+    pos = FSEARCH_PUT(pos, ",\"uid\":");
+    pos = fsearch_format_uint(pos, (uint64_t)pstat->st_uid);
+    pos = FSEARCH_PUT(pos, ",\"gid\":");
+    pos = fsearch_format_uint(pos, (uint64_t)pstat->st_gid);
+    pos = FSEARCH_PUT(pos, ",\"rdev\":");
+    pos = fsearch_format_uint(pos, (uint64_t)pstat->st_rdev);
+    pos = FSEARCH_PUT(pos, ",\"size\":");
+    pos = fsearch_format_int(pos, (int64_t)pstat->st_size);
+    pos = FSEARCH_PUT(pos, ",\"blocks\":");
+    pos = fsearch_format_int(pos, (int64_t)pstat->st_blocks);
+    pos = FSEARCH_PUT(pos, ",\"atime\":");
+    pos = fsearch_format_int(pos, (int64_t)pstat->st_atim.tv_sec);
+    pos = FSEARCH_PUT(pos, ",\"atime_nsec\":");
+    pos = fsearch_format_int(pos, (int64_t)pstat->st_atim.tv_nsec);
+    pos = FSEARCH_PUT(pos, ",\"mtime\":");
+    pos = fsearch_format_int(pos, (int64_t)pstat->st_mtim.tv_sec);
+    pos = FSEARCH_PUT(pos, ",\"mtime_nsec\":");
+    pos = fsearch_format_int(pos, (int64_t)pstat->st_mtim.tv_nsec);
+    pos = FSEARCH_PUT(pos, ",\"ctime\":");
+    pos = fsearch_format_int(pos, (int64_t)pstat->st_ctim.tv_sec);
+    pos = FSEARCH_PUT(pos, ",\"ctime_nsec\":");
+    pos = fsearch_format_int(pos, (int64_t)pstat->st_ctim.tv_nsec);
+    pos = FSEARCH_PUT(pos, "}\n");
+    return pos;
+}
+
+static size_t fsearch_format_binary(char *data, const char *path, size_t length, const struct stat *pstat)
+{
+    fsearch_binary_t record;
+    memset(&record, 0, sizeof(record));
+
+    record.path_len = (uint32_t)length;
+    record.mode = (uint32_t)pstat->st_mode;
+    record.dev = (uint64_t)pstat->st_dev;
+    record.ino = (uint64_t)pstat->st_ino;
+    record.nlink = (uint64_t)pstat->st_nlink;
+    record.uid = (uint64_t)pstat->st_uid;
+    record.gid = (uint64_t)pstat->st_gid;
+    record.rdev = (uint64_t)pstat->st_rdev;
+    record.size = (int64_t)pstat->st_size;
+    record.blocks = (int64_t)pstat->st_blocks;
+    record.atime_sec = (int64_t)pstat->st_atim.tv_sec;
+    record.atime_nsec = (int64_t)pstat->st_atim.tv_nsec;
+    record.mtime_sec = (int64_t)pstat->st_mtim.tv_sec;
+    record.mtime_nsec = (int64_t)pstat->st_mtim.tv_nsec;
+    record.ctime_sec = (int64_t)pstat->st_ctim.tv_sec;
+    record.ctime_nsec = (int64_t)pstat->st_ctim.tv_nsec;
+
+    memcpy(data, &record, sizeof(record));
+    memcpy(&data[sizeof(record)], path, length);
+    return sizeof(record) + length;
+}
+
+int fsearch_format_record(fsearch_output_t *pout, fsearch_format_e format,
+    const char *path, size_t length, const struct stat *pstat)
+{
+    size_t size = length + 1;
+    if (format == FSEARCH_FORMAT_JSONL) size = length * 6 + FSEARCH_JSON_FIELDS;
+    else if (format == FSEARCH_FORMAT_BINARY) size = sizeof(fsearch_binary_t) + length;
+
+    /* Paths of very deep trees do not fit in output buffer, format them aside */
+    int aside = size > FSEARCH_OUTPUT_SIZE;
+    char *data = aside ? (char*)malloc(size) : fsearch_output_reserve(pout, size);
+    if (data == NULL) return -1;
+
+    if (format == FSEARCH_FORMAT_JSONL)
+    {
+        size = fsearch_format_json(data, path, length, pstat) - data;
+    }
+    else if (format == FSEARCH_FORMAT_BINARY)
+    {
+        size = fsearch_format_binary(data, path, length, pstat);
+    }
+    else
+    {
+        memcpy(data, path, length);
+        data[length] = '\0';
+    }
+
+    if (!aside)
+    {
+        fsearch_output_commit(pout, size);
+        return 0;
+    }
+
+    int status = fsearch_output_write(pout, data, size);
+    free(data);
+    return status;
+}
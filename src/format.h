@@ -0,0 +1,52 @@
+/*
+ *  src/format.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Machine readable output formats (-0, --jsonl, --binary)
+ * written straight into output buffer without printf
+ */
+
+#ifndef __FSEARCH_FORMAT_H__
+#define __FSEARCH_FORMAT_H__
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include "output.h"
+
+typedef enum {
+    FSEARCH_FORMAT_TEXT = 0,            // Lines for people, optionally verbose or tree
+    FSEARCH_FORMAT_NUL,                 // Paths terminated with NUL byte
+    FSEARCH_FORMAT_JSONL,               // One JSON object with raw stat fields per line
+    FSEARCH_FORMAT_BINARY               // Fixed record followed by path bytes
+} fsearch_format_e;
+
+/*
+    Binary record in host byte order, path_len bytes of path
+    (not terminated) follow every record. Records are packed
+    back to back, so the next one starts right after the path.
+*/
+typedef struct fsearch_binary_ {
+    uint32_t path_len;
+    uint32_t mode;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t nlink;
+    uint64_t uid;
+    uint64_t gid;
+    uint64_t rdev;
+    int64_t size;
+    int64_t blocks;
+    int64_t atime_sec;
+    int64_t atime_nsec;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+} fsearch_binary_t;
+
+int fsearch_format_record(fsearch_output_t *pout, fsearch_format_e format,
+    const char *path, size_t length, const struct stat *pstat);
+
+#endif /* __FSEARCH_FORMAT_H__ */
@@ -11,14 +11,20 @@
 #include <errno.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 #include "config.h"
 #include "search.h"
+#include "worker.h"
+#include "index.h"
+#include "daemon.h"
+#include "dupes.h"
 
 static int g_interrupted = 0;
 
 void signal_callback(int sig)
 {
-    printf("\nInterrupted with signal: %d\n", sig);
+    /* Stdout may carry records of a machine readable format */
+    fprintf(stderr, "\nInterrupted with signal: %d\n", sig);
     __sync_lock_test_and_set(&g_interrupted, 1);    
 }
 
@@ -27,28 +33,91 @@ int main(int argc, char *argv[])
     fsearch_cfg_t config;
     config.interrupted = &g_interrupted;
 
+    /* Load timezone once for verbose time formatting */
+    tzset();
+
     /* Register interrupt signal (Ctrl+C) */
     signal(SIGINT, signal_callback);
 
     /* Parse command line arguments */
     if (!fsearch_parse_args(&config, argc, argv))
     {
+        fsearch_config_destroy(&config);
         fsearch_print_usage(argv[0]);
         return 1;
     }
 
-    /* Start recursive search target files */
-    int status = fsearch_search_files(&config, config.directory);
-    if (status < 0) /* Can not open target directory */
+    /* Open output once, results are written in large chunks */
+    if (fsearch_output_open(&config.writer, config.output) < 0)
     {
-        fsearch_log_error(&config, config.directory);
+        fsearch_log_error(&config, config.output);
+        fsearch_config_destroy(&config);
         return 1;
     }
 
+    int status = 0;
+
+    /* Index and daemon modes report their own errors */
+    if (config.socket != NULL)
+    {
+        status = config.daemon ?
+            fsearch_daemon_run(&config, config.socket) :
+            fsearch_daemon_query(&config, config.socket, argc, argv);
+    }
+    else if (config.diff != NULL)
+    {
+        status = fsearch_index_diff(&config, config.diff, config.index);
+    }
+    else if (config.index != NULL)
+    {
+        status = config.build_index ?
+            fsearch_index_build(&config, config.index) :
+            fsearch_index_search(&config, config.index);
+    }
+    else if (config.duplicates)
+    {
+        /* Matching files are collected and compared when search is done */
+        status = fsearch_find_duplicates(&config, config.directory);
+        if (status < 0) fsearch_log_error(&config, config.directory);
+    }
+    else
+    {
+        /* Start recursive search target files */
+        /* Breadth first order is served by worker queues */
+        status = (config.threads > 1 || config.bfs) ?
+            fsearch_search_parallel(&config, config.directory) :
+            fsearch_search_files(&config, config.directory);
+
+        /* Can not open target directory */
+        if (status < 0) fsearch_log_error(&config, config.directory);
+    }
+
+    /* Totals are complete only after the whole tree was walked */
+    if (status >= 0 && config.du != NULL)
+    {
+        long long entries = fsearch_du_print(config.du, &config.writer, config.indentation, config.top);
+        if (entries < 0)
+        {
+            fsearch_log_error(&config, config.directory);
+            status = -1;
+        }
+
+        config.result_count = entries > 0 ? (size_t)entries : 0;
+        config.is_found = entries > 0;
+    }
+
+    /* Flush results, also when search was interrupted */
+    fsearch_output_close(&config.writer);
+    if (config.inodes != NULL) fsearch_stats_inodes(config.stats, config.inodes->count, fsearch_inodes_memory(config.inodes));
+    fsearch_stats_print(config.stats, config.result_count, config.writer.written);
+    fsearch_config_destroy(&config);
+    if (status < 0) return 1;
+
     /* Cant find any file */
     if (!config.is_found) 
     {
-        printf("No file found\n");
+        /* Only text output is for people, other formats stay empty */
+        if (!config.quiet) fprintf(config.format == FSEARCH_FORMAT_TEXT ? stdout : stderr, "No file found\n");
         return 1;
     }
 
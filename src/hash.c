@@ -0,0 +1,88 @@
+/*
+ *  src/hash.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Non cryptographic 128 bit hash of file contents
+ * (--duplicates) and index sub trees (--diff)
+ */
+
+#include <string.h>
+#include "hash.h"
+
+#define FSEARCH_MURMUR_C1       0x87c37b91114253d5ULL
+#define FSEARCH_MURMUR_C2       0x4cf5ad432745937fULL
+
+static inline uint64_t fsearch_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fsearch_fmix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+void fsearch_murmur_init(fsearch_murmur_t *pstate, uint64_t seed)
+{
+    pstate->h1 = pstate->h2 = seed;
+    pstate->length = 0;
+}
+
+void fsearch_murmur_update(fsearch_murmur_t *pstate, const uint8_t *data, size_t length)
+{
+    uint64_t h1 = pstate->h1, h2 = pstate->h2;
+    size_t i, blocks = length / 16;
+
+    for (i = 0; i < blocks; i++)
+    {
+        uint64_t k1, k2;
+        memcpy(&k1, &data[i * 16], sizeof(k1));
+        memcpy(&k2, &data[i * 16 + 8], sizeof(k2));
+
+        k1 *= FSEARCH_MURMUR_C1; k1 = fsearch_rotl(k1, 31); k1 *= FSEARCH_MURMUR_C2; h1 ^= k1;
+        h1 = fsearch_rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= FSEARCH_MURMUR_C2; k2 = fsearch_rotl(k2, 33); k2 *= FSEARCH_MURMUR_C1; h2 ^= k2;
+        h2 = fsearch_rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    pstate->h1 = h1;
+    pstate->h2 = h2;
+    pstate->length += blocks * 16;
+}
+
+void fsearch_murmur_final(fsearch_murmur_t *pstate, const uint8_t *tail, size_t length, uint64_t hash[2])
+{
+    uint64_t k1 = 0, k2 = 0;
+    size_t i;
+
+    fsearch_murmur_update(pstate, tail, length);
+    tail += length & ~(size_t)15;
+    length &= 15;
+
+    for (i = length; i > 8; i--) k2 |= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+    for (i = length < 8 ? length : 8; i > 0; i--) k1 |= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+
+    if (length > 8) { k2 *= FSEARCH_MURMUR_C2; k2 = fsearch_rotl(k2, 33); k2 *= FSEARCH_MURMUR_C1; pstate->h2 ^= k2; }
+    if (length) { k1 *= FSEARCH_MURMUR_C1; k1 = fsearch_rotl(k1, 31); k1 *= FSEARCH_MURMUR_C2; pstate->h1 ^= k1; }
+
+    uint64_t h1 = pstate->h1 ^ (pstate->length + length);
+    uint64_t h2 = pstate->h2 ^ (pstate->length + length);
+
+    h1 += h2;
+    h2 += h1;
+    h1 = fsearch_fmix(h1);
+    h2 = fsearch_fmix(h2);
+    h1 += h2;
+    h2 += h1;
+
+    hash[0] = h1;
+    hash[1] = h2;
+}
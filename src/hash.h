@@ -0,0 +1,31 @@
+/*
+ *  src/hash.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Non cryptographic 128 bit hash of file contents
+ * (--duplicates) and index sub trees (--diff)
+ */
+
+#ifndef __FSEARCH_HASH_H__
+#define __FSEARCH_HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    MurmurHash3 x64 128 bit, streamed. Every update except
+    the last one must be a multiple of the 16 byte block.
+*/
+typedef struct fsearch_murmur_ {
+    uint64_t h1;
+    uint64_t h2;
+    uint64_t length;
+} fsearch_murmur_t;
+
+void fsearch_murmur_init(fsearch_murmur_t *pstate, uint64_t seed);
+void fsearch_murmur_update(fsearch_murmur_t *pstate, const uint8_t *data, size_t length);
+void fsearch_murmur_final(fsearch_murmur_t *pstate, const uint8_t *tail, size_t length, uint64_t hash[2]);
+
+#endif /* __FSEARCH_HASH_H__ */
@@ -0,0 +1,173 @@
+/*
+ *  src/ignore.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Ignore file rules (.gitignore and .fsearchignore) loaded
+ * once per directory and shared with its sub directories
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ignore.h"
+
+static const char *g_ignore_files[] = { ".gitignore", ".fsearchignore" };
+
+static int fsearch_ignore_read(int dir_fd, const char *name, char **pbuffer, size_t *plength)
+{
+    int fd = openat(dir_fd, name, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return errno == ENOENT ? 0 : -1;
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) < 0 || !S_ISREG(statbuf.st_mode) ||
+        statbuf.st_size > FSEARCH_IGNORE_FILE_MAX)
+    {
+        close(fd);
+        return -1;
+    }
+
+    /* Both files share one buffer, keep room for separator and terminator */
+    size_t size = (size_t)statbuf.st_size;
+    char *buffer = (char*)realloc(*pbuffer, *plength + size + 2);
+
+    if (buffer == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    ssize_t count = read(fd, &buffer[*plength], size);
+    close(fd);
+
+    *pbuffer = buffer;
+    if (count <= 0) return 0;
+
+    *plength += (size_t)count;
+    buffer[(*plength)++] = '\n';
+    buffer[*plength] = '\0';
+    return 1;
+}
+
+static int fsearch_ignore_parse(fsearch_ignore_t *pignore, size_t length)
+{
+    size_t i, lines = 1;
+    for (i = 0; i < length; i++) lines += pignore->buffer[i] == '\n';
+
+    pignore->rules = (fsearch_rule_t*)malloc(lines * sizeof(fsearch_rule_t));
+    if (pignore->rules == NULL) return -1;
+
+    char *line = pignore->buffer, *next;
+    for (; line < &pignore->buffer[length]; line = next)
+    {
+        char *end = strchr(line, '\n');
+        next = end + 1;
+
+        /* Trailing spaces and CR of DOS line endings are not part of pattern */
+        while (end > line && (end[-1] == ' ' || end[-1] == '\r')) end--;
+        *end = '\0';
+
+        if (line == end || line[0] == '#') continue;
+        fsearch_rule_t *prule = &pignore->rules[pignore->count];
+        int negate = 0, dir_only = 0, anchored = 0;
+
+        if (line[0] == '!') { negate = 1; line++; }
+        else if (line[0] == '\\') line++;
+
+        if (end > line && end[-1] == '/') { dir_only = 1; *--end = '\0'; }
+
+        /* Leading '**' matches in all directories, same as no slash at all */
+        while (!strncmp(line, "**/", 3)) line += 3;
+
+        if (line[0] == '/') { anchored = 1; line++; }
+        else if (strchr(line, '/') != NULL) anchored = 1;
+        if (line == end) continue;
+
+        prule->pattern = line;
+        prule->negate = negate;
+        prule->dir_only = dir_only;
+        prule->anchored = anchored;
+        pignore->count++;
+    }
+
+    return 0;
+}
+
+fsearch_ignore_t* fsearch_ignore_load(int dir_fd, const char *path, size_t length, fsearch_ignore_t *parent)
+{
+    char *buffer = NULL;
+    size_t i, size = 0;
+    int found = 0;
+
+    for (i = 0; i < sizeof(g_ignore_files) / sizeof(g_ignore_files[0]); i++)
+        found += fsearch_ignore_read(dir_fd, g_ignore_files[i], &buffer, &size) > 0;
+
+    fsearch_ignore_t *pignore = found ? (fsearch_ignore_t*)calloc(1, sizeof(fsearch_ignore_t)) : NULL;
+    if (pignore == NULL)
+    {
+        free(buffer);
+        return NULL;
+    }
+
+    pignore->buffer = buffer;
+    pignore->offset = (length && path[length - 1] == '/') ? length : length + 1;
+
+    /* File without any rule does not change inherited ones */
+    if (fsearch_ignore_parse(pignore, size) < 0 || !pignore->count)
+    {
+        free(pignore->rules);
+        free(pignore->buffer);
+        free(pignore);
+        return NULL;
+    }
+
+    pignore->parent = fsearch_ignore_retain(parent);
+    pignore->refs = 1;
+    return pignore;
+}
+
+fsearch_ignore_t* fsearch_ignore_retain(fsearch_ignore_t *pignore)
+{
+    if (pignore != NULL) __sync_add_and_fetch(&pignore->refs, 1);
+    return pignore;
+}
+
+void fsearch_ignore_release(fsearch_ignore_t *pignore)
+{
+    /* Last sub directory done with the rules frees them and walks up */
+    while (pignore != NULL && !__sync_sub_and_fetch(&pignore->refs, 1))
+    {
+        fsearch_ignore_t *parent = pignore->parent;
+        free(pignore->rules);
+        free(pignore->buffer);
+        free(pignore);
+        pignore = parent;
+    }
+}
+
+int fsearch_ignore_match(const fsearch_ignore_t *pignore, const char *path, size_t name_offset, int is_dir)
+{
+    const char *name = &path[name_offset];
+
+    for (; pignore != NULL; pignore = pignore->parent)
+    {
+        const char *relative = &path[pignore->offset];
+        size_t i = pignore->count;
+
+        while (i--)
+        {
+            const fsearch_rule_t *prule = &pignore->rules[i];
+            if (prule->dir_only && !is_dir) continue;
+
+            if (!fnmatch(prule->pattern, prule->anchored ? relative : name, prule->anchored ? FNM_PATHNAME : 0))
+                return prule->negate ? 0 : 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,42 @@
+/*
+ *  src/ignore.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Ignore file rules (.gitignore and .fsearchignore) loaded
+ * once per directory and shared with its sub directories
+ */
+
+#ifndef __FSEARCH_IGNORE_H__
+#define __FSEARCH_IGNORE_H__
+
+#include <stddef.h>
+
+#define FSEARCH_IGNORE_FILE_MAX (1024 * 1024)
+
+typedef struct fsearch_rule_ {
+    const char *pattern;            // Points into rules buffer
+    int negate:1;                   // '!' re-includes matching entries
+    int dir_only:1;                 // Trailing '/' matches directories only
+    int anchored:1;                 // Matched against path relative to rules directory
+} fsearch_rule_t;
+
+typedef struct fsearch_ignore_ {
+    struct fsearch_ignore_ *parent; // Rules of nearest ancestor with ignore file
+    fsearch_rule_t *rules;          // Rules in file order, last match wins
+    char *buffer;                   // Ignore file contents
+    size_t count;                   // Count of rules
+    size_t offset;                  // Relative paths start at this path offset
+    int refs;                       // Sub directories still using the rules
+} fsearch_ignore_t;
+
+/* Returns rules found in directory chained to parent, NULL if there are none */
+fsearch_ignore_t* fsearch_ignore_load(int dir_fd, const char *path, size_t length, fsearch_ignore_t *parent);
+fsearch_ignore_t* fsearch_ignore_retain(fsearch_ignore_t *pignore);
+void fsearch_ignore_release(fsearch_ignore_t *pignore);
+
+/* Entry name starts at path offset, nearest rules file decides */
+int fsearch_ignore_match(const fsearch_ignore_t *pignore, const char *path, size_t name_offset, int is_dir);
+
+#endif /* __FSEARCH_IGNORE_H__ */
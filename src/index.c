@@ -0,0 +1,1133 @@
+/*
+ *  src/index.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Persistent memory mapped file name index
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "index.h"
+#include "search.h"
+#include "dir.h"
+#include "hash.h"
+
+#define FSEARCH_INDEX_MAGIC     "FSINDEX"
+#define FSEARCH_INDEX_VERSION   1
+#define FSEARCH_INDEX_BLOCK     64      // Records per front coding block
+#define FSEARCH_VARINT_MAX      10
+#define FSEARCH_RECORD_MAX      (FSEARCH_FULL_PATH_LEN + FSEARCH_VARINT_MAX * 11)
+#define FSEARCH_TRIGRAM_SHIFT   40      // Posting key is trigram << 40 | record
+#define FSEARCH_TRIGRAM_RECORD  (((uint64_t)1 << FSEARCH_TRIGRAM_SHIFT) - 1)
+#define FSEARCH_TRIGRAM_NAME    256     // Trigrams taken from one name at most
+
+/* All fields are stored in host byte order */
+typedef struct fsearch_index_header_ {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;                // Records per block
+    uint64_t count;                     // Count of records
+    uint64_t data_offset;               // First record
+    uint64_t blocks_offset;             // Record offset of every block
+    uint64_t root_offset;               // Indexed root directory path
+    uint64_t root_length;
+    uint64_t trigrams_offset;           // Trigram table, zero when not built
+    uint64_t trigram_count;
+    uint64_t dirs_offset;               // Sub tree table, zero in older indexes
+    uint64_t dir_count;
+} fsearch_index_header_t;
+
+/* Sub tree of every directory record, stored in record order */
+typedef struct fsearch_index_dir_ {
+    uint64_t record;                    // Record of the directory
+    uint64_t count;                     // Records below it
+    uint64_t hash[2];                   // Merkle hash of records below it
+} fsearch_index_dir_t;
+
+/* Posting lists are stored before the table as varint record deltas */
+typedef struct fsearch_trigram_ {
+    uint32_t trigram;                   // Three lowercase name bytes
+    uint32_t reserved;
+    uint64_t count;                     // Records in posting list
+    uint64_t offset;                    // Posting list offset
+} fsearch_trigram_t;
+
+typedef struct fsearch_index_writer_ {
+    FILE *fp;
+    uint64_t offset;                    // Current file offset
+    uint64_t count;                     // Written records
+    uint64_t *blocks;                   // Block offsets
+    size_t block_count;
+    size_t block_capacity;
+    char last[FSEARCH_FULL_PATH_LEN];   // Previous path for front coding
+    size_t last_len;
+    fsearch_index_dir_t *dirs;          // Sub trees in record order
+    size_t dir_count;
+    size_t dir_capacity;
+    uint64_t *postings;                 // Trigram postings in record order
+    size_t posting_count;
+    size_t posting_capacity;
+    dev_t device;                       // Root device, for -x
+    int trigrams;                       // Write trigram section
+} fsearch_index_writer_t;
+
+typedef struct fsearch_index_entry_ {
+    const char *name;                   // Set when arena is complete
+    size_t name_offset;                 // Offset in names arena
+    size_t name_len;
+} fsearch_index_entry_t;
+
+typedef struct fsearch_index_list_ {
+    fsearch_index_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    char *names;                        // Names arena
+    size_t names_len;
+    size_t names_size;
+} fsearch_index_list_t;
+
+typedef struct fsearch_record_ {
+    char path[FSEARCH_FULL_PATH_LEN];   // Decoded full path
+    size_t length;
+    size_t name_offset;                 // Last path component
+    unsigned int depth;                 // Depth from indexed root
+    struct stat stat;
+} fsearch_record_t;
+
+typedef struct fsearch_index_reader_ {
+    const uint8_t *data;                // Mapped index file
+    size_t size;
+    const fsearch_index_header_t *pheader;
+    const uint64_t *blocks;             // Record offset of every block
+    const fsearch_index_dir_t *dirs;    // Sub trees, NULL in older indexes
+    const uint8_t *pos;                 // Next record to decode
+    uint64_t next;                      // Number of next record
+    fsearch_record_t record;            // Last decoded record
+} fsearch_index_reader_t;
+
+static size_t fsearch_varint_put(uint8_t *out, uint64_t value)
+{
+    size_t length = 0;
+
+    while (value >= 0x80)
+    {
+        out[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+static int fsearch_varint_get(const uint8_t **ppos, const uint8_t *end, uint64_t *pvalue)
+{
+    const uint8_t *pos = *ppos;
+    uint64_t value = 0;
+    int shift = 0;
+
+    while (pos < end && shift < 64)
+    {
+        uint8_t byte = *pos++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80))
+        {
+            *pvalue = value;
+            *ppos = pos;
+            return 0;
+        }
+
+        shift += 7;
+    }
+
+    return -1;
+}
+
+static uint64_t fsearch_zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t fsearch_unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static int fsearch_writer_put(fsearch_index_writer_t *pwriter, const void *data, size_t length)
+{
+    if (fwrite(data, 1, length, pwriter->fp) != length) return -1;
+    pwriter->offset += length;
+    return 0;
+}
+
+static int fsearch_writer_record(fsearch_index_writer_t *pwriter, const char *path,
+    size_t length, unsigned int depth, const struct stat *pstat)
+{
+    uint8_t record[FSEARCH_RECORD_MAX];
+    size_t shared = 0, pos = 0;
+
+    if (pwriter->count % FSEARCH_INDEX_BLOCK == 0)
+    {
+        if (pwriter->block_count == pwriter->block_capacity)
+        {
+            size_t capacity = pwriter->block_capacity ? pwriter->block_capacity * 2 : 1024;
+            uint64_t *blocks = (uint64_t*)realloc(pwriter->blocks, capacity * sizeof(uint64_t));
+            if (blocks == NULL) return -1;
+
+            pwriter->blocks = blocks;
+            pwriter->block_capacity = capacity;
+        }
+
+        /* Every block starts with a full path so it can be decoded alone */
+        pwriter->blocks[pwriter->block_count++] = pwriter->offset;
+    }
+    else
+    {
+        size_t max = length < pwriter->last_len ? length : pwriter->last_len;
+        while (shared < max && path[shared] == pwriter->last[shared]) shared++;
+    }
+
+    pos += fsearch_varint_put(&record[pos], shared);
+    pos += fsearch_varint_put(&record[pos], length - shared);
+    memcpy(&record[pos], &path[shared], length - shared);
+    pos += length - shared;
+
+    pos += fsearch_varint_put(&record[pos], depth);
+    pos += fsearch_varint_put(&record[pos], pstat->st_mode);
+    pos += fsearch_varint_put(&record[pos], pstat->st_nlink);
+    pos += fsearch_varint_put(&record[pos], pstat->st_uid);
+    pos += fsearch_varint_put(&record[pos], pstat->st_gid);
+    pos += fsearch_varint_put(&record[pos], (uint64_t)pstat->st_size);
+    pos += fsearch_varint_put(&record[pos], fsearch_zigzag(pstat->st_atime));
+    pos += fsearch_varint_put(&record[pos], fsearch_zigzag(pstat->st_mtime));
+    pos += fsearch_varint_put(&record[pos], fsearch_zigzag(pstat->st_ctime));
+
+    memcpy(&pwriter->last[shared], &path[shared], length - shared);
+    pwriter->last_len = length;
+    pwriter->count++;
+
+    return fsearch_writer_put(pwriter, record, pos);
+}
+
+/* Fields compared by --diff, the hash of a sub tree covers them in all its records */
+static void fsearch_record_hash(const char *name, size_t name_len, const struct stat *pstat,
+    const uint64_t child[2], uint64_t hash[2])
+{
+    uint64_t fields[8] = {
+        (uint64_t)pstat->st_mode, (uint64_t)pstat->st_uid, (uint64_t)pstat->st_gid,
+        (uint64_t)pstat->st_size, (uint64_t)pstat->st_mtime, child[0], child[1], name_len
+    };
+
+    fsearch_murmur_t state;
+    fsearch_murmur_init(&state, 0);
+    fsearch_murmur_update(&state, (const uint8_t*)fields, sizeof(fields));
+    fsearch_murmur_final(&state, (const uint8_t*)name, name_len, hash);
+}
+
+static int fsearch_writer_dir(fsearch_index_writer_t *pwriter)
+{
+    if (pwriter->dir_count == pwriter->dir_capacity)
+    {
+        size_t capacity = pwriter->dir_capacity ? pwriter->dir_capacity * 2 : 1024;
+        fsearch_index_dir_t *dirs = (fsearch_index_dir_t*)realloc(pwriter->dirs, capacity * sizeof(fsearch_index_dir_t));
+        if (dirs == NULL) return -1;
+
+        pwriter->dirs = dirs;
+        pwriter->dir_capacity = capacity;
+    }
+
+    /* Count and hash are known when the walk is back from it */
+    fsearch_index_dir_t *pdir = &pwriter->dirs[pwriter->dir_count++];
+    memset(pdir, 0, sizeof(fsearch_index_dir_t));
+    pdir->record = pwriter->count - 1;
+    return 0;
+}
+
+static uint32_t fsearch_trigram(const char *data)
+{
+    return ((uint32_t)FSEARCH_LOWER(data[0]) << 16) |
+        ((uint32_t)FSEARCH_LOWER(data[1]) << 8) |
+        (uint32_t)FSEARCH_LOWER(data[2]);
+}
+
+static size_t fsearch_trigrams_get(const char *data, size_t length, uint32_t *trigrams, size_t max)
+{
+    size_t i, j, count = 0;
+
+    for (i = 0; i + 3 <= length && count < max; i++)
+    {
+        /* Names are short, insertion sort keeps them unique */
+        uint32_t trigram = fsearch_trigram(&data[i]);
+        for (j = count; j > 0 && trigrams[j - 1] > trigram; j--);
+        if (j > 0 && trigrams[j - 1] == trigram) continue;
+
+        memmove(&trigrams[j + 1], &trigrams[j], (count - j) * sizeof(uint32_t));
+        trigrams[j] = trigram;
+        count++;
+    }
+
+    return count;
+}
+
+static int fsearch_writer_postings(fsearch_index_writer_t *pwriter, const char *name, size_t length)
+{
+    uint32_t trigrams[FSEARCH_TRIGRAM_NAME];
+    size_t i, count = fsearch_trigrams_get(name, length, trigrams, FSEARCH_TRIGRAM_NAME);
+    uint64_t record = pwriter->count - 1;
+
+    if (record > FSEARCH_TRIGRAM_RECORD)
+    {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    if (pwriter->posting_count + count > pwriter->posting_capacity)
+    {
+        size_t capacity = pwriter->posting_capacity ? pwriter->posting_capacity * 2 : 65536;
+        uint64_t *postings = (uint64_t*)realloc(pwriter->postings, capacity * sizeof(uint64_t));
+        if (postings == NULL) return -1;
+
+        pwriter->postings = postings;
+        pwriter->posting_capacity = capacity;
+    }
+
+    for (i = 0; i < count; i++)
+        pwriter->postings[pwriter->posting_count++] = ((uint64_t)trigrams[i] << FSEARCH_TRIGRAM_SHIFT) | record;
+
+    return 0;
+}
+
+static int fsearch_postings_sort(uint64_t *postings, size_t count)
+{
+    uint64_t *temp = (uint64_t*)malloc(count * sizeof(uint64_t));
+    if (temp == NULL) return -1;
+
+    uint64_t *src = postings, *dst = temp;
+    int pass;
+
+    /* Stable radix sort by trigram, records stay ascending */
+    for (pass = 0; pass < 3; pass++)
+    {
+        int shift = FSEARCH_TRIGRAM_SHIFT + pass * 8;
+        size_t i, offsets[256], total = 0;
+        memset(offsets, 0, sizeof(offsets));
+
+        for (i = 0; i < count; i++) offsets[(src[i] >> shift) & 0xFF]++;
+
+        for (i = 0; i < 256; i++)
+        {
+            size_t bucket = offsets[i];
+            offsets[i] = total;
+            total += bucket;
+        }
+
+        for (i = 0; i < count; i++) dst[offsets[(src[i] >> shift) & 0xFF]++] = src[i];
+
+        uint64_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != postings) memcpy(postings, src, count * sizeof(uint64_t));
+    free(temp);
+    return 0;
+}
+
+static int fsearch_writer_trigrams(fsearch_index_writer_t *pwriter, fsearch_index_header_t *pheader)
+{
+    if (!pwriter->posting_count) return 0;
+    if (fsearch_postings_sort(pwriter->postings, pwriter->posting_count) < 0) return -1;
+
+    const uint64_t *postings = pwriter->postings;
+    size_t i, count = 0;
+
+    for (i = 0; i < pwriter->posting_count; i++)
+        if (!i || (postings[i] >> FSEARCH_TRIGRAM_SHIFT) != (postings[i - 1] >> FSEARCH_TRIGRAM_SHIFT)) count++;
+
+    fsearch_trigram_t *table = (fsearch_trigram_t*)calloc(count, sizeof(fsearch_trigram_t));
+    if (table == NULL) return -1;
+
+    fsearch_trigram_t *pentry = NULL;
+    uint8_t buffer[4096];
+    uint64_t previous = 0;
+    size_t used = 0;
+    int status = 0;
+
+    for (i = 0; i < pwriter->posting_count && !status; i++)
+    {
+        uint32_t trigram = (uint32_t)(postings[i] >> FSEARCH_TRIGRAM_SHIFT);
+        uint64_t record = postings[i] & FSEARCH_TRIGRAM_RECORD;
+
+        if (pentry == NULL || pentry->trigram != trigram)
+        {
+            /* Flush so the new list starts at current offset */
+            if (used) status = fsearch_writer_put(pwriter, buffer, used);
+            pentry = pentry == NULL ? table : pentry + 1;
+            pentry->trigram = trigram;
+            pentry->offset = pwriter->offset;
+            previous = 0;
+            used = 0;
+        }
+
+        /* First record is stored as is, others as delta */
+        used += fsearch_varint_put(&buffer[used], record - previous);
+        previous = record;
+        pentry->count++;
+
+        if (used + FSEARCH_VARINT_MAX > sizeof(buffer))
+        {
+            status = fsearch_writer_put(pwriter, buffer, used);
+            used = 0;
+        }
+    }
+
+    if (!status && used) status = fsearch_writer_put(pwriter, buffer, used);
+
+    /* Keep the table aligned for direct access from the map */
+    static const uint8_t padding[8] = { 0 };
+    size_t pad = (8 - pwriter->offset % 8) % 8;
+    if (!status) status = fsearch_writer_put(pwriter, padding, pad);
+
+    pheader->trigrams_offset = pwriter->offset;
+    pheader->trigram_count = count;
+
+    if (!status) status = fsearch_writer_put(pwriter, table, count * sizeof(fsearch_trigram_t));
+    free(table);
+    return status;
+}
+
+static int fsearch_list_add(fsearch_index_list_t *plist, const fsearch_entry_t *pentry)
+{
+    if (plist->count == plist->capacity)
+    {
+        size_t capacity = plist->capacity ? plist->capacity * 2 : 64;
+        fsearch_index_entry_t *entries = (fsearch_index_entry_t*)realloc(plist->entries, capacity * sizeof(fsearch_index_entry_t));
+        if (entries == NULL) return -1;
+
+        plist->entries = entries;
+        plist->capacity = capacity;
+    }
+
+    if (plist->names_len + pentry->name_len + 1 > plist->names_size)
+    {
+        size_t size = plist->names_size ? plist->names_size * 2 : 4096;
+        while (size < plist->names_len + pentry->name_len + 1) size *= 2;
+
+        char *names = (char*)realloc(plist->names, size);
+        if (names == NULL) return -1;
+
+        plist->names = names;
+        plist->names_size = size;
+    }
+
+    fsearch_index_entry_t *pindex = &plist->entries[plist->count++];
+    pindex->name_offset = plist->names_len;
+    pindex->name_len = pentry->name_len;
+
+    memcpy(&plist->names[plist->names_len], pentry->name, pentry->name_len + 1);
+    plist->names_len += pentry->name_len + 1;
+    return 0;
+}
+
+static int fsearch_list_compare(const void *a, const void *b)
+{
+    const fsearch_index_entry_t *first = (const fsearch_index_entry_t*)a;
+    const fsearch_index_entry_t *second = (const fsearch_index_entry_t*)b;
+    return strcmp(first->name, second->name);
+}
+
+static int fsearch_index_walk(fsearch_cfg_t *pcfg, fsearch_index_writer_t *pwriter, int parent_fd,
+    const char *name, char *path, size_t length, unsigned int depth, uint64_t hash[2])
+{
+    fsearch_index_list_t list;
+    memset(&list, 0, sizeof(list));
+
+    fsearch_dir_t dir;
+    if (fsearch_dir_open(&dir, parent_fd, name, parent_fd == AT_FDCWD) < 0) return -1;
+
+    const fsearch_entry_t *entry = NULL;
+    fsearch_murmur_t state;
+    int status = 0;
+
+    /* Entries are chained in sorted order, their hashes are whole blocks */
+    fsearch_murmur_init(&state, 0);
+
+    while ((entry = fsearch_dir_read(&dir)) != NULL)
+    {
+        if (fsearch_list_add(&list, entry) < 0)
+        {
+            status = -1;
+            break;
+        }
+    }
+
+    size_t i;
+    for (i = 0; i < list.count; i++) list.entries[i].name = &list.names[list.entries[i].name_offset];
+
+    /* Sorted siblings give stable order and longer shared prefixes */
+    if (list.count) qsort(list.entries, list.count, sizeof(fsearch_index_entry_t), fsearch_list_compare);
+    size_t offset = (length && path[length - 1] == '/') ? length : length + 1;
+
+    for (i = 0; i < list.count && status == 0; i++)
+    {
+        if (__sync_add_and_fetch(pcfg->interrupted, 0))
+        {
+            status = -1;
+            break;
+        }
+
+        const char *entry_name = list.entries[i].name;
+        size_t name_len = list.entries[i].name_len;
+        uint64_t child[2] = { 0, 0 }, entry_hash[2];
+        struct stat statbuf;
+
+        /* Excluded entries and their subtrees are left out of the index */
+        if (pcfg->exclude_count && fsearch_check_exclude(pcfg, entry_name, name_len)) continue;
+
+        if (offset + name_len >= FSEARCH_FULL_PATH_LEN)
+        {
+            errno = ENAMETOOLONG;
+            fsearch_log_error(pcfg, entry_name);
+            continue;
+        }
+
+        path[offset - 1] = '/';
+        memcpy(&path[offset], entry_name, name_len + 1);
+
+        if (fsearch_dir_stat(&dir, entry_name, &statbuf, 0) < 0)
+        {
+            fsearch_log_error(pcfg, path);
+            path[length] = '\0';
+            continue;
+        }
+
+        if (fsearch_writer_record(pwriter, path, offset + name_len, depth + 1, &statbuf) < 0 ||
+            (pwriter->trigrams && fsearch_writer_postings(pwriter, entry_name, name_len) < 0) ||
+            (S_ISDIR(statbuf.st_mode) && fsearch_writer_dir(pwriter) < 0))
+        {
+            status = -1;
+            break;
+        }
+
+        int descend = S_ISDIR(statbuf.st_mode) &&
+            (!pcfg->max_depth || depth + 1 < (unsigned int)pcfg->max_depth) &&
+            (!pcfg->one_filesystem || statbuf.st_dev == pwriter->device);
+
+        /* Table may move while sub tree is written, keep the position */
+        size_t dir_index = pwriter->dir_count - 1;
+
+        if (descend &&
+            fsearch_index_walk(pcfg, pwriter, dir.fd, entry_name, path, offset + name_len, depth + 1, child) < 0)
+        {
+            /* Unreadable sub directories are skipped, write errors are fatal */
+            if (ferror(pwriter->fp) || __sync_add_and_fetch(pcfg->interrupted, 0)) status = -1;
+            else fsearch_log_error(pcfg, path);
+        }
+
+        if (S_ISDIR(statbuf.st_mode))
+        {
+            fsearch_index_dir_t *pdir = &pwriter->dirs[dir_index];
+            pdir->count = pwriter->count - pdir->record - 1;
+            pdir->hash[0] = child[0];
+            pdir->hash[1] = child[1];
+        }
+
+        fsearch_record_hash(entry_name, name_len, &statbuf, child, entry_hash);
+        fsearch_murmur_update(&state, (const uint8_t*)entry_hash, sizeof(entry_hash));
+        path[length] = '\0';
+    }
+
+    fsearch_murmur_final(&state, (const uint8_t*)"", 0, hash);
+
+    fsearch_dir_close(&dir);
+    free(list.entries);
+    free(list.names);
+    return status;
+}
+
+int fsearch_index_build(fsearch_cfg_t *pcfg, const char *path)
+{
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    fsearch_index_writer_t writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.trigrams = pcfg->trigrams;
+
+    writer.fp = fopen(temp, "wb");
+    if (writer.fp == NULL)
+    {
+        fsearch_log_error(pcfg, temp);
+        return -1;
+    }
+
+    fsearch_index_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FSEARCH_INDEX_MAGIC, sizeof(header.magic));
+    header.version = FSEARCH_INDEX_VERSION;
+    header.block_size = FSEARCH_INDEX_BLOCK;
+
+    char root[FSEARCH_FULL_PATH_LEN];
+    size_t length = strlen(pcfg->directory);
+    memcpy(root, pcfg->directory, length + 1);
+
+    /* Unreadable root fails in the walk below */
+    struct stat statbuf;
+    if (pcfg->one_filesystem && stat(root, &statbuf) == 0) writer.device = statbuf.st_dev;
+
+    /* Header is rewritten with final offsets at the end */
+    int status = fsearch_writer_put(&writer, &header, sizeof(header));
+    header.root_offset = writer.offset;
+    header.root_length = length;
+    if (!status) status = fsearch_writer_put(&writer, root, length + 1);
+    header.data_offset = writer.offset;
+
+    uint64_t hash[2];
+    int logged = 0;
+
+    if (!status && fsearch_index_walk(pcfg, &writer, AT_FDCWD, root, root, length, 0, hash) < 0)
+    {
+        /* Root directory could not be opened or read */
+        if (!ferror(writer.fp) && !__sync_add_and_fetch(pcfg->interrupted, 0))
+        {
+            fsearch_log_error(pcfg, pcfg->directory);
+            logged = 1;
+        }
+
+        status = -1;
+    }
+
+    /* Keep block table aligned for direct access from the map */
+    static const uint8_t padding[8] = { 0 };
+    size_t pad = (8 - writer.offset % 8) % 8;
+    if (!status) status = fsearch_writer_put(&writer, padding, pad);
+
+    header.blocks_offset = writer.offset;
+    header.count = writer.count;
+
+    if (!status) status = fsearch_writer_put(&writer, writer.blocks, writer.block_count * sizeof(uint64_t));
+
+    header.dirs_offset = writer.offset;
+    header.dir_count = writer.dir_count;
+
+    if (!status) status = fsearch_writer_put(&writer, writer.dirs, writer.dir_count * sizeof(fsearch_index_dir_t));
+    if (!status) status = fsearch_writer_trigrams(&writer, &header);
+    if (!status && (fseek(writer.fp, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, writer.fp) != 1)) status = -1;
+    if (fclose(writer.fp) && !status) status = -1;
+    free(writer.postings);
+    free(writer.blocks);
+    free(writer.dirs);
+
+    /* Replace old index only when the new one is complete */
+    if (!status && rename(temp, path) < 0) status = -1;
+
+    if (status < 0)
+    {
+        if (!logged && !__sync_add_and_fetch(pcfg->interrupted, 0)) fsearch_log_error(pcfg, path);
+        unlink(temp);
+        return -1;
+    }
+
+    pcfg->is_found = 1;
+    return 1;
+}
+
+static int fsearch_record_decode(const uint8_t **ppos, const uint8_t *end, int restart, fsearch_record_t *prec)
+{
+    uint64_t shared, suffix, depth, mode, nlink, uid, gid, size, atime, mtime, ctime;
+
+    if (fsearch_varint_get(ppos, end, &shared) < 0 ||
+        fsearch_varint_get(ppos, end, &suffix) < 0) return -1;
+
+    if (restart) shared = 0;
+    if (shared > prec->length || shared + suffix >= sizeof(prec->path) ||
+        suffix > (uint64_t)(end - *ppos)) return -1;
+
+    memcpy(&prec->path[shared], *ppos, suffix);
+    prec->length = shared + suffix;
+    prec->path[prec->length] = '\0';
+    *ppos += suffix;
+
+    if (fsearch_varint_get(ppos, end, &depth) < 0 ||
+        fsearch_varint_get(ppos, end, &mode) < 0 ||
+        fsearch_varint_get(ppos, end, &nlink) < 0 ||
+        fsearch_varint_get(ppos, end, &uid) < 0 ||
+        fsearch_varint_get(ppos, end, &gid) < 0 ||
+        fsearch_varint_get(ppos, end, &size) < 0 ||
+        fsearch_varint_get(ppos, end, &atime) < 0 ||
+        fsearch_varint_get(ppos, end, &mtime) < 0 ||
+        fsearch_varint_get(ppos, end, &ctime) < 0) return -1;
+
+    const char *slash = strrchr(prec->path, '/');
+    prec->name_offset = slash ? (size_t)(slash - prec->path) + 1 : 0;
+    prec->depth = (unsigned int)depth;
+
+    memset(&prec->stat, 0, sizeof(prec->stat));
+    prec->stat.st_mode = (mode_t)mode;
+    prec->stat.st_nlink = (nlink_t)nlink;
+    prec->stat.st_uid = (uid_t)uid;
+    prec->stat.st_gid = (gid_t)gid;
+    prec->stat.st_size = (off_t)size;
+    prec->stat.st_atime = (time_t)fsearch_unzigzag(atime);
+    prec->stat.st_mtime = (time_t)fsearch_unzigzag(mtime);
+    prec->stat.st_ctime = (time_t)fsearch_unzigzag(ctime);
+    return 0;
+}
+
+static int fsearch_index_scope(const char *scope, size_t scope_len, const fsearch_record_t *prec, int recursive)
+{
+    /* Record must be below the searched directory */
+    if (prec->length <= scope_len + 1 ||
+        prec->path[scope_len] != '/' ||
+        strncmp(prec->path, scope, scope_len)) return 0;
+
+    /* Non recursive search wants direct children only */
+    return recursive || prec->name_offset == scope_len + 1;
+}
+
+static void fsearch_index_check(fsearch_cfg_t *pcfg, const char *scope, size_t scope_len, fsearch_record_t *prec)
+{
+    if (scope != NULL ? !fsearch_index_scope(scope, scope_len, prec, pcfg->recursive) :
+        (!pcfg->recursive && prec->depth > 1)) return;
+
+    const char *name = &prec->path[prec->name_offset];
+    size_t name_len = prec->length - prec->name_offset;
+
+    if (fsearch_check_entry(pcfg, name, name_len, &prec->stat) &&
+        fsearch_check_content(pcfg, AT_FDCWD, prec->path, prec->path, &prec->stat))
+        fsearch_report_match(pcfg, &prec->stat, prec->path, prec->name_offset ? prec->name_offset - 1 : 0);
+}
+
+static int fsearch_trigram_compare(const void *key, const void *entry)
+{
+    uint32_t trigram = *(const uint32_t*)key;
+    uint32_t other = ((const fsearch_trigram_t*)entry)->trigram;
+    return trigram < other ? -1 : trigram > other;
+}
+
+static int fsearch_postings_intersect(const uint8_t *pos, const uint8_t *end, const fsearch_trigram_t *ptrigram,
+    uint64_t record_count, uint64_t *records, size_t *pcount, int first)
+{
+    uint64_t i, record = 0;
+    size_t count = 0, j = 0;
+
+    for (i = 0; i < ptrigram->count && (first || j < *pcount); i++)
+    {
+        uint64_t delta;
+        if (fsearch_varint_get(&pos, end, &delta) < 0) return -1;
+
+        /* Records must be strictly ascending inside the index */
+        if ((i && !delta) || delta >= record_count - record) return -1;
+        record += delta;
+
+        if (first)
+        {
+            records[count++] = record;
+            continue;
+        }
+
+        while (j < *pcount && records[j] < record) j++;
+        if (j < *pcount && records[j] == record) records[count++] = records[j++];
+    }
+
+    *pcount = count;
+    return 0;
+}
+
+/*
+    Collect records containing every trigram of the -f pattern.
+    Returns -1 when the pattern has no trigram and a full scan is needed.
+*/
+static int fsearch_index_candidates(const fsearch_matcher_t *pmatcher, const uint8_t *data,
+    const fsearch_index_header_t *pheader, uint64_t **precords, size_t *pcount)
+{
+    uint32_t trigrams[FSEARCH_PATTERN_MAX];
+    size_t i, count = 0;
+
+    *precords = NULL;
+    *pcount = 0;
+
+    if (pmatcher->regex != NULL || !pmatcher->length || !pheader->trigram_count) return -1;
+
+    /* Tokens are NUL separated and every one must appear in the name */
+    if (!pmatcher->use_regex) count = fsearch_trigrams_get(pmatcher->pattern, pmatcher->length, trigrams, FSEARCH_PATTERN_MAX);
+    else
+    {
+        for (i = 0; i < pmatcher->count; i++)
+        {
+            uint32_t token_trigrams[FSEARCH_PATTERN_MAX];
+            const fsearch_token_t *token = &pmatcher->tokens[i];
+            size_t j, token_count = fsearch_trigrams_get(token->data, token->length, token_trigrams, FSEARCH_PATTERN_MAX);
+            for (j = 0; j < token_count && count < FSEARCH_PATTERN_MAX; j++) trigrams[count++] = token_trigrams[j];
+        }
+    }
+
+    if (!count) return -1;
+
+    const fsearch_trigram_t *table = (const fsearch_trigram_t*)(data + pheader->trigrams_offset);
+    const fsearch_trigram_t *lists[FSEARCH_PATTERN_MAX];
+
+    for (i = 0; i < count; i++)
+    {
+        const fsearch_trigram_t *plist = bsearch(&trigrams[i], table, pheader->trigram_count, sizeof(fsearch_trigram_t), fsearch_trigram_compare);
+        if (plist == NULL) return 0; /* No record can match */
+
+        /* Shortest lists first, intersection only shrinks */
+        size_t j;
+        for (j = i; j > 0 && lists[j - 1]->count > plist->count; j--) lists[j] = lists[j - 1];
+        lists[j] = plist;
+    }
+
+    uint64_t *records = (uint64_t*)malloc((lists[0]->count ? lists[0]->count : 1) * sizeof(uint64_t));
+    if (records == NULL) return -2;
+
+    const uint8_t *end = data + pheader->trigrams_offset;
+    size_t found = 0;
+
+    for (i = 0; i < count && (!i || found); i++)
+    {
+        if (lists[i]->offset < pheader->blocks_offset || lists[i]->offset > pheader->trigrams_offset ||
+            fsearch_postings_intersect(data + lists[i]->offset, end, lists[i], pheader->count, records, &found, !i) < 0)
+        {
+            free(records);
+            return -3;
+        }
+    }
+
+    *precords = records;
+    *pcount = found;
+    return 0;
+}
+
+static int fsearch_index_open(fsearch_cfg_t *pcfg, const char *path, fsearch_index_reader_t *preader)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fsearch_log_error(pcfg, path);
+        return -1;
+    }
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) < 0 || (size_t)statbuf.st_size < sizeof(fsearch_index_header_t))
+    {
+        if (!errno) errno = EINVAL;
+        fsearch_log_error(pcfg, path);
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)statbuf.st_size;
+    const uint8_t *data = (const uint8_t*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        fsearch_log_error(pcfg, path);
+        return -1;
+    }
+
+    const fsearch_index_header_t *pheader = (const fsearch_index_header_t*)data;
+    uint64_t block_count = (pheader->count + FSEARCH_INDEX_BLOCK - 1) / FSEARCH_INDEX_BLOCK;
+
+    if (memcmp(pheader->magic, FSEARCH_INDEX_MAGIC, sizeof(pheader->magic)) ||
+        pheader->version != FSEARCH_INDEX_VERSION ||
+        pheader->block_size != FSEARCH_INDEX_BLOCK ||
+        pheader->data_offset > size || pheader->blocks_offset > size ||
+        pheader->data_offset > pheader->blocks_offset ||
+        pheader->blocks_offset % 8 || block_count > (size - pheader->blocks_offset) / sizeof(uint64_t) ||
+        (pheader->dir_count && (pheader->dirs_offset % 8 ||
+            pheader->dirs_offset < pheader->blocks_offset + block_count * sizeof(uint64_t) ||
+            pheader->dirs_offset > size ||
+            pheader->dir_count > (size - pheader->dirs_offset) / sizeof(fsearch_index_dir_t))) ||
+        (pheader->trigram_count && (pheader->trigrams_offset % 8 ||
+            pheader->trigrams_offset < pheader->blocks_offset + block_count * sizeof(uint64_t) ||
+            pheader->trigrams_offset > size ||
+            pheader->trigram_count > (size - pheader->trigrams_offset) / sizeof(fsearch_trigram_t))))
+    {
+        fprintf(stderr, "%s: '%s': Invalid index file\n", pcfg->exec_name, path);
+        munmap((void*)data, size);
+        return -1;
+    }
+
+    preader->data = data;
+    preader->size = size;
+    preader->pheader = pheader;
+    preader->blocks = (const uint64_t*)(data + pheader->blocks_offset);
+    preader->dirs = pheader->dir_count ? (const fsearch_index_dir_t*)(data + pheader->dirs_offset) : NULL;
+    preader->pos = data + pheader->data_offset;
+    preader->next = 0;
+    preader->record.length = 0;
+    return 0;
+}
+
+static void fsearch_index_close(fsearch_index_reader_t *preader)
+{
+    munmap((void*)preader->data, preader->size);
+}
+
+/* Decodes record number target, from start of its block when it is not ahead */
+static int fsearch_index_seek(fsearch_index_reader_t *preader, uint64_t target)
+{
+    const fsearch_index_header_t *pheader = preader->pheader;
+    const uint8_t *end = preader->data + pheader->blocks_offset;
+
+    if (target / FSEARCH_INDEX_BLOCK != preader->next / FSEARCH_INDEX_BLOCK || target < preader->next)
+    {
+        uint64_t block = preader->blocks[target / FSEARCH_INDEX_BLOCK];
+        if (block < pheader->data_offset || block >= pheader->blocks_offset) return -1;
+
+        preader->pos = preader->data + block;
+        preader->next = target - target % FSEARCH_INDEX_BLOCK;
+    }
+
+    for (; preader->next <= target; preader->next++)
+    {
+        int restart = preader->next % FSEARCH_INDEX_BLOCK == 0;
+        if (fsearch_record_decode(&preader->pos, end, restart, &preader->record) < 0) return -1;
+    }
+
+    return 0;
+}
+
+int fsearch_index_search(fsearch_cfg_t *pcfg, const char *path)
+{
+    fsearch_index_reader_t *preader = (fsearch_index_reader_t*)malloc(sizeof(fsearch_index_reader_t));
+    if (preader == NULL)
+    {
+        fsearch_log_error(pcfg, path);
+        return -1;
+    }
+
+    if (fsearch_index_open(pcfg, path, preader) < 0)
+    {
+        free(preader);
+        return -1;
+    }
+
+    /* Default directory means whole index, otherwise limit to sub tree */
+    char scope[FSEARCH_FULL_PATH_LEN];
+    size_t scope_len = 0;
+    int scoped = strcmp(pcfg->directory, "./") != 0;
+
+    if (scoped)
+    {
+        scope_len = strlen(pcfg->directory);
+        while (scope_len > 0 && pcfg->directory[scope_len - 1] == '/') scope_len--;
+        memcpy(scope, pcfg->directory, scope_len);
+        scope[scope_len] = '\0';
+    }
+
+    const fsearch_index_header_t *pheader = preader->pheader;
+    uint64_t *records = NULL;
+    size_t record_count = 0;
+    int candidates = fsearch_index_candidates(&pcfg->matcher, preader->data, pheader, &records, &record_count);
+
+    if (candidates < -1)
+    {
+        if (candidates == -2) fsearch_log_error(pcfg, path);
+        else fprintf(stderr, "%s: '%s': Corrupted index postings\n", pcfg->exec_name, path);
+        fsearch_index_close(preader);
+        free(preader);
+        return -1;
+    }
+
+    /* Full scan decodes records front to back, candidates jump by blocks */
+    madvise((void*)preader->data, preader->size, candidates < 0 ? MADV_SEQUENTIAL : MADV_RANDOM);
+
+    uint64_t i;
+    int status = 1;
+
+    for (i = 0; !fsearch_search_stopped(pcfg); i++)
+    {
+        uint64_t target = i;
+
+        if (candidates == 0)
+        {
+            if (i >= record_count) break;
+            target = records[i];
+        }
+        else if (i >= pheader->count) break;
+
+        if (fsearch_index_seek(preader, target) < 0)
+        {
+            fprintf(stderr, "%s: '%s': Corrupted index record\n", pcfg->exec_name, path);
+            status = -1;
+            break;
+        }
+
+        fsearch_index_check(pcfg, scoped ? scope : NULL, scope_len, &preader->record);
+    }
+
+    free(records);
+    fsearch_index_close(preader);
+    free(preader);
+    return status;
+}
+
+/* Path below indexed root, so indexes of different roots can be compared */
+static const char* fsearch_diff_path(const fsearch_index_reader_t *preader)
+{
+    const char *path = preader->record.path;
+    if (preader->record.length >= preader->pheader->root_length) path += preader->pheader->root_length;
+
+    while (*path == '/') path++;
+    return path;
+}
+
+/* Records are in pre-order with sorted siblings, so slash sorts before any other byte */
+static int fsearch_diff_compare(const char *first, const char *second)
+{
+    const unsigned char *x = (const unsigned char*)first;
+    const unsigned char *y = (const unsigned char*)second;
+
+    while (*x && *x == *y) { x++; y++; }
+    int cx = *x == '/' ? 1 : (*x ? *x + 1 : 0);
+    int cy = *y == '/' ? 1 : (*y ? *y + 1 : 0);
+    return cx - cy;
+}
+
+static int fsearch_diff_changed(const struct stat *pold, const struct stat *pnew)
+{
+    return pold->st_mode != pnew->st_mode || pold->st_uid != pnew->st_uid ||
+        pold->st_gid != pnew->st_gid || pold->st_size != pnew->st_size ||
+        pold->st_mtime != pnew->st_mtime;
+}
+
+static int fsearch_diff_dir_compare(const void *key, const void *entry)
+{
+    uint64_t record = *(const uint64_t*)key;
+    uint64_t other = ((const fsearch_index_dir_t*)entry)->record;
+    return record < other ? -1 : record > other;
+}
+
+/* Sub tree of directory record, NULL if index has no table or it is damaged */
+static const fsearch_index_dir_t* fsearch_diff_dir(const fsearch_index_reader_t *preader, uint64_t record)
+{
+    if (preader->dirs == NULL) return NULL;
+
+    const fsearch_index_dir_t *pdir = bsearch(&record, preader->dirs, preader->pheader->dir_count,
+        sizeof(fsearch_index_dir_t), fsearch_diff_dir_compare);
+
+    if (pdir == NULL || pdir->count >= preader->pheader->count - record) return NULL;
+    return pdir;
+}
+
+/* Returns 1 when record is decoded, 0 after last record and -1 if it is corrupted */
+static int fsearch_diff_load(fsearch_index_reader_t *preader, uint64_t record)
+{
+    if (record >= preader->pheader->count) return 0;
+    if (preader->next != record + 1 && fsearch_index_seek(preader, record) < 0) return -1;
+    return 1;
+}
+
+static void fsearch_diff_report(fsearch_cfg_t *pcfg, const char *change, fsearch_record_t *prec)
+{
+    const char *name = &prec->path[prec->name_offset];
+    if (!fsearch_check_entry(pcfg, name, prec->length - prec->name_offset, &prec->stat)) return;
+
+    /* Kind of change leads the line, the rest is printed as any match */
+    if (!pcfg->quiet) fsearch_output_write(&pcfg->writer, change, 2);
+    fsearch_report_match(pcfg, &prec->stat, prec->path, prec->name_offset ? prec->name_offset - 1 : 0);
+}
+
+int fsearch_index_diff(fsearch_cfg_t *pcfg, const char *old_path, const char *new_path)
+{
+    fsearch_index_reader_t *readers = (fsearch_index_reader_t*)malloc(2 * sizeof(fsearch_index_reader_t));
+    if (readers == NULL)
+    {
+        fsearch_log_error(pcfg, old_path);
+        return -1;
+    }
+
+    fsearch_index_reader_t *pold = &readers[0], *pnew = &readers[1];
+
+    if (fsearch_index_open(pcfg, old_path, pold) < 0)
+    {
+        free(readers);
+        return -1;
+    }
+
+    if (fsearch_index_open(pcfg, new_path, pnew) < 0)
+    {
+        fsearch_index_close(pold);
+        free(readers);
+        return -1;
+    }
+
+    /* Both indexes are read front to back, skipped sub trees jump ahead */
+    madvise((void*)pold->data, pold->size, MADV_SEQUENTIAL);
+    madvise((void*)pnew->data, pnew->size, MADV_SEQUENTIAL);
+
+    uint64_t i = 0, j = 0;
+    int status = 1;
+
+    while (!fsearch_search_stopped(pcfg))
+    {
+        int old_state = fsearch_diff_load(pold, i);
+        int new_state = fsearch_diff_load(pnew, j);
+
+        if (old_state < 0 || new_state < 0)
+        {
+            fprintf(stderr, "%s: '%s': Corrupted index record\n", pcfg->exec_name, old_state < 0 ? old_path : new_path);
+            status = -1;
+            break;
+        }
+
+        if (!old_state && !new_state) break;
+
+        int order = !old_state ? 1 : (!new_state ? -1 :
+            fsearch_diff_compare(fsearch_diff_path(pold), fsearch_diff_path(pnew)));
+
+        if (order < 0)
+        {
+            fsearch_diff_report(pcfg, "- ", &pold->record);
+            i++;
+            continue;
+        }
+
+        if (order > 0)
+        {
+            fsearch_diff_report(pcfg, "+ ", &pnew->record);
+            j++;
+            continue;
+        }
+
+        int changed = fsearch_diff_changed(&pold->record.stat, &pnew->record.stat);
+        if (changed) fsearch_diff_report(pcfg, "~ ", &pnew->record);
+
+        /* Directory with the same mtime and the same records below is skipped whole */
+        if (!changed && S_ISDIR(pnew->record.stat.st_mode))
+        {
+            const fsearch_index_dir_t *pold_dir = fsearch_diff_dir(pold, i);
+            const fsearch_index_dir_t *pnew_dir = fsearch_diff_dir(pnew, j);
+
+            if (pold_dir != NULL && pnew_dir != NULL &&
+                pold_dir->hash[0] == pnew_dir->hash[0] && pold_dir->hash[1] == pnew_dir->hash[1])
+            {
+                i += pold_dir->count;
+                j += pnew_dir->count;
+            }
+        }
+
+        i++;
+        j++;
+    }
+
+    fsearch_index_close(pnew);
+    fsearch_index_close(pold);
+    free(readers);
+    return status;
+}
@@ -0,0 +1,22 @@
+/*
+ *  src/index.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * Persistent memory mapped file name index
+ */
+
+#ifndef __FSEARCH_INDEX_H__
+#define __FSEARCH_INDEX_H__
+
+#include "config.h"
+
+int fsearch_index_build(fsearch_cfg_t *pcfg, const char *path);
+int fsearch_index_search(fsearch_cfg_t *pcfg, const char *path);
+
+/* Reports entries added (+), removed (-) and changed (~) between two
+   indexes, sub trees whose directory and hash are equal are skipped */
+int fsearch_index_diff(fsearch_cfg_t *pcfg, const char *old_path, const char *new_path);
+
+#endif /* __FSEARCH_INDEX_H__ */
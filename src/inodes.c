@@ -0,0 +1,111 @@
+/*
+ *  src/inodes.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Set of visited (device, inode) pairs for symlink
+ * following (-L) and hard link dedupe (--unique-inodes)
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include "inodes.h"
+
+fsearch_inodes_t* fsearch_inodes_create(void)
+{
+    fsearch_inodes_t *pinodes = (fsearch_inodes_t*)malloc(sizeof(fsearch_inodes_t));
+    if (pinodes == NULL) return NULL;
+
+    pinodes->slots = (fsearch_inode_t*)calloc(FSEARCH_INODES_MIN, sizeof(fsearch_inode_t));
+    if (pinodes->slots == NULL || pthread_mutex_init(&pinodes->lock, NULL))
+    {
+        free(pinodes->slots);
+        free(pinodes);
+        return NULL;
+    }
+
+    pinodes->capacity = FSEARCH_INODES_MIN;
+    pinodes->count = 0;
+    return pinodes;
+}
+
+void fsearch_inodes_destroy(fsearch_inodes_t *pinodes)
+{
+    if (pinodes == NULL) return;
+    pthread_mutex_destroy(&pinodes->lock);
+    free(pinodes->slots);
+    free(pinodes);
+}
+
+static size_t fsearch_inodes_hash(uint64_t dev, uint64_t ino)
+{
+    uint64_t k = ino ^ (dev * 0x9e3779b97f4a7c15ULL);
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    return (size_t)k;
+}
+
+/* Slot of pair or the free slot where it belongs */
+static fsearch_inode_t* fsearch_inodes_find(fsearch_inode_t *slots, size_t capacity, uint64_t dev, uint64_t ino)
+{
+    size_t i = fsearch_inodes_hash(dev, ino) & (capacity - 1);
+
+    while (slots[i].dev && (slots[i].dev != dev || slots[i].ino != ino))
+        i = (i + 1) & (capacity - 1);
+
+    return &slots[i];
+}
+
+static int fsearch_inodes_grow(fsearch_inodes_t *pinodes)
+{
+    size_t i, capacity = pinodes->capacity * 2;
+    fsearch_inode_t *slots = (fsearch_inode_t*)calloc(capacity, sizeof(fsearch_inode_t));
+    if (slots == NULL) return -1;
+
+    for (i = 0; i < pinodes->capacity; i++)
+    {
+        const fsearch_inode_t *pslot = &pinodes->slots[i];
+        if (pslot->dev) *fsearch_inodes_find(slots, capacity, pslot->dev, pslot->ino) = *pslot;
+    }
+
+    free(pinodes->slots);
+    pinodes->slots = slots;
+    pinodes->capacity = capacity;
+    return 0;
+}
+
+int fsearch_inodes_insert(fsearch_inodes_t *pinodes, dev_t dev, ino_t ino)
+{
+    uint64_t key = (uint64_t)dev + 1;
+    int status = 0;
+
+    pthread_mutex_lock(&pinodes->lock);
+    fsearch_inode_t *pslot = fsearch_inodes_find(pinodes->slots, pinodes->capacity, key, (uint64_t)ino);
+
+    if (!pslot->dev)
+    {
+        pslot->dev = key;
+        pslot->ino = (uint64_t)ino;
+        status = 1;
+
+        /* Keep probes short, table is at most 3/4 full */
+        if (++pinodes->count * 4 > pinodes->capacity * 3 && fsearch_inodes_grow(pinodes) < 0)
+        {
+            /* Table could not grow, undo so it never gets full */
+            pslot->dev = 0;
+            pinodes->count--;
+            errno = ENOMEM;
+            status = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&pinodes->lock);
+    return status;
+}
+
+size_t fsearch_inodes_memory(const fsearch_inodes_t *pinodes)
+{
+    return sizeof(fsearch_inodes_t) + pinodes->capacity * sizeof(fsearch_inode_t);
+}
@@ -0,0 +1,40 @@
+/*
+ *  src/inodes.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Set of visited (device, inode) pairs for symlink
+ * following (-L) and hard link dedupe (--unique-inodes)
+ */
+
+#ifndef __FSEARCH_INODES_H__
+#define __FSEARCH_INODES_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define FSEARCH_INODES_MIN      1024    // Initial slot count, power of two
+
+typedef struct fsearch_inode_ {
+    uint64_t dev;                       // Device plus one, zero marks free slot
+    uint64_t ino;
+} fsearch_inode_t;
+
+typedef struct fsearch_inodes_ {
+    pthread_mutex_t lock;               // Inserts come from all workers
+    fsearch_inode_t *slots;             // Open addressing, linear probing
+    size_t capacity;                    // Slot count, power of two
+    size_t count;                       // Used slots
+} fsearch_inodes_t;
+
+fsearch_inodes_t* fsearch_inodes_create(void);
+void fsearch_inodes_destroy(fsearch_inodes_t *pinodes);
+
+/* Returns 1 if pair was added, 0 if it was already there, -1 on error */
+int fsearch_inodes_insert(fsearch_inodes_t *pinodes, dev_t dev, ino_t ino);
+size_t fsearch_inodes_memory(const fsearch_inodes_t *pinodes);
+
+#endif /* __FSEARCH_INODES_H__ */
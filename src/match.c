@@ -0,0 +1,260 @@
+/*
+ *  src/match.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * Compiled case insensitive file name matcher
+ */
+
+#include <string.h>
+#include "match.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define FSEARCH_USE_SIMD
+#include <immintrin.h>
+#endif
+
+typedef const char*(*fsearch_find_fn_t)(const char*, size_t, const char*, size_t);
+
+static inline int fsearch_equal_scalar(const char *data, const char *lower, size_t length)
+{
+    size_t i;
+    for (i = 0; i < length; i++)
+        if (FSEARCH_LOWER(data[i]) != (unsigned char)lower[i]) return 0;
+
+    return 1;
+}
+
+static const char* fsearch_find_scalar(const char *haystack, size_t length, const char *needle, size_t needle_len)
+{
+    size_t i;
+    if (needle_len > length) return NULL;
+
+    for (i = 0; i <= length - needle_len; i++)
+    {
+        if (FSEARCH_LOWER(haystack[i]) == (unsigned char)needle[0] &&
+            fsearch_equal_ci(&haystack[i + 1], &needle[1], needle_len - 1))
+                return &haystack[i];
+    }
+
+    return NULL;
+}
+
+#ifdef FSEARCH_USE_SIMD
+static inline __m128i fsearch_lower_sse2(__m128i data)
+{
+    __m128i upper = _mm_and_si128(
+        _mm_cmpgt_epi8(data, _mm_set1_epi8('A' - 1)),
+        _mm_cmplt_epi8(data, _mm_set1_epi8('Z' + 1)));
+
+    return _mm_or_si128(data, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static const char* fsearch_find_sse2(const char *haystack, size_t length, const char *needle, size_t needle_len)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+    size_t i = 0;
+
+    /* Compare first and last needle bytes at 16 positions at once */
+    for (; i + needle_len - 1 + 16 <= length; i += 16)
+    {
+        __m128i block_first = fsearch_lower_sse2(_mm_loadu_si128((const __m128i*)&haystack[i]));
+        __m128i block_last = fsearch_lower_sse2(_mm_loadu_si128((const __m128i*)&haystack[i + needle_len - 1]));
+
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(block_first, first),
+            _mm_cmpeq_epi8(block_last, last)));
+
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+            if (fsearch_equal_ci(&haystack[i + bit + 1], &needle[1], needle_len - 1))
+                return &haystack[i + bit];
+
+            mask &= mask - 1;
+        }
+    }
+
+    return fsearch_find_scalar(&haystack[i], length - i, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i fsearch_lower_avx2(__m256i data)
+{
+    __m256i upper = _mm256_and_si256(
+        _mm256_cmpgt_epi8(data, _mm256_set1_epi8('A' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), data));
+
+    return _mm256_or_si256(data, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static const char* fsearch_find_avx2(const char *haystack, size_t length, const char *needle, size_t needle_len)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+    size_t i = 0;
+
+    /* Same as SSE2 kernel, but 32 positions at once */
+    for (; i + needle_len - 1 + 32 <= length; i += 32)
+    {
+        __m256i block_first = fsearch_lower_avx2(_mm256_loadu_si256((const __m256i*)&haystack[i]));
+        __m256i block_last = fsearch_lower_avx2(_mm256_loadu_si256((const __m256i*)&haystack[i + needle_len - 1]));
+
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(block_first, first),
+            _mm256_cmpeq_epi8(block_last, last)));
+
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+            if (fsearch_equal_scalar(&haystack[i + bit + 1], &needle[1], needle_len - 1))
+            {
+                _mm256_zeroupper();
+                return &haystack[i + bit];
+            }
+
+            mask &= mask - 1;
+        }
+    }
+
+    /* Avoid AVX to SSE transition penalty in the tail kernel */
+    _mm256_zeroupper();
+    return fsearch_find_sse2(&haystack[i], length - i, needle, needle_len);
+}
+#endif
+
+static fsearch_find_fn_t fsearch_find_kernel(void)
+{
+    static fsearch_find_fn_t kernel = NULL;
+    fsearch_find_fn_t current = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+    if (current != NULL) return current;
+
+#ifdef FSEARCH_USE_SIMD
+    __builtin_cpu_init();
+    current = __builtin_cpu_supports("avx2") ? fsearch_find_avx2 : fsearch_find_sse2;
+#else
+    current = fsearch_find_scalar;
+#endif
+
+    __atomic_store_n(&kernel, current, __ATOMIC_RELAXED);
+    return current;
+}
+
+int fsearch_equal_ci(const char *data, const char *lower, size_t length)
+{
+    size_t i = 0;
+
+#ifdef FSEARCH_USE_SIMD
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i block = fsearch_lower_sse2(_mm_loadu_si128((const __m128i*)&data[i]));
+        __m128i expect = _mm_loadu_si128((const __m128i*)&lower[i]);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, expect)) != 0xFFFF) return 0;
+    }
+#endif
+
+    return fsearch_equal_scalar(&data[i], &lower[i], length - i);
+}
+
+const char* fsearch_find_ci(const char *haystack, size_t length, const char *needle, size_t needle_len)
+{
+    if (!needle_len) return haystack;
+    if (needle_len > length) return NULL;
+    return fsearch_find_kernel()(haystack, length, needle, needle_len);
+}
+
+void fsearch_matcher_destroy(fsearch_matcher_t *pmatcher)
+{
+    fsearch_regex_free(pmatcher->regex);
+    pmatcher->regex = NULL;
+}
+
+int fsearch_matcher_compile_regex(fsearch_matcher_t *pmatcher, const char *pattern, int is_glob, char *error, size_t size)
+{
+    fsearch_regex_t *pregex = fsearch_regex_compile(pattern, is_glob, error, size);
+    if (pregex == NULL) return -1;
+
+    fsearch_matcher_compile(pmatcher, pattern);
+    pmatcher->regex = pregex;
+    return 0;
+}
+
+int fsearch_matcher_compile(fsearch_matcher_t *pmatcher, const char *pattern)
+{
+    size_t i, length = strnlen(pattern, sizeof(pmatcher->pattern) - 1);
+    fsearch_matcher_destroy(pmatcher);
+
+    /* Change file name to lowercase to support case sensitivity */
+    for (i = 0; i < length; i++) pmatcher->pattern[i] = FSEARCH_LOWER(pattern[i]);
+    pmatcher->pattern[length] = '\0';
+
+    pmatcher->length = length;
+    pmatcher->use_regex = memchr(pmatcher->pattern, '+', length) != NULL;
+    pmatcher->count = 0;
+
+    if (!pmatcher->use_regex) return 0;
+    char *token = pmatcher->pattern;
+
+    /* Split tokens once, empty tokens are skipped like strtok does */
+    for (i = 0; i <= length; i++)
+    {
+        if (pmatcher->pattern[i] != '+' && pmatcher->pattern[i] != '\0') continue;
+        pmatcher->pattern[i] = '\0';
+
+        size_t token_len = (size_t)(&pmatcher->pattern[i] - token);
+        if (token_len && pmatcher->count < FSEARCH_TOKENS_MAX)
+        {
+            pmatcher->tokens[pmatcher->count].data = token;
+            pmatcher->tokens[pmatcher->count].length = token_len;
+            pmatcher->count++;
+        }
+
+        token = &pmatcher->pattern[i + 1];
+    }
+
+    return 1;
+}
+
+int fsearch_matcher_match(const fsearch_matcher_t *pmatcher, const char *name, size_t length)
+{
+    if (!pmatcher->length) return 1;
+
+    /* Glob and regex patterns run in DFA */
+    if (pmatcher->regex != NULL) return fsearch_regex_match(pmatcher->regex, name, length);
+
+    /* There is no regex operator in search criteria */
+    if (!pmatcher->use_regex)
+    {
+        if (length != pmatcher->length) return 0;
+        return fsearch_equal_ci(name, pmatcher->pattern, length);
+    }
+
+    if (!pmatcher->count) return 0;
+    const fsearch_token_t *token = &pmatcher->tokens[0];
+
+    const char *offset = fsearch_find_ci(name, length, token->data, token->length);
+    if (offset == NULL) return 0; /* Token not found */
+
+    const char *end = name + length;
+    size_t i;
+
+    for (i = 0; i < pmatcher->count; i++)
+    {
+        /* Compare token and file name offset */
+        token = &pmatcher->tokens[i];
+        if ((size_t)(end - offset) < token->length ||
+            !fsearch_equal_ci(offset, token->data, token->length)) return 0;
+
+        /* Move offset to the last character of token and 
+           skip all of its repetitions ('+' operator) */
+        offset += token->length - 1;
+        unsigned char skip_char = FSEARCH_LOWER(*offset);
+        while (offset < end && FSEARCH_LOWER(*offset) == skip_char) offset++;
+    }
+
+    /* All possible occurrences passed */
+    return 1;
+}
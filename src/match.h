@@ -0,0 +1,45 @@
+/*
+ *  src/match.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * Compiled case insensitive file name matcher
+ */
+
+#ifndef __FSEARCH_MATCH_H__
+#define __FSEARCH_MATCH_H__
+
+#include <stddef.h>
+#include "regex.h"
+
+#define FSEARCH_PATTERN_MAX     256
+#define FSEARCH_TOKENS_MAX      (FSEARCH_PATTERN_MAX / 2)
+
+/* ASCII only, same as tolower() in the default "C" locale */
+#define FSEARCH_LOWER(c) ((unsigned char)(c) | (((unsigned char)(c) - 'A' < 26u) << 5))
+
+typedef struct fsearch_token_ {
+    const char *data;               // Points into matcher pattern
+    size_t length;                  // Token length
+} fsearch_token_t;
+
+typedef struct fsearch_matcher_ {
+    fsearch_token_t tokens[FSEARCH_TOKENS_MAX]; // Pre-split regex tokens
+    fsearch_regex_t *regex;                     // Compiled glob or regex (-g/-e)
+    char pattern[FSEARCH_PATTERN_MAX];          // Lowercase pattern, tokens are NUL separated
+    size_t length;                              // Pattern length (zero matches everything)
+    size_t count;                               // Count of regex tokens
+    int use_regex;                              // Pattern contains '+' operator
+} fsearch_matcher_t;
+
+int fsearch_matcher_compile(fsearch_matcher_t *pmatcher, const char *pattern);
+int fsearch_matcher_compile_regex(fsearch_matcher_t *pmatcher, const char *pattern, int is_glob, char *error, size_t size);
+void fsearch_matcher_destroy(fsearch_matcher_t *pmatcher);
+int fsearch_matcher_match(const fsearch_matcher_t *pmatcher, const char *name, size_t length);
+
+/* Case insensitive primitives, needle must be lowercase */
+const char* fsearch_find_ci(const char *haystack, size_t length, const char *needle, size_t needle_len);
+int fsearch_equal_ci(const char *data, const char *lower, size_t length);
+
+#endif /* __FSEARCH_MATCH_H__ */
@@ -0,0 +1,147 @@
+/*
+ *  src/names.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * User and group name cache for verbose output
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <grp.h>
+#include <pwd.h>
+#include "names.h"
+
+#define FSEARCH_NSS_BUFFER      4096                // Used when sysconf has no size
+#define FSEARCH_NSS_BUFFER_MAX  (16 * 1024 * 1024)
+
+static unsigned int fsearch_names_slot(unsigned int id)
+{
+    /* Ids are often sequential, mix bits before masking */
+    id ^= id >> 16;
+    id *= 0x45d9f3b;
+    id ^= id >> 16;
+    return id & (FSEARCH_NAMES_SIZE - 1);
+}
+
+static void fsearch_names_resolve(unsigned int id, int is_group, char *output, size_t size)
+{
+    long initial = sysconf(is_group ? _SC_GETGR_R_SIZE_MAX : _SC_GETPW_R_SIZE_MAX);
+    size_t length = initial > 0 ? (size_t)initial : FSEARCH_NSS_BUFFER;
+    char *buffer = NULL;
+    int status = ERANGE;
+    output[0] = '\0';
+
+    /* Groups of directory services may list many members, grow until entry fits */
+    while (status == ERANGE && length <= FSEARCH_NSS_BUFFER_MAX)
+    {
+        char *pbuffer = (char*)realloc(buffer, length);
+        if (pbuffer == NULL) break;
+        buffer = pbuffer;
+
+        if (is_group)
+        {
+            struct group grp, *result = NULL;
+            status = getgrgid_r((gid_t)id, &grp, buffer, length, &result);
+            if (!status && result != NULL) snprintf(output, size, "%s", result->gr_name);
+        }
+        else
+        {
+            struct passwd pws, *result = NULL;
+            status = getpwuid_r((uid_t)id, &pws, buffer, length, &result);
+            if (!status && result != NULL) snprintf(output, size, "%s", result->pw_name);
+        }
+
+        length *= 2;
+    }
+
+    free(buffer);
+}
+
+/* Slot holding id or free slot for it, NULL when table is full */
+static fsearch_name_t* fsearch_names_find(fsearch_name_t *table, unsigned int id)
+{
+    unsigned int i, slot = fsearch_names_slot(id);
+
+    /* Linear probing, table never shrinks during the run */
+    for (i = 0; i < FSEARCH_NAMES_SIZE; i++)
+    {
+        fsearch_name_t *pentry = &table[(slot + i) & (FSEARCH_NAMES_SIZE - 1)];
+        if (!pentry->used || pentry->id == id) return pentry;
+    }
+
+    return NULL;
+}
+
+static size_t fsearch_names_get(fsearch_names_t *pnames, fsearch_name_t *table,
+    unsigned int id, int is_group, char *output, size_t size)
+{
+    char name[FSEARCH_NAME_LEN];
+    fsearch_name_t *pentry;
+
+    if (pnames != NULL)
+    {
+        pthread_mutex_lock(&pnames->lock);
+        pentry = fsearch_names_find(table, id);
+
+        if (pentry != NULL && pentry->used)
+        {
+            size_t length = snprintf(output, size, "%s", pentry->name);
+            pthread_mutex_unlock(&pnames->lock);
+            return length;
+        }
+
+        pthread_mutex_unlock(&pnames->lock);
+    }
+
+    /* NSS may be a network round trip, other threads keep using the cache */
+    fsearch_names_resolve(id, is_group, name, sizeof(name));
+
+    if (pnames != NULL)
+    {
+        /* Another thread may have stored the same id meanwhile */
+        pthread_mutex_lock(&pnames->lock);
+        pentry = fsearch_names_find(table, id);
+
+        if (pentry != NULL && !pentry->used)
+        {
+            memcpy(pentry->name, name, sizeof(name));
+            pentry->id = id;
+            pentry->used = 1;
+        }
+
+        pthread_mutex_unlock(&pnames->lock);
+    }
+
+    return snprintf(output, size, "%s", name);
+}
+
+fsearch_names_t* fsearch_names_create(void)
+{
+    fsearch_names_t *pnames = (fsearch_names_t*)calloc(1, sizeof(fsearch_names_t));
+    if (pnames == NULL) return NULL;
+
+    pthread_mutex_init(&pnames->lock, NULL);
+    return pnames;
+}
+
+void fsearch_names_destroy(fsearch_names_t *pnames)
+{
+    if (pnames == NULL) return;
+    pthread_mutex_destroy(&pnames->lock);
+    free(pnames);
+}
+
+size_t fsearch_names_user(fsearch_names_t *pnames, uid_t uid, char *output, size_t size)
+{
+    return fsearch_names_get(pnames, pnames ? pnames->users : NULL, (unsigned int)uid, 0, output, size);
+}
+
+size_t fsearch_names_group(fsearch_names_t *pnames, gid_t gid, char *output, size_t size)
+{
+    return fsearch_names_get(pnames, pnames ? pnames->groups : NULL, (unsigned int)gid, 1, output, size);
+}
@@ -0,0 +1,39 @@
+/*
+ *  src/names.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * User and group name cache for verbose output
+ */
+
+#ifndef __FSEARCH_NAMES_H__
+#define __FSEARCH_NAMES_H__
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#define FSEARCH_NAMES_SIZE      512     // Slots per table, power of two
+#define FSEARCH_NAME_LEN        33
+
+typedef struct fsearch_name_ {
+    char name[FSEARCH_NAME_LEN];
+    unsigned int id;
+    int used;
+} fsearch_name_t;
+
+typedef struct fsearch_names_ {
+    pthread_mutex_t lock;
+    fsearch_name_t users[FSEARCH_NAMES_SIZE];
+    fsearch_name_t groups[FSEARCH_NAMES_SIZE];
+} fsearch_names_t;
+
+fsearch_names_t* fsearch_names_create(void);
+void fsearch_names_destroy(fsearch_names_t *pnames);
+
+/* Copy resolved name to output, empty string if id is unknown.
+   Cache can be NULL, then every call does a lookup. */
+size_t fsearch_names_user(fsearch_names_t *pnames, uid_t uid, char *output, size_t size);
+size_t fsearch_names_group(fsearch_names_t *pnames, gid_t gid, char *output, size_t size);
+
+#endif /* __FSEARCH_NAMES_H__ */
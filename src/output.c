@@ -0,0 +1,181 @@
+/*
+ *  src/output.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * Buffered output writer for stdout and output file
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "output.h"
+
+static int fsearch_output_writev(int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        /* Skip fully written vectors and adjust partially written one */
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
+static int fsearch_output_send(fsearch_output_t *pout, const char *data, size_t length)
+{
+    int i, status = 0;
+
+    for (i = 0; i < pout->count; i++)
+    {
+        /* Pending buffer and extra data go out with a single syscall */
+        struct iovec iov[2];
+        iov[0].iov_base = pout->buffer;
+        iov[0].iov_len = pout->length;
+        iov[1].iov_base = (void*)data;
+        iov[1].iov_len = length;
+
+        if (fsearch_output_writev(pout->fds[i], iov, 2) < 0) status = -1;
+    }
+
+    pout->written += pout->length + length;
+    pout->length = 0;
+    return status;
+}
+
+int fsearch_output_open(fsearch_output_t *pout, const char *path)
+{
+    pout->buffer = (char*)malloc(FSEARCH_OUTPUT_SIZE);
+    if (pout->buffer == NULL) return -1;
+
+    pout->length = 0;
+    pout->written = 0;
+    pout->fds[0] = STDOUT_FILENO;
+    pout->count = 1;
+    pout->owned = 1;
+
+    if (path != NULL && path[0] != '\0')
+    {
+        /* Open output file once for the whole search */
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            int error = errno;
+            free(pout->buffer);
+            pout->buffer = NULL;
+            errno = error;
+            return -1;
+        }
+
+        pout->fds[pout->count++] = fd;
+    }
+
+    return 0;
+}
+
+int fsearch_output_attach(fsearch_output_t *pout, const int *fds, int count)
+{
+    if (count < 1 || count > FSEARCH_OUTPUT_FDS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pout->buffer = (char*)malloc(FSEARCH_OUTPUT_SIZE);
+    if (pout->buffer == NULL) return -1;
+
+    /* Writer takes ownership of all given descriptors */
+    memcpy(pout->fds, fds, count * sizeof(int));
+    pout->length = 0;
+    pout->written = 0;
+    pout->count = count;
+    pout->owned = 0;
+    return 0;
+}
+
+int fsearch_output_write(fsearch_output_t *pout, const char *data, size_t length)
+{
+    if (pout->length + length <= FSEARCH_OUTPUT_SIZE)
+    {
+        memcpy(&pout->buffer[pout->length], data, length);
+        pout->length += length;
+        return 0;
+    }
+
+    /* Data does not fit, send it together with pending buffer */
+    return fsearch_output_send(pout, data, length);
+}
+
+char* fsearch_output_reserve(fsearch_output_t *pout, size_t length)
+{
+    /* Caller formats in place, flush if requested room is not free */
+    if (length > FSEARCH_OUTPUT_SIZE) return NULL;
+    if (pout->length + length > FSEARCH_OUTPUT_SIZE &&
+        fsearch_output_flush(pout) < 0) return NULL;
+
+    return &pout->buffer[pout->length];
+}
+
+void fsearch_output_commit(fsearch_output_t *pout, size_t length)
+{
+    pout->length += length;
+}
+
+int fsearch_output_vline(fsearch_output_t *pout, size_t max, const char *pFmt, va_list args)
+{
+    /* Make sure the longest possible line fits in buffer */
+    if (pout->length + max + 1 > FSEARCH_OUTPUT_SIZE &&
+        fsearch_output_flush(pout) < 0) return -1;
+
+    int length = vsnprintf(&pout->buffer[pout->length], max, pFmt, args);
+    if (length < 0) return -1;
+
+    /* Truncated like a fixed line buffer would do */
+    if ((size_t)length >= max) length = max - 1;
+
+    pout->length += length;
+    pout->buffer[pout->length++] = '\n';
+    return 0;
+}
+
+int fsearch_output_flush(fsearch_output_t *pout)
+{
+    if (!pout->length) return 0;
+    return fsearch_output_send(pout, NULL, 0);
+}
+
+void fsearch_output_close(fsearch_output_t *pout)
+{
+    if (pout->buffer == NULL) return;
+    fsearch_output_flush(pout);
+
+    int i;
+    for (i = pout->owned; i < pout->count; i++) close(pout->fds[i]);
+
+    free(pout->buffer);
+    pout->buffer = NULL;
+    pout->count = 0;
+}
@@ -0,0 +1,38 @@
+/*
+ *  src/output.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * Buffered output writer for stdout and output file
+ */
+
+#ifndef __FSEARCH_OUTPUT_H__
+#define __FSEARCH_OUTPUT_H__
+
+#include <stddef.h>
+#include <stdarg.h>
+
+#define FSEARCH_OUTPUT_SIZE     (64 * 1024)
+#define FSEARCH_OUTPUT_FDS      2
+
+typedef struct fsearch_output_ {
+    char *buffer;                       // Pending output
+    size_t length;                      // Used bytes in buffer
+    size_t written;                     // Bytes sent to each descriptor
+    int fds[FSEARCH_OUTPUT_FDS];        // Stdout and optional output file
+    int count;                          // Count of used descriptors
+    int owned;                          // First descriptor closed by writer
+} fsearch_output_t;
+
+/* Writer is not locked, callers must serialize access */
+int fsearch_output_open(fsearch_output_t *pout, const char *path);
+int fsearch_output_attach(fsearch_output_t *pout, const int *fds, int count);
+int fsearch_output_write(fsearch_output_t *pout, const char *data, size_t length);
+char* fsearch_output_reserve(fsearch_output_t *pout, size_t length);  // NULL if larger than buffer
+void fsearch_output_commit(fsearch_output_t *pout, size_t length);
+int fsearch_output_vline(fsearch_output_t *pout, size_t max, const char *pFmt, va_list args);
+int fsearch_output_flush(fsearch_output_t *pout);
+void fsearch_output_close(fsearch_output_t *pout);
+
+#endif /* __FSEARCH_OUTPUT_H__ */
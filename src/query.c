@@ -0,0 +1,157 @@
+/*
+ *  src/query.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Library interface (libfsearch): queries are compiled once
+ * and run any number of times, also from several threads
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "search.h"
+#include "worker.h"
+#include "index.h"
+#include "query.h"
+
+#define FSEARCH_QUERY_NAME      "libfsearch"
+
+struct fsearch_query_ {
+    fsearch_cfg_t config;           // Parsed options and compiled criteria
+    char **args;                    // Own copy of arguments, options point into it
+    int argc;
+};
+
+/* Option parser keeps its position in getopt globals */
+static pthread_mutex_t g_parse_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void fsearch_query_free_args(char **args, int argc)
+{
+    int i;
+
+    for (i = 0; i < argc; i++) free(args[i]);
+    free(args);
+}
+
+fsearch_query_t* fsearch_query_create(int argc, const char *argv[])
+{
+    fsearch_query_t *pquery = (fsearch_query_t*)calloc(1, sizeof(fsearch_query_t));
+    if (pquery == NULL) return NULL;
+
+    /* Program name comes first like in main, list ends with NULL */
+    pquery->args = (char**)calloc(argc + 2, sizeof(char*));
+    if (pquery->args == NULL)
+    {
+        free(pquery);
+        return NULL;
+    }
+
+    int i, status = 1;
+    pquery->args[0] = strdup(FSEARCH_QUERY_NAME);
+    if (pquery->args[0] == NULL) status = 0;
+
+    for (i = 0; i < argc && status; i++)
+        if ((pquery->args[i + 1] = strdup(argv[i])) == NULL) status = 0;
+
+    pquery->argc = argc + 1;
+    if (!status)
+    {
+        fsearch_query_free_args(pquery->args, pquery->argc);
+        free(pquery);
+        return NULL;
+    }
+
+    /* Verbose dates are formatted with localtime_r, which expects tzset */
+    tzset();
+
+    /* Zero makes getopt drop state left by the previous parse */
+    pthread_mutex_lock(&g_parse_lock);
+    optind = 0;
+    status = fsearch_parse_args(&pquery->config, pquery->argc, pquery->args);
+    pthread_mutex_unlock(&g_parse_lock);
+
+    /* Queries only search, index building and daemon have their own entry points
+       and options which print their results can not be given to a callback */
+    fsearch_cfg_t *pcfg = &pquery->config;
+    if (!status || pcfg->build_index || pcfg->socket != NULL || pcfg->diff != NULL ||
+        pcfg->duplicates || pcfg->du != NULL || pcfg->stats != NULL || pcfg->output != NULL)
+    {
+        fsearch_query_destroy(pquery);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return pquery;
+}
+
+void fsearch_query_destroy(fsearch_query_t *pquery)
+{
+    if (pquery == NULL) return;
+
+    fsearch_config_destroy(&pquery->config);
+    fsearch_query_free_args(pquery->args, pquery->argc);
+    free(pquery);
+}
+
+long fsearch_query_run(const fsearch_query_t *pquery, const char *directory,
+    fsearch_match_cb_t callback, void *ctx, int *cancel)
+{
+    if (callback == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Compiled criteria are shared read only, search state is per run */
+    fsearch_cfg_t config = pquery->config;
+    int interrupted = 0;
+
+    config.interrupted = cancel != NULL ? cancel : &interrupted;
+    if (directory != NULL) config.directory = directory;
+    config.callback = callback;
+    config.ctx = ctx;
+    config.stopped = 0;
+    config.result_count = 0;
+    config.is_found = 0;
+
+    /* Callback gets full stat, it is taken for matches only */
+    config.need_stat = 1;
+
+    /* Matches go to callback, nothing is printed */
+    config.writer.buffer = NULL;
+    config.names = NULL;
+    config.tree = NULL;
+    config.stats = NULL;
+    config.du = NULL;
+
+    /* Visited inodes belong to one run */
+    if (config.inodes != NULL && (config.inodes = fsearch_inodes_create()) == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (pthread_mutex_init(&config.lock, NULL))
+    {
+        fsearch_inodes_destroy(config.inodes);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int status;
+    if (config.index != NULL) status = fsearch_index_search(&config, config.index);
+    else if (config.threads > 1 || config.bfs) status = fsearch_search_parallel(&config, config.directory);
+    else status = fsearch_search_files(&config, config.directory);
+
+    int error = errno;
+    pthread_mutex_destroy(&config.lock);
+    fsearch_inodes_destroy(config.inodes);
+
+    errno = error;
+    return status < 0 ? -1 : (long)config.result_count;
+}
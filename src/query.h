@@ -0,0 +1,39 @@
+/*
+ *  src/query.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Library interface (libfsearch): queries are compiled once
+ * and run any number of times, also from several threads
+ */
+
+#ifndef __FSEARCH_QUERY_H__
+#define __FSEARCH_QUERY_H__
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/*
+    Called for every match, calls of one search never overlap.
+    Path and stat are only valid during the call, path[dir_len]
+    is where file name starts (after slash). Return non zero to
+    stop the search.
+*/
+typedef int (*fsearch_match_cb_t)(void *ctx, const char *path, size_t dir_len, const struct stat *pstat);
+
+typedef struct fsearch_query_ fsearch_query_t;
+
+/* Compiles command line style arguments (without program name), NULL
+   on invalid arguments or options which don't search (build, daemon) or
+   need printed output (diff, duplicates, du, stats, output file) */
+fsearch_query_t* fsearch_query_create(int argc, const char *argv[]);
+void fsearch_query_destroy(fsearch_query_t *pquery);
+
+/* Searches directory (or -d of query when NULL) and returns count of
+   reported matches, -1 with errno set if directory can not be searched.
+   Optional cancel flag may be set from other thread to stop the search. */
+long fsearch_query_run(const fsearch_query_t *pquery, const char *directory,
+    fsearch_match_cb_t callback, void *ctx, int *cancel);
+
+#endif /* __FSEARCH_QUERY_H__ */
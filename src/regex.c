@@ -0,0 +1,1049 @@
+/*
+ *  src/regex.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Glob and regular expression matching using
+ * lazily built DFA with literal prefiltering
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memmem()
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "regex.h"
+
+#define FSEARCH_NFA_MAX         8192    // Max count of NFA nodes
+#define FSEARCH_DFA_MAX         2048    // Max count of cached DFA states
+#define FSEARCH_DFA_BUCKETS     (FSEARCH_DFA_MAX * 2)
+#define FSEARCH_REPEAT_MAX      255     // Max count in {m,n}
+#define FSEARCH_LITERAL_MAX     256
+
+#define FSEARCH_SET_HAS(set, c) ((set)[(unsigned char)(c) >> 3] & (1 << ((unsigned char)(c) & 7)))
+#define FSEARCH_SET_ADD(set, c) ((set)[(unsigned char)(c) >> 3] |= (1 << ((unsigned char)(c) & 7)))
+
+typedef enum {
+    fsearch_nfa_class,              // Consume one byte from the class set
+    fsearch_nfa_split,              // Epsilon to both outs
+    fsearch_nfa_epsilon,            // Epsilon to first out
+    fsearch_nfa_bol,                // Beginning of input assertion
+    fsearch_nfa_eol,                // End of input assertion
+    fsearch_nfa_match               // Accepting node
+} fsearch_nfa_type_e;
+
+typedef struct fsearch_nfa_node_ {
+    fsearch_nfa_type_e type;
+    int out1;
+    int out2;
+    int set;                        // Byte set index for class nodes
+} fsearch_nfa_node_t;
+
+typedef struct fsearch_dfa_state_ {
+    int next[256];                  // Cached transitions, -1 if not built yet
+    int *nodes;                     // Sorted NFA node set
+    int count;                      // Count of NFA nodes
+    int is_match;                   // Contains accepting node
+    int eol_match;                  // Accepts if input ends here
+    uint32_t hash;
+} fsearch_dfa_state_t;
+
+struct fsearch_regex_ {
+    pthread_mutex_t lock;           // Protects lazy DFA construction
+    fsearch_nfa_node_t *nodes;
+    uint8_t (*sets)[32];            // Byte class bitmaps
+    int node_count;
+    int set_count;
+    int set_capacity;
+    int start;                      // NFA start node
+
+    fsearch_dfa_state_t **states;   // Cached DFA states (fixed capacity)
+    int *buckets;                   // Hash table of DFA states
+    int state_count;
+
+    int *mark;                      // Closure scratch space
+    int *stack;
+    int *scratch[2];
+    int generation;
+
+    char literal[FSEARCH_LITERAL_MAX]; // Required literal for prefilter
+    size_t literal_len;
+};
+
+typedef struct fsearch_frag_ {
+    int start;
+    int end;                        // Dangling epsilon node
+} fsearch_frag_t;
+
+typedef struct fsearch_parser_ {
+    fsearch_regex_t *pregex;
+    const char *pattern;
+    const char *error;
+    size_t length;
+    size_t pos;
+    int depth;
+
+    /* Longest required literal of top level concatenation */
+    char run[FSEARCH_LITERAL_MAX];
+    size_t run_len;
+    int alternation;
+    int atom_char;                  // Last atom as plain byte or -1
+} fsearch_parser_t;
+
+static int fsearch_parse_alt(fsearch_parser_t *pparser, fsearch_frag_t *pfrag);
+
+static int fsearch_nfa_add(fsearch_parser_t *pparser, fsearch_nfa_type_e type, int out1, int out2, int set)
+{
+    fsearch_regex_t *pregex = pparser->pregex;
+    if (pregex->node_count >= FSEARCH_NFA_MAX)
+    {
+        pparser->error = "Pattern is too complex";
+        return -1;
+    }
+
+    fsearch_nfa_node_t *pnode = &pregex->nodes[pregex->node_count];
+    pnode->type = type;
+    pnode->out1 = out1;
+    pnode->out2 = out2;
+    pnode->set = set;
+
+    return pregex->node_count++;
+}
+
+static int fsearch_set_add(fsearch_parser_t *pparser)
+{
+    fsearch_regex_t *pregex = pparser->pregex;
+
+    if (pregex->set_count >= pregex->set_capacity)
+    {
+        int capacity = pregex->set_capacity ? pregex->set_capacity * 2 : 16;
+        uint8_t (*sets)[32] = realloc(pregex->sets, capacity * sizeof(*sets));
+
+        if (sets == NULL)
+        {
+            pparser->error = "Out of memory";
+            return -1;
+        }
+
+        pregex->set_capacity = capacity;
+        pregex->sets = sets;
+    }
+
+    memset(pregex->sets[pregex->set_count], 0, sizeof(pregex->sets[0]));
+    return pregex->set_count++;
+}
+
+static int fsearch_frag_empty(fsearch_parser_t *pparser, fsearch_frag_t *pfrag)
+{
+    int node = fsearch_nfa_add(pparser, fsearch_nfa_epsilon, -1, -1, -1);
+    if (node < 0) return -1;
+
+    pfrag->start = pfrag->end = node;
+    return 0;
+}
+
+static int fsearch_frag_node(fsearch_parser_t *pparser, fsearch_nfa_type_e type, int set, fsearch_frag_t *pfrag)
+{
+    int end = fsearch_nfa_add(pparser, fsearch_nfa_epsilon, -1, -1, -1);
+    if (end < 0) return -1;
+
+    int start = fsearch_nfa_add(pparser, type, end, -1, set);
+    if (start < 0) return -1;
+
+    pfrag->start = start;
+    pfrag->end = end;
+    return 0;
+}
+
+static void fsearch_frag_concat(fsearch_parser_t *pparser, fsearch_frag_t *pfirst, const fsearch_frag_t *psecond)
+{
+    pparser->pregex->nodes[pfirst->end].out1 = psecond->start;
+    pfirst->end = psecond->end;
+}
+
+static int fsearch_frag_repeat(fsearch_parser_t *pparser, fsearch_frag_t *pfrag, char op)
+{
+    fsearch_nfa_node_t *nodes = pparser->pregex->nodes;
+    int end = fsearch_nfa_add(pparser, fsearch_nfa_epsilon, -1, -1, -1);
+    if (end < 0) return -1;
+
+    int split = fsearch_nfa_add(pparser, fsearch_nfa_split, pfrag->start, end, -1);
+    if (split < 0) return -1;
+
+    switch (op)
+    {
+        case '*': /* Loop back to split, enter through split */
+            nodes[pfrag->end].out1 = split;
+            pfrag->start = split;
+            break;
+        case '+': /* Loop back to split, enter through fragment */
+            nodes[pfrag->end].out1 = split;
+            break;
+        case '?': /* Enter through split, no loop */
+            nodes[pfrag->end].out1 = end;
+            pfrag->start = split;
+            break;
+        default:
+            break;
+    }
+
+    pfrag->end = end;
+    return 0;
+}
+
+static int fsearch_frag_copy(fsearch_parser_t *pparser, int first, int count, const fsearch_frag_t *psrc, fsearch_frag_t *pdst)
+{
+    fsearch_regex_t *pregex = pparser->pregex;
+    int i, delta = pregex->node_count - first;
+
+    if (pregex->node_count + count > FSEARCH_NFA_MAX)
+    {
+        pparser->error = "Pattern is too complex";
+        return -1;
+    }
+
+    /* Fragment nodes are contiguous, relocate internal links */
+    for (i = 0; i < count; i++)
+    {
+        fsearch_nfa_node_t node = pregex->nodes[first + i];
+        if (node.out1 >= first && node.out1 < first + count) node.out1 += delta;
+        if (node.out2 >= first && node.out2 < first + count) node.out2 += delta;
+        pregex->nodes[pregex->node_count++] = node;
+    }
+
+    pdst->start = psrc->start + delta;
+    pdst->end = psrc->end + delta;
+
+    /* Source end may be linked already, copy must be dangling */
+    pregex->nodes[pdst->end].out1 = -1;
+    return 0;
+}
+
+static int fsearch_frag_bounded(fsearch_parser_t *pparser, int first, fsearch_frag_t *pfrag, int min, int max)
+{
+    int i, count = pparser->pregex->node_count - first;
+    fsearch_frag_t copy, atom = *pfrag;
+    fsearch_frag_t result = atom;
+
+    if (!min && !max) return fsearch_frag_empty(pparser, pfrag);
+
+    if (!min)
+    {
+        /* First copy is optional, or the whole thing for {0,} */
+        if (fsearch_frag_repeat(pparser, &result, max < 0 ? '*' : '?') < 0) return -1;
+        if (max < 0) { *pfrag = result; return 0; }
+        min = 1;
+    }
+    else
+    {
+        /* Mandatory copies */
+        for (i = 1; i < min; i++)
+        {
+            if (fsearch_frag_copy(pparser, first, count, &atom, &copy) < 0) return -1;
+            fsearch_frag_concat(pparser, &result, &copy);
+        }
+    }
+
+    /* Unbounded tail or optional copies */
+    for (i = min; max < 0 ? i == min : i < max; i++)
+    {
+        if (fsearch_frag_copy(pparser, first, count, &atom, &copy) < 0 ||
+            fsearch_frag_repeat(pparser, &copy, max < 0 ? '*' : '?') < 0) return -1;
+        fsearch_frag_concat(pparser, &result, &copy);
+    }
+
+    *pfrag = result;
+    return 0;
+}
+
+static void fsearch_class_escape(uint8_t *set, char c)
+{
+    int i;
+
+    switch (c)
+    {
+        case 'd': for (i = '0'; i <= '9'; i++) FSEARCH_SET_ADD(set, i); break;
+        case 's': FSEARCH_SET_ADD(set, ' '); for (i = '\t'; i <= '\r'; i++) FSEARCH_SET_ADD(set, i); break;
+        case 'w':
+            for (i = 0; i < 256; i++)
+                if ((i >= 'a' && i <= 'z') || (i >= 'A' && i <= 'Z') ||
+                    (i >= '0' && i <= '9') || i == '_') FSEARCH_SET_ADD(set, i);
+            break;
+        case 't': FSEARCH_SET_ADD(set, '\t'); break;
+        case 'n': FSEARCH_SET_ADD(set, '\n'); break;
+        default: FSEARCH_SET_ADD(set, c); break;
+    }
+}
+
+static int fsearch_class_named(uint8_t *set, const char *name, size_t length)
+{
+    static const char *names[] = { "alpha", "digit", "alnum", "upper", "lower", "space", "punct", "xdigit" };
+    int i, c, index = -1;
+
+    for (i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+        if (strlen(names[i]) == length && !strncmp(names[i], name, length)) index = i;
+
+    for (c = 0; c < 128 && index >= 0; c++)
+    {
+        int upper = c >= 'A' && c <= 'Z', lower = c >= 'a' && c <= 'z', digit = c >= '0' && c <= '9';
+        int space = c == ' ' || (c >= '\t' && c <= '\r');
+        int punct = c > ' ' && c < 127 && !upper && !lower && !digit;
+        int xdigit = digit || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+        int member[] = { upper || lower, digit, upper || lower || digit, upper, lower, space, punct, xdigit };
+        if (member[index]) FSEARCH_SET_ADD(set, c);
+    }
+
+    return index;
+}
+
+static void fsearch_class_invert(uint8_t *set)
+{
+    int i;
+    for (i = 0; i < 32; i++) set[i] = ~set[i];
+}
+
+static int fsearch_parse_class(fsearch_parser_t *pparser, fsearch_frag_t *pfrag)
+{
+    const char *pattern = pparser->pattern;
+    int set = fsearch_set_add(pparser);
+    if (set < 0) return -1;
+
+    uint8_t *bits = pparser->pregex->sets[set];
+    int negate = 0, first = 1, closed = 0;
+
+    if (pparser->pos < pparser->length && pattern[pparser->pos] == '^')
+    {
+        negate = 1;
+        pparser->pos++;
+    }
+
+    while (pparser->pos < pparser->length)
+    {
+        unsigned char c = pattern[pparser->pos++];
+        if (c == ']' && !first) { closed = 1; break; }
+        first = 0;
+
+        /* Named class like [:alpha:] */
+        if (c == '[' && pparser->pos < pparser->length && pattern[pparser->pos] == ':')
+        {
+            const char *name = &pattern[pparser->pos + 1];
+            const char *end = strstr(name, ":]");
+
+            if (end != NULL)
+            {
+                if (fsearch_class_named(bits, name, end - name) < 0)
+                {
+                    pparser->error = "Invalid character class name";
+                    return -1;
+                }
+
+                pparser->pos = (end + 2) - pattern;
+                continue;
+            }
+        }
+
+        /* Equivalence class [=c=] and collating symbol [.c.] stand for one character */
+        if (c == '[' && pparser->pos < pparser->length && (pattern[pparser->pos] == '=' || pattern[pparser->pos] == '.'))
+        {
+            const char terminator[] = { pattern[pparser->pos], ']', '\0' };
+            const char *name = &pattern[pparser->pos + 1];
+            const char *end = strstr(name, terminator);
+
+            if (end != NULL)
+            {
+                if (end - name != 1)
+                {
+                    pparser->error = "Invalid collating element";
+                    return -1;
+                }
+
+                FSEARCH_SET_ADD(bits, (unsigned char)*name);
+                pparser->pos = (end + 2) - pattern;
+                continue;
+            }
+        }
+
+        if (c == '\\' && pparser->pos < pparser->length)
+        {
+            c = pattern[pparser->pos++];
+            if (strchr("dswtn", c) != NULL)
+            {
+                fsearch_class_escape(bits, c);
+                continue;
+            }
+        }
+
+        /* Range like a-z, trailing '-' is literal */
+        if (pparser->pos + 1 < pparser->length &&
+            pattern[pparser->pos] == '-' &&
+            pattern[pparser->pos + 1] != ']')
+        {
+            unsigned char last = pattern[pparser->pos + 1];
+            pparser->pos += 2;
+
+            if (last == '\\' && pparser->pos < pparser->length) last = pattern[pparser->pos++];
+            if (last < c)
+            {
+                pparser->error = "Invalid range in bracket expression";
+                return -1;
+            }
+
+            int i;
+            for (i = c; i <= last; i++) FSEARCH_SET_ADD(bits, i);
+            continue;
+        }
+
+        FSEARCH_SET_ADD(bits, c);
+    }
+
+    if (!closed)
+    {
+        pparser->error = "Unterminated bracket expression";
+        return -1;
+    }
+
+    if (negate) fsearch_class_invert(bits);
+    return fsearch_frag_node(pparser, fsearch_nfa_class, set, pfrag);
+}
+
+static int fsearch_parse_char(fsearch_parser_t *pparser, unsigned char c, int escaped, fsearch_frag_t *pfrag)
+{
+    int set = fsearch_set_add(pparser);
+    if (set < 0) return -1;
+
+    uint8_t *bits = pparser->pregex->sets[set];
+
+    if (escaped && strchr("dDsSwW", c) != NULL)
+    {
+        fsearch_class_escape(bits, (char)(c | 0x20));
+        if (c >= 'A' && c <= 'Z') fsearch_class_invert(bits);
+    }
+    else if (escaped && (c == 't' || c == 'n'))
+    {
+        fsearch_class_escape(bits, c);
+        pparser->atom_char = c == 't' ? '\t' : '\n';
+    }
+    else
+    {
+        FSEARCH_SET_ADD(bits, c);
+        pparser->atom_char = c;
+    }
+
+    return fsearch_frag_node(pparser, fsearch_nfa_class, set, pfrag);
+}
+
+static int fsearch_parse_atom(fsearch_parser_t *pparser, fsearch_frag_t *pfrag)
+{
+    const char *pattern = pparser->pattern;
+    unsigned char c = pattern[pparser->pos++];
+    pparser->atom_char = -1;
+
+    switch (c)
+    {
+        case '(':
+        {
+            /* Groups don't capture, accept (?:...) as well */
+            if (pparser->pos + 1 < pparser->length &&
+                pattern[pparser->pos] == '?' &&
+                pattern[pparser->pos + 1] == ':') pparser->pos += 2;
+
+            pparser->depth++;
+            if (fsearch_parse_alt(pparser, pfrag) < 0) return -1;
+            pparser->depth--;
+            pparser->atom_char = -1;
+
+            if (pparser->pos >= pparser->length || pattern[pparser->pos] != ')')
+            {
+                pparser->error = "Missing ')'";
+                return -1;
+            }
+
+            pparser->pos++;
+            return 0;
+        }
+        case '[':
+            return fsearch_parse_class(pparser, pfrag);
+        case '.':
+        {
+            int set = fsearch_set_add(pparser);
+            if (set < 0) return -1;
+
+            memset(pparser->pregex->sets[set], 0xFF, sizeof(pparser->pregex->sets[0]));
+            return fsearch_frag_node(pparser, fsearch_nfa_class, set, pfrag);
+        }
+        case '^':
+            return fsearch_frag_node(pparser, fsearch_nfa_bol, -1, pfrag);
+        case '$':
+            return fsearch_frag_node(pparser, fsearch_nfa_eol, -1, pfrag);
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            pparser->error = "Repetition operator without operand";
+            return -1;
+        case '\\':
+            if (pparser->pos >= pparser->length)
+            {
+                pparser->error = "Trailing backslash";
+                return -1;
+            }
+
+            return fsearch_parse_char(pparser, pattern[pparser->pos++], 1, pfrag);
+        default:
+            break;
+    }
+
+    return fsearch_parse_char(pparser, c, 0, pfrag);
+}
+
+static int fsearch_parse_bound(fsearch_parser_t *pparser, int *pmin, int *pmax)
+{
+    const char *pattern = pparser->pattern;
+    char *end = NULL;
+
+    long min = strtol(&pattern[pparser->pos], &end, 10);
+    if (end == &pattern[pparser->pos]) goto invalid;
+
+    long max = min;
+    pparser->pos = end - pattern;
+
+    if (pattern[pparser->pos] == ',')
+    {
+        pparser->pos++;
+        if (pattern[pparser->pos] == '}') max = -1;
+        else
+        {
+            max = strtol(&pattern[pparser->pos], &end, 10);
+            if (end == &pattern[pparser->pos]) goto invalid;
+            pparser->pos = end - pattern;
+        }
+    }
+
+    if (pattern[pparser->pos] != '}') goto invalid;
+    pparser->pos++;
+
+    if (min < 0 || min > FSEARCH_REPEAT_MAX || max > FSEARCH_REPEAT_MAX || (max >= 0 && max < min))
+        goto invalid;
+
+    *pmin = (int)min;
+    *pmax = (int)max;
+    return 0;
+
+invalid:
+    pparser->error = "Invalid repetition bound";
+    return -1;
+}
+
+static void fsearch_literal_commit(fsearch_parser_t *pparser)
+{
+    fsearch_regex_t *pregex = pparser->pregex;
+
+    if (pparser->run_len > pregex->literal_len)
+    {
+        memcpy(pregex->literal, pparser->run, pparser->run_len);
+        pregex->literal_len = pparser->run_len;
+    }
+
+    pparser->run_len = 0;
+}
+
+static int fsearch_parse_concat(fsearch_parser_t *pparser, fsearch_frag_t *pfrag)
+{
+    const char *pattern = pparser->pattern;
+    if (fsearch_frag_empty(pparser, pfrag) < 0) return -1;
+
+    while (pparser->pos < pparser->length &&
+           pattern[pparser->pos] != '|' &&
+           pattern[pparser->pos] != ')')
+    {
+        int first = pparser->pregex->node_count;
+        fsearch_frag_t atom;
+
+        if (fsearch_parse_atom(pparser, &atom) < 0) return -1;
+        int required = 1, ends_run = 0;
+
+        while (pparser->pos < pparser->length)
+        {
+            char op = pattern[pparser->pos];
+            int min = 0, max = -1;
+
+            if (op == '{')
+            {
+                pparser->pos++;
+                if (fsearch_parse_bound(pparser, &min, &max) < 0 ||
+                    fsearch_frag_bounded(pparser, first, &atom, min, max) < 0) return -1;
+            }
+            else if (op == '*' || op == '+' || op == '?')
+            {
+                pparser->pos++;
+                min = op == '+' ? 1 : 0;
+                if (fsearch_frag_repeat(pparser, &atom, op) < 0) return -1;
+            }
+            else break;
+
+            /* Repeated atom is required at least once only if min > 0 */
+            if (!min) required = 0;
+            ends_run = 1;
+        }
+
+        /* Track longest run of plain bytes required at top level */
+        if (!pparser->depth)
+        {
+            if (pparser->atom_char < 0 || !required) fsearch_literal_commit(pparser);
+            else if (pparser->run_len < sizeof(pparser->run))
+            {
+                pparser->run[pparser->run_len++] = (char)pparser->atom_char;
+                if (ends_run) fsearch_literal_commit(pparser);
+            }
+        }
+
+        fsearch_frag_concat(pparser, pfrag, &atom);
+    }
+
+    if (!pparser->depth) fsearch_literal_commit(pparser);
+    return 0;
+}
+
+static int fsearch_parse_alt(fsearch_parser_t *pparser, fsearch_frag_t *pfrag)
+{
+    if (fsearch_parse_concat(pparser, pfrag) < 0) return -1;
+
+    while (pparser->pos < pparser->length && pparser->pattern[pparser->pos] == '|')
+    {
+        fsearch_frag_t other;
+        pparser->pos++;
+
+        /* Literal of one branch is not required by the others */
+        if (!pparser->depth) pparser->alternation = 1;
+        if (fsearch_parse_concat(pparser, &other) < 0) return -1;
+
+        int end = fsearch_nfa_add(pparser, fsearch_nfa_epsilon, -1, -1, -1);
+        if (end < 0) return -1;
+
+        int split = fsearch_nfa_add(pparser, fsearch_nfa_split, pfrag->start, other.start, -1);
+        if (split < 0) return -1;
+
+        pparser->pregex->nodes[pfrag->end].out1 = end;
+        pparser->pregex->nodes[other.end].out1 = end;
+        pfrag->start = split;
+        pfrag->end = end;
+    }
+
+    return 0;
+}
+
+/* Leading ']' of a class (after negation) is a member, not its end,
+   neither is ']' of [:name:], [=c=] or [.c.] inside of the class */
+static const char* fsearch_glob_class_end(const char *glob, size_t start)
+{
+    size_t i = start + 1;
+    if (glob[i] == '!' || glob[i] == '^') i++;
+    if (glob[i] == ']') i++;
+
+    for (; glob[i] != '\0'; i++)
+    {
+        if (glob[i] == '[' && glob[i + 1] != '\0' && strchr(":=.", glob[i + 1]) != NULL)
+        {
+            const char terminator[] = { glob[i + 1], ']', '\0' };
+            const char *end = strstr(&glob[i + 2], terminator);
+
+            if (end != NULL)
+            {
+                i = (end + 1) - glob;
+                continue;
+            }
+        }
+
+        if (glob[i] == ']') return &glob[i];
+    }
+
+    return NULL;
+}
+
+static char* fsearch_glob_to_regex(const char *glob)
+{
+    size_t i, pos = 0, length = strlen(glob);
+    const char *end;
+
+    /* Worst case every byte expands to "[^/]*" */
+    char *regex = (char*)malloc(length * 5 + 3);
+    if (regex == NULL) return NULL;
+
+    regex[pos++] = '^';
+
+    for (i = 0; i < length; i++)
+    {
+        char c = glob[i];
+
+        if (c == '*')
+        {
+            /* '**' crosses directory boundaries */
+            if (glob[i + 1] == '*') { memcpy(&regex[pos], ".*", 2); pos += 2; i++; }
+            else { memcpy(&regex[pos], "[^/]*", 5); pos += 5; }
+        }
+        else if (c == '?')
+        {
+            memcpy(&regex[pos], "[^/]", 4);
+            pos += 4;
+        }
+        else if (c == '[' && (end = fsearch_glob_class_end(glob, i)) != NULL)
+        {
+            regex[pos++] = '[';
+            i++;
+
+            if (glob[i] == '!' || glob[i] == '^') { regex[pos++] = '^'; i++; }
+            if (glob[i] == ']') regex[pos++] = glob[i++];
+
+            while (&glob[i] < end)
+            {
+                if (glob[i] == '\\') regex[pos++] = '\\';
+                regex[pos++] = glob[i++];
+            }
+
+            regex[pos++] = ']';
+        }
+        else if (c == '\\' && glob[i + 1] != '\0')
+        {
+            regex[pos++] = '\\';
+            regex[pos++] = glob[++i];
+        }
+        else
+        {
+            if (strchr(".+()|{}^$\\[]", c) != NULL) regex[pos++] = '\\';
+            regex[pos++] = c;
+        }
+    }
+
+    regex[pos++] = '$';
+    regex[pos] = '\0';
+    return regex;
+}
+
+static void fsearch_closure(fsearch_regex_t *pregex, int node, int at_start, int at_end, int *set, int *count)
+{
+    int top = 0;
+    pregex->stack[top++] = node;
+
+    while (top)
+    {
+        int n = pregex->stack[--top];
+        if (n < 0 || pregex->mark[n] == pregex->generation) continue;
+
+        fsearch_nfa_node_t *pnode = &pregex->nodes[n];
+        pregex->mark[n] = pregex->generation;
+
+        switch (pnode->type)
+        {
+            case fsearch_nfa_class:
+            case fsearch_nfa_match:
+                set[(*count)++] = n;
+                break;
+            case fsearch_nfa_eol:
+                /* Keep assertion in the set until input ends */
+                if (at_end) pregex->stack[top++] = pnode->out1;
+                else set[(*count)++] = n;
+                break;
+            case fsearch_nfa_bol:
+                if (at_start) pregex->stack[top++] = pnode->out1;
+                break;
+            case fsearch_nfa_split:
+                pregex->stack[top++] = pnode->out2;
+                pregex->stack[top++] = pnode->out1;
+                break;
+            case fsearch_nfa_epsilon:
+                pregex->stack[top++] = pnode->out1;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static int fsearch_set_accepts(fsearch_regex_t *pregex, const int *set, int count, int at_start, int at_end)
+{
+    int *closure = pregex->scratch[1];
+    int i, size = 0;
+
+    pregex->generation++;
+    for (i = 0; i < count; i++)
+    {
+        fsearch_nfa_node_t *pnode = &pregex->nodes[set[i]];
+        if (pnode->type == fsearch_nfa_match) return 1;
+        if (at_end && pnode->type == fsearch_nfa_eol) fsearch_closure(pregex, set[i], at_start, 1, closure, &size);
+    }
+
+    for (i = 0; i < size; i++)
+        if (pregex->nodes[closure[i]].type == fsearch_nfa_match) return 1;
+
+    return 0;
+}
+
+static void fsearch_set_sort(int *set, int count)
+{
+    int i, j;
+
+    for (i = 1; i < count; i++)
+    {
+        int value = set[i];
+        for (j = i; j > 0 && set[j - 1] > value; j--) set[j] = set[j - 1];
+        set[j] = value;
+    }
+}
+
+static int fsearch_set_step(fsearch_regex_t *pregex, const int *set, int count, unsigned char c, int *next)
+{
+    int i, size = 0;
+    pregex->generation++;
+
+    for (i = 0; i < count; i++)
+    {
+        fsearch_nfa_node_t *pnode = &pregex->nodes[set[i]];
+        if (pnode->type == fsearch_nfa_class && FSEARCH_SET_HAS(pregex->sets[pnode->set], c))
+            fsearch_closure(pregex, pnode->out1, 0, 0, next, &size);
+    }
+
+    /* Unanchored search may start a match at any position */
+    fsearch_closure(pregex, pregex->start, 0, 0, next, &size);
+    fsearch_set_sort(next, size);
+    return size;
+}
+
+static uint32_t fsearch_set_hash(const int *set, int count)
+{
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        hash ^= (uint32_t)set[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static int fsearch_state_get(fsearch_regex_t *pregex, const int *set, int count, int at_start)
+{
+    uint32_t hash = fsearch_set_hash(set, count);
+    uint32_t bucket = hash % FSEARCH_DFA_BUCKETS;
+
+    while (pregex->buckets[bucket] >= 0)
+    {
+        fsearch_dfa_state_t *pstate = pregex->states[pregex->buckets[bucket]];
+        if (pstate->hash == hash && pstate->count == count &&
+            !memcmp(pstate->nodes, set, count * sizeof(int)))
+                return pregex->buckets[bucket];
+
+        bucket = (bucket + 1) % FSEARCH_DFA_BUCKETS;
+    }
+
+    /* State cache is full, caller falls back to NFA simulation */
+    if (pregex->state_count >= FSEARCH_DFA_MAX) return -1;
+
+    fsearch_dfa_state_t *pstate = (fsearch_dfa_state_t*)malloc(sizeof(fsearch_dfa_state_t));
+    if (pstate == NULL) return -1;
+
+    pstate->nodes = (int*)malloc((count ? count : 1) * sizeof(int));
+    if (pstate->nodes == NULL)
+    {
+        free(pstate);
+        return -1;
+    }
+
+    memcpy(pstate->nodes, set, count * sizeof(int));
+    memset(pstate->next, 0xFF, sizeof(pstate->next));
+    pstate->count = count;
+    pstate->hash = hash;
+    pstate->is_match = fsearch_set_accepts(pregex, set, count, at_start, 0);
+    pstate->eol_match = fsearch_set_accepts(pregex, set, count, at_start, 1);
+
+    int index = pregex->state_count;
+    pregex->buckets[bucket] = index;
+
+    /* Publish state before any transition can point to it */
+    __atomic_store_n(&pregex->states[index], pstate, __ATOMIC_RELEASE);
+    __atomic_store_n(&pregex->state_count, index + 1, __ATOMIC_RELEASE);
+    return index;
+}
+
+static int fsearch_regex_simulate(fsearch_regex_t *pregex, const fsearch_dfa_state_t *pstate,
+    const unsigned char *data, size_t length)
+{
+    int *current = pregex->scratch[0];
+    int *next = (int*)malloc(pregex->node_count * sizeof(int));
+    int count = pstate->count;
+    size_t i;
+
+    if (next == NULL) return 0;
+    memcpy(current, pstate->nodes, count * sizeof(int));
+
+    for (i = 0; i < length; i++)
+    {
+        count = fsearch_set_step(pregex, current, count, data[i], next);
+        memcpy(current, next, count * sizeof(int));
+        if (fsearch_set_accepts(pregex, current, count, 0, 0)) break;
+    }
+
+    int matched = fsearch_set_accepts(pregex, current, count, 0, i >= length);
+    free(next);
+    return matched;
+}
+
+static int fsearch_regex_transition(fsearch_regex_t *pregex, fsearch_dfa_state_t *pstate, unsigned char c)
+{
+    pthread_mutex_lock(&pregex->lock);
+
+    /* Another thread may have built it in the meantime */
+    int next = pstate->next[c];
+
+    if (next < 0)
+    {
+        int count = fsearch_set_step(pregex, pstate->nodes, pstate->count, c, pregex->scratch[0]);
+        next = fsearch_state_get(pregex, pregex->scratch[0], count, 0);
+        if (next >= 0) __atomic_store_n(&pstate->next[c], next, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&pregex->lock);
+    return next;
+}
+
+int fsearch_regex_match(fsearch_regex_t *pregex, const char *data, size_t length)
+{
+    /* Cheap rejection of names without the required literal */
+    if (pregex->literal_len == 1 && memchr(data, pregex->literal[0], length) == NULL) return 0;
+    if (pregex->literal_len > 1 && memmem(data, length, pregex->literal, pregex->literal_len) == NULL) return 0;
+
+    const unsigned char *input = (const unsigned char*)data;
+    fsearch_dfa_state_t *pstate = pregex->states[0];
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        if (pstate->is_match) return 1;
+        if (!pstate->count) return 0; // Dead state
+
+        int next = __atomic_load_n(&pstate->next[input[i]], __ATOMIC_ACQUIRE);
+        if (next < 0) next = fsearch_regex_transition(pregex, pstate, input[i]);
+
+        if (next < 0)
+        {
+            /* Cache is full, finish the rest without caching */
+            pthread_mutex_lock(&pregex->lock);
+            int matched = fsearch_regex_simulate(pregex, pstate, &input[i], length - i);
+            pthread_mutex_unlock(&pregex->lock);
+            return matched;
+        }
+
+        pstate = __atomic_load_n(&pregex->states[next], __ATOMIC_ACQUIRE);
+    }
+
+    return pstate->is_match || pstate->eol_match;
+}
+
+void fsearch_regex_free(fsearch_regex_t *pregex)
+{
+    if (pregex == NULL) return;
+    int i;
+
+    for (i = 0; i < pregex->state_count; i++)
+    {
+        free(pregex->states[i]->nodes);
+        free(pregex->states[i]);
+    }
+
+    pthread_mutex_destroy(&pregex->lock);
+    free(pregex->scratch[0]);
+    free(pregex->scratch[1]);
+    free(pregex->buckets);
+    free(pregex->states);
+    free(pregex->stack);
+    free(pregex->nodes);
+    free(pregex->sets);
+    free(pregex->mark);
+    free(pregex);
+}
+
+fsearch_regex_t* fsearch_regex_compile(const char *pattern, int is_glob, char *error, size_t size)
+{
+    fsearch_regex_t *pregex = (fsearch_regex_t*)calloc(1, sizeof(fsearch_regex_t));
+    char *source = is_glob ? fsearch_glob_to_regex(pattern) : strdup(pattern);
+
+    if (pregex == NULL || source == NULL ||
+        (pregex->nodes = (fsearch_nfa_node_t*)malloc(FSEARCH_NFA_MAX * sizeof(fsearch_nfa_node_t))) == NULL)
+    {
+        snprintf(error, size, "Out of memory");
+        free(pregex);
+        free(source);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pregex->lock, NULL);
+
+    fsearch_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.pregex = pregex;
+    parser.pattern = source;
+    parser.length = strlen(source);
+
+    fsearch_frag_t frag;
+    int status = fsearch_parse_alt(&parser, &frag);
+
+    if (status == 0 && parser.pos < parser.length)
+    {
+        parser.error = "Unmatched ')'";
+        status = -1;
+    }
+
+    int match = status < 0 ? -1 : fsearch_nfa_add(&parser, fsearch_nfa_match, -1, -1, -1);
+    free(source);
+
+    if (match < 0)
+    {
+        snprintf(error, size, "%s", parser.error ? parser.error : "Invalid pattern");
+        fsearch_regex_free(pregex);
+        return NULL;
+    }
+
+    pregex->nodes[frag.end].out1 = match;
+    pregex->start = frag.start;
+    if (parser.alternation) pregex->literal_len = 0;
+
+    int count = pregex->node_count;
+    pregex->states = (fsearch_dfa_state_t**)calloc(FSEARCH_DFA_MAX, sizeof(fsearch_dfa_state_t*));
+    pregex->buckets = (int*)malloc(FSEARCH_DFA_BUCKETS * sizeof(int));
+    pregex->scratch[0] = (int*)malloc(count * sizeof(int));
+    pregex->scratch[1] = (int*)malloc(count * sizeof(int));
+    pregex->stack = (int*)malloc((count * 2 + 2) * sizeof(int));
+    pregex->mark = (int*)calloc(count, sizeof(int));
+
+    if (pregex->states == NULL || pregex->buckets == NULL ||
+        pregex->scratch[0] == NULL || pregex->scratch[1] == NULL ||
+        pregex->stack == NULL || pregex->mark == NULL)
+    {
+        snprintf(error, size, "Out of memory");
+        fsearch_regex_free(pregex);
+        return NULL;
+    }
+
+    memset(pregex->buckets, 0xFF, FSEARCH_DFA_BUCKETS * sizeof(int));
+
+    /* Build start state, it always has index zero */
+    int size_start = 0;
+    pregex->generation++;
+    fsearch_closure(pregex, pregex->start, 1, 0, pregex->scratch[0], &size_start);
+    fsearch_set_sort(pregex->scratch[0], size_start);
+
+    if (fsearch_state_get(pregex, pregex->scratch[0], size_start, 1) != 0)
+    {
+        snprintf(error, size, "Out of memory");
+        fsearch_regex_free(pregex);
+        return NULL;
+    }
+
+    return pregex;
+}
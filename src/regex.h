@@ -0,0 +1,22 @@
+/*
+ *  src/regex.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * Glob and regular expression matching using
+ * lazily built DFA with literal prefiltering
+ */
+
+#ifndef __FSEARCH_REGEX_H__
+#define __FSEARCH_REGEX_H__
+
+#include <stddef.h>
+
+typedef struct fsearch_regex_ fsearch_regex_t;
+
+fsearch_regex_t* fsearch_regex_compile(const char *pattern, int is_glob, char *error, size_t size);
+int fsearch_regex_match(fsearch_regex_t *pregex, const char *data, size_t length);
+void fsearch_regex_free(fsearch_regex_t *pregex);
+
+#endif /* __FSEARCH_REGEX_H__ */
@@ -11,94 +11,58 @@
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
-#include <dirent.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
-#include <ctype.h>
 #include <time.h>
-#include <grp.h>
-#include <pwd.h>
+#include <pthread.h>
 
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include "search.h"
-
-#define FSEARCH_CHECK_FL(types, flag) (((types) & (flag)) == (flag))
-#define FSEARCH_FULL_PATH_LEN   (PATH_MAX + NAME_MAX + 1) // +1 for slash
-
-#define FSEARCH_STR_BOLD        "\033[1m"
-#define FSEARCH_STR_RESET       "\033[0m"
+#include "dir.h"
+#include "content.h"
+
+#define FSEARCH_DAY_SECONDS     86400
+#define FSEARCH_DAY_CACHE       64
+#define FSEARCH_PATH_MIN        4096    // Initial path buffer of a walk
+#define FSEARCH_FRAMES_MIN      64      // Initial directory stack depth
+
+/* Directory being scanned, its entries are processed up to next sub directory */
+typedef struct fsearch_frame_ {
+    fsearch_dir_t dir;
+    fsearch_level_t level;          // Traversal state of entries
+    fsearch_ignore_t *ignore;       // Rules loaded in this directory
+    fsearch_du_dir_t *usage;        // Totals of --du
+    fsearch_timer_t timer;
+    size_t length;                  // Path length of directory
+    int report;                     // Entries are deep enough to report
+    int recursive;                  // Sub directories are entered
+} fsearch_frame_t;
+
+typedef struct fsearch_day_ {
+    time_t start;                   // Local midnight
+    time_t end;                     // Next local midnight
+    char prefix[8];                 // Month and day (e.g. 'Mar  9 ')
+} fsearch_day_t;
+
+/* Recently formatted days, per thread so no locking is needed */
+static __thread fsearch_day_t g_days[FSEARCH_DAY_CACHE];
+
+static const char *g_months[12] = { 
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
 
 void fsearch_log_error(fsearch_cfg_t *pcfg, const char *path)
 {
+    fsearch_stats_error(pcfg->stats, errno);
     fprintf(stderr, "%s: '%s': %s\n", 
         pcfg->exec_name, path, strerror(errno));
 }
 
-static int fsearch_check_name(fsearch_cfg_t *pcfg, const char *entry)
-{
-    size_t name_len = strlen(pcfg->file_name);
-    if (!name_len) return 1;
-
-    /* Copy file name otherwise strtok will damage variable */
-    char file_name[name_len + 1];
-    strcpy(file_name, pcfg->file_name);
-
-    size_t i, entry_len = strlen(entry);
-    char entry_name[entry_len + 1];
-
-    /* Make file name lowercase to support case sensitivity */
-    for (i = 0; i < entry_len; i++) entry_name[i] = tolower(entry[i]);
-
-    entry_name[entry_len] = '\0';
-    char *saveptr = NULL;
-
-    /* There is no regex operator in search criteria */
-    if (!pcfg->use_regex) return !strcmp(pcfg->file_name, entry_name);
-
-    char *token = strtok_r(file_name, "+", &saveptr);
-    if (token == NULL) return 0;
-
-    char *offset = strstr(entry_name, token);
-    if (offset == NULL) return 0; /* Token not found */
-
-    while (token != NULL)
-    {
-        /* Compare first token and file name offset */
-        size_t token_len = strlen(token);
-        if (strncmp(offset, token, token_len)) return 0;
-
-        /* Move offset after first token */
-        offset += token_len - 1;
-        char skip_char = *offset;
-        i = 0;
-
-        /* Skip last characer of first token */
-        while (offset[i] == skip_char) i++;
-        offset += i;
-        
-        /* Get next token */
-        token = strtok_r(NULL, "+", &saveptr);
-    }
-
-    /* All possible occurrences passed */
-    return 1;
-}
-
-static int fsearch_check_size(fsearch_cfg_t *pcfg, size_t size)
-{
-    if (pcfg->file_size < 0) return 1;
-    return pcfg->file_size == size ? 1 : 0;
-}
-
-static int fsearch_check_links(fsearch_cfg_t *pcfg, nlink_t links)
-{
-    if (pcfg->link_count < 0) return 1;
-    return pcfg->link_count == links ? 1 : 0;
-}
-
 static char fsearch_get_type(fsearch_cfg_t *pcfg, mode_t mode)
 {
     switch (mode & S_IFMT)
@@ -116,82 +80,6 @@ static char fsearch_get_type(fsearch_cfg_t *pcfg, mode_t mode)
     return 'u'; // Unknown file format
 }
 
-static int fsearch_check_type(fsearch_cfg_t *pcfg, mode_t mode)
-{
-    if (!pcfg->file_types) return 1;
-    char type = fsearch_get_type(pcfg, mode);
-
-    switch (type)
-    {
-        case 'b':
-            if (FSEARCH_CHECK_FL(pcfg->file_types, fsearch_block_device)) return 1; 
-            break;
-        case 'c':
-            if (FSEARCH_CHECK_FL(pcfg->file_types, fsearch_char_device)) return 1;  
-            break;
-        case 'd':
-            if (FSEARCH_CHECK_FL(pcfg->file_types, fsearch_directory)) return 1;  
-            break;
-        case 'p':
-            if (FSEARCH_CHECK_FL(pcfg->file_types, fsearch_pipe)) return 1;  
-            break;
-        case 'l':
-            if (FSEARCH_CHECK_FL(pcfg->file_types, fsearch_symlink)) return 1;  
-            break;
-        case 'f':
-            if (FSEARCH_CHECK_FL(pcfg->file_types, fsearch_regular_file)) return 1;  
-            break;
-        case 's':
-            if (FSEARCH_CHECK_FL(pcfg->file_types, fsearch_socket)) return 1;  
-            break;
-        default: break;
-    }
-
-    return 0; // Unknown file format
-}
-
-static size_t fsearch_get_depth(fsearch_cfg_t *pcfg, const char *path)
-{
-    char *saveptr_found, *saveptr_last;
-    char found[FSEARCH_FULL_PATH_LEN];
-    char last[FSEARCH_FULL_PATH_LEN];
-    size_t depth = 0; 
-
-    strcpy(last, pcfg->last_directory);
-    strcpy(found, path);
-
-    char *foundptr = strtok_r(found, "/", &saveptr_found);
-    char *lastptr = strtok_r(last, "/", &saveptr_last);
-
-    while (foundptr != NULL && lastptr != NULL)
-    {
-        if (strcmp(foundptr, lastptr)) return depth;
-        depth += pcfg->indentation;
-
-        foundptr = strtok_r(NULL, "/", &saveptr_found);
-        lastptr = strtok_r(NULL, "/", &saveptr_last);  
-    }
-
-    return depth;
-}
-
-static int fsearch_get_chmod(char *output, size_t size, mode_t mode)
-{
-    int owner = (mode & S_IRUSR) ? 4 : 0;
-    owner += (mode & S_IWUSR) ? 2 : 0;
-    owner += (mode & S_IXUSR) ? 1 : 0;
-
-    int group = (mode & S_IRGRP) ? 4 : 0;
-    group += (mode & S_IWGRP) ? 2 : 0;
-    group += (mode & S_IXGRP) ? 1 : 0;
-
-    int others = (mode & S_IROTH) ? 4 : 0;
-    others += (mode & S_IWOTH) ? 2 : 0;
-    others += (mode & S_IXOTH) ? 1 : 0;
-
-    return snprintf(output, size, "%d%d%d", owner, group, others);
-}
-
 static int fsearch_get_chmodstr(char *output, size_t size, mode_t mode)
 {
     if (size < FSEARCH_PERM_LEN + 1) return 0;
@@ -212,13 +100,63 @@ static int fsearch_get_chmodstr(char *output, size_t size, mode_t mode)
     return FSEARCH_PERM_LEN;
 }
 
-static int fsearch_check_permissions(fsearch_cfg_t *pcfg, mode_t mode)
+static void fsearch_get_time(time_t time, char *output)
 {
-    if (!pcfg->permissions) return 1;
-    char buff[FSEARCH_PERM_LEN + 1];
+    fsearch_day_t *pday = &g_days[(unsigned long)(time / FSEARCH_DAY_SECONDS) % FSEARCH_DAY_CACHE];
+    fsearch_day_t day;
 
-    fsearch_get_chmod(buff, sizeof(buff), mode);
-    return (atoi(buff) == pcfg->permissions) ? 1 : 0;
+    if (time < pday->start || time >= pday->end)
+    {
+        struct tm tm, edge;
+        localtime_r(&time, &tm);
+
+        day.start = time - (tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec);
+        day.end = day.start + FSEARCH_DAY_SECONDS;
+        snprintf(day.prefix, sizeof(day.prefix), "%s%3d ", g_months[tm.tm_mon % 12], tm.tm_mday);
+
+        /* Cache only days without UTC offset change (DST) */
+        time_t last = day.end - 1;
+        localtime_r(&day.start, &edge);
+        int cacheable = edge.tm_gmtoff == tm.tm_gmtoff;
+        localtime_r(&last, &edge);
+        cacheable = cacheable && edge.tm_gmtoff == tm.tm_gmtoff;
+
+        if (cacheable) *pday = day;
+        else
+        {
+            snprintf(output, FSEARCH_TIME_LEN + 1, "%s%02d:%02d", day.prefix, tm.tm_hour, tm.tm_min);
+            return;
+        }
+    }
+
+    /* Only hours and minutes are left to format */
+    int seconds = (int)(time - pday->start);
+    int hour = seconds / 3600, min = (seconds % 3600) / 60;
+
+    memcpy(output, pday->prefix, 7);
+    output[7] = '0' + hour / 10;
+    output[8] = '0' + hour % 10;
+    output[9] = ':';
+    output[10] = '0' + min / 10;
+    output[11] = '0' + min % 10;
+    output[FSEARCH_TIME_LEN] = '\0';
+}
+
+static void fsearch_get_size(off_t size, char *output)
+{
+    unsigned long long value = size > 0 ? (unsigned long long)size : 0;
+    char digits[24];
+    int i, count = 0;
+
+    do digits[count++] = '0' + value % 10;
+    while ((value /= 10) != 0);
+
+    /* Right aligned within the field, wider values are not cut */
+    int pad = count < FSEARCH_SIZE_LEN ? FSEARCH_SIZE_LEN - count : 0;
+    memset(output, ' ', pad);
+
+    for (i = 0; i < count; i++) output[pad + i] = digits[count - i - 1];
+    output[pad + count] = '\0';
 }
 
 static int fsearch_get_info(fsearch_cfg_t *pcfg, struct stat *pstat, char *output, size_t size)
@@ -234,167 +172,439 @@ static int fsearch_get_info(fsearch_cfg_t *pcfg, struct stat *pstat, char *outpu
     fsearch_get_chmodstr(chmod, sizeof(chmod), pstat->st_mode);
     char type = fsearch_get_type(pcfg, pstat->st_mode);
 
-    /* Get username from uid */
-    struct passwd *pws = getpwuid(pstat->st_uid);
-    const char *uname = pws ? pws->pw_name : "";
-
-    /* Get group name from gid */
-    struct group *grp = getgrgid(pstat->st_gid);
-    const char *gname = grp ? grp->gr_name : "";
+    /* Get user and group names from cache */
+    char uname[FSEARCH_NAME_LEN], gname[FSEARCH_NAME_LEN];
+    fsearch_names_user(pcfg->names, pstat->st_uid, uname, sizeof(uname));
+    fsearch_names_group(pcfg->names, pstat->st_gid, gname, sizeof(gname));
 
-    /* Get last access time */
+    /* Get last access time (e.g. 'Mar  9 03:20') */
     char stime[FSEARCH_TIME_LEN + 1];
-    const char *ptime = ctime(&pstat->st_atime);
-
-    /* Get only day and time from full date */
-    strncpy(stime, &ptime[4], FSEARCH_TIME_LEN);
-    stime[FSEARCH_TIME_LEN] = '\0';
+    fsearch_get_time(pstat->st_atime, stime);
 
     /* Create size string with indentation */
-    char sizebuf[FSEARCH_SIZE_LEN + 1];
-    snprintf(sizebuf, sizeof(sizebuf), "%.10ld", pstat->st_size);
-    size_t i;
-
-    /* Fill zero indentations with spaces */
-    for (i = 0; i < FSEARCH_SIZE_LEN; i++)
-    {
-        if (sizebuf[i] != '0') break;
-        else if (i != FSEARCH_SIZE_LEN - 1) sizebuf[i] = ' ';
-    }
-
-    sizebuf[FSEARCH_SIZE_LEN] = '\0';
+    char sizebuf[24];
+    fsearch_get_size(pstat->st_size, sizebuf);
     type = type == 'f' ? '-' : type;
 
     return snprintf(output, size, "%c%s  %lu  %s  %s  %s [%s] ",
-        type, chmod, pstat->st_nlink, uname, gname, sizebuf, stime);
+        type, chmod, (unsigned long)pstat->st_nlink, uname, gname, sizebuf, stime);
 }
 
 static void fsearch_printf(fsearch_cfg_t *pcfg, const char *pFmt, ...)
 {
     va_list args;
-    char line[LINE_MAX];
 
+    /* Format straight into output buffer, it is flushed in large chunks */
     va_start(args, pFmt);
-    vsnprintf(line, sizeof(line), pFmt, args);
+    fsearch_output_vline(&pcfg->writer, LINE_MAX, pFmt, args);
     va_end(args);
+}
 
-    if (pcfg->output[0] != '\0')
+int fsearch_search_stopped(fsearch_cfg_t *pcfg)
+{
+    return __sync_add_and_fetch(pcfg->interrupted, 0) ||
+        __sync_add_and_fetch(&pcfg->stopped, 0);
+}
+
+void fsearch_report_match(fsearch_cfg_t *pcfg, struct stat *pstat, const char *path, size_t dir_len)
+{
+    pthread_mutex_lock(&pcfg->lock);
+
+    /* Other threads may find more before they see the limit */
+    if (pcfg->max_results && pcfg->result_count >= pcfg->max_results)
     {
-        FILE *fp = fopen(pcfg->output, "a");
-        if (fp != NULL)
+        pthread_mutex_unlock(&pcfg->lock);
+        return;
+    }
+
+    if (pcfg->callback != NULL)
+    {
+        /* Path and stat are borrowed, non zero return stops the search */
+        if (pcfg->callback(pcfg->ctx, path, dir_len, pstat)) __sync_lock_test_and_set(&pcfg->stopped, 1);
+    }
+    else if (pcfg->quiet)
+    {
+        /* Only exit status is needed */
+    }
+    else if (pcfg->format != FSEARCH_FORMAT_TEXT)
+    {
+        fsearch_format_record(&pcfg->writer, pcfg->format, path, strlen(path), pstat);
+    }
+    else if (pcfg->tree != NULL)
+    {
+        /* Draw only the part of the tree that changed since last match */
+        fsearch_tree_render(pcfg->tree, &pcfg->writer, path, dir_len,
+            S_ISDIR(pstat->st_mode), pcfg->criteria > 0);
+    }
+    else
+    {
+        char sinfo[FSEARCH_INFO_LEN + 1];
+        fsearch_get_info(pcfg, pstat, sinfo, sizeof(sinfo));
+        size_t length = strlen(path);
+
+        /* Lines are cut at LINE_MAX, paths of deep trees are written as they are */
+        if (length + FSEARCH_INFO_LEN < LINE_MAX) fsearch_printf(pcfg, "%s%s", sinfo, path);
+        else
         {
-            fprintf(fp, "%s\n", line);
-            fclose(fp);
+            fsearch_output_write(&pcfg->writer, sinfo, strlen(sinfo));
+            fsearch_output_write(&pcfg->writer, path, length);
+            fsearch_output_write(&pcfg->writer, "\n", 1);
         }
     }
 
-    printf("%s\n", line);
+    pcfg->is_found = 1;
+
+    /* Stop traversal and workers once we have enough */
+    if (++pcfg->result_count == pcfg->max_results) __sync_lock_test_and_set(&pcfg->stopped, 1);
+    pthread_mutex_unlock(&pcfg->lock);
+}
+
+int fsearch_check_entry(fsearch_cfg_t *pcfg, const char *name, size_t length, struct stat *pstat)
+{
+    return fsearch_filter_entry(&pcfg->filter, name, length, pstat) &&
+        fsearch_filter_stat(&pcfg->filter, name, length, pstat);
 }
 
-static void fsearch_display_path(fsearch_cfg_t *pcfg, struct stat *pstat, const char *path)
+int fsearch_check_content(fsearch_cfg_t *pcfg, int dir_fd, const char *name, const char *path, struct stat *pstat)
 {
-    if (!pcfg->indentation)
+    if (pcfg->content == NULL) return 1;
+    if (!S_ISREG(pstat->st_mode)) return 0;
+
+    int status = fsearch_content_match(dir_fd, name, pcfg->content, pcfg->content_len);
+    if (status < 0) fsearch_log_error(pcfg, path);
+    return status > 0;
+}
+
+int fsearch_path_reserve(fsearch_path_t *ppath, size_t length)
+{
+    if (length < ppath->capacity) return 0;
+
+    size_t capacity = ppath->capacity ? ppath->capacity * 2 : FSEARCH_PATH_MIN;
+    while (capacity <= length) capacity *= 2;
+
+    char *data = (char*)realloc(ppath->data, capacity);
+    if (data == NULL) return -1;
+
+    ppath->data = data;
+    ppath->capacity = capacity;
+    return 0;
+}
+
+static size_t fsearch_append_path(fsearch_path_t *ppath, size_t length, const fsearch_entry_t *pentry)
+{
+    /* Dont add slash twice if directory already contains slash character at the end */
+    size_t offset = (length && ppath->data[length - 1] == '/') ? length : length + 1;
+    if (fsearch_path_reserve(ppath, offset + pentry->name_len) < 0) return 0;
+
+    ppath->data[offset - 1] = '/';
+    memcpy(&ppath->data[offset], pentry->name, pentry->name_len + 1);
+    return offset + pentry->name_len;
+}
+
+static int fsearch_stat_entry(fsearch_cfg_t *pcfg, fsearch_dir_t *pdir, fsearch_timer_t *ptimer,
+    const fsearch_entry_t *pentry, fsearch_path_t *ppath, size_t length, struct stat *pstat)
+{
+    fsearch_timer_phase(ptimer, FSEARCH_PHASE_MATCH);
+    int status = fsearch_dir_stat(pdir, pentry->name, pstat, pcfg->follow);
+
+    /* Dangling or looping link is reported as the link itself */
+    if (status < 0 && pcfg->follow) status = fsearch_dir_stat(pdir, pentry->name, pstat, 0);
+
+    fsearch_timer_phase(ptimer, FSEARCH_PHASE_STAT);
+    fsearch_timer_stat(ptimer);
+    if (status >= 0) return 0;
+
+    int error = errno;
+    int built = fsearch_append_path(ppath, length, pentry) > 0;
+    errno = error;
+
+    fsearch_log_error(pcfg, built ? ppath->data : pentry->name);
+    ppath->data[length] = '\0';
+    return -1;
+}
+
+static const fsearch_entry_t* fsearch_read_entry(fsearch_dir_t *pdir, fsearch_timer_t *ptimer)
+{
+    /* Work left by skipped entries was spent on checks */
+    fsearch_timer_phase(ptimer, FSEARCH_PHASE_MATCH);
+    const fsearch_entry_t *entry = fsearch_dir_read(pdir);
+
+    fsearch_timer_phase(ptimer, FSEARCH_PHASE_READ);
+    if (entry != NULL) fsearch_timer_entry(ptimer);
+    return entry;
+}
+
+int fsearch_check_exclude(fsearch_cfg_t *pcfg, const char *name, size_t length)
+{
+    size_t i;
+
+    for (i = 0; i < pcfg->exclude_count; i++)
+        if (fsearch_regex_match(pcfg->excludes[i], name, length)) return 1;
+
+    return 0;
+}
+
+static int fsearch_check_prune(fsearch_cfg_t *pcfg, const fsearch_ignore_t *pignore,
+    const fsearch_entry_t *pentry, fsearch_path_t *ppath, size_t length, mode_t mode)
+{
+    if (fsearch_check_exclude(pcfg, pentry->name, pentry->name_len)) return 1;
+    if (pignore == NULL) return 0;
+
+    /* Anchored rules match path relative to the ignore file */
+    size_t path_len = fsearch_append_path(ppath, length, pentry);
+    int ignored = path_len && fsearch_ignore_match(pignore, ppath->data, path_len - pentry->name_len, S_ISDIR(mode));
+
+    ppath->data[length] = '\0';
+    return ignored;
+}
+
+int fsearch_level_init(fsearch_cfg_t *pcfg, fsearch_level_t *plevel, const char *pdirectory)
+{
+    plevel->ignore = NULL;
+    plevel->device = 0;
+    plevel->depth = 1;
+
+    if (!pcfg->one_filesystem) return 0;
+    struct stat statbuf;
+
+    if (stat(pdirectory, &statbuf) < 0) return -1;
+    plevel->device = statbuf.st_dev;
+    return 0;
+}
+
+static int fsearch_frame_open(fsearch_cfg_t *pcfg, fsearch_frame_t *pframe, int parent_fd, const char *name,
+    fsearch_path_t *ppath, size_t length, const fsearch_level_t *plevel)
+{
+    fsearch_timer_start(&pframe->timer, pcfg->stats);
+
+    /* Only target directory itself may be given as a link without -L */
+    int follow = pcfg->follow || plevel->depth == 1;
+    if (fsearch_dir_open(&pframe->dir, parent_fd, name, follow) < 0) return -1;
+
+    /* Links may lead to a directory again (or to its ancestor), walk it once */
+    if (pcfg->follow)
     {
-        char sinfo[FSEARCH_INFO_LEN + 1];
-        fsearch_get_info(pcfg, pstat, sinfo, sizeof(sinfo));
-        fsearch_printf(pcfg, "%s%s", sinfo, path);
-        return;
+        struct stat statbuf;
+        int status = fstat(pframe->dir.fd, &statbuf) < 0 ? -1 :
+            fsearch_inodes_insert(pcfg->inodes, statbuf.st_dev, statbuf.st_ino);
+
+        if (status <= 0)
+        {
+            int error = errno;
+            fsearch_dir_close(&pframe->dir);
+            errno = error;
+            return status;
+        }
+    }
+
+    /* Rules of this directory apply to its entries and everything below */
+    pframe->ignore = pcfg->ignore_files ?
+        fsearch_ignore_load(pframe->dir.fd, ppath->data, length, plevel->ignore) : NULL;
+    fsearch_timer_phase(&pframe->timer, FSEARCH_PHASE_OPEN);
+
+    /* Inodes are looked up in the order they are laid out on disk */
+    if (pcfg->inode_order && fsearch_dir_sort(&pframe->dir) < 0)
+    {
+        int error = errno;
+        fsearch_ignore_release(pframe->ignore);
+        fsearch_dir_close(&pframe->dir);
+        errno = error;
+        return -1;
     }
 
-    /* Get last printed directory depth to draw tree   */
-    size_t match_depth = fsearch_get_depth(pcfg, path);
+    fsearch_timer_phase(&pframe->timer, FSEARCH_PHASE_READ);
+
+    /* Usage of matching entries is summed up without locking */
+    pframe->usage = fsearch_du_enter(pcfg->du, ppath->data, length);
+    pframe->length = length;
+
+    pframe->level = *plevel;
+    if (pframe->ignore != NULL) pframe->level.ignore = pframe->ignore;
+    pframe->level.depth = plevel->depth + 1;
+
+    /* Depth limits are the same for the whole directory */
+    pframe->report = plevel->depth >= pcfg->min_depth;
+    pframe->recursive = pcfg->recursive && (!pcfg->max_depth || plevel->depth < pcfg->max_depth);
+    return 1;
+}
+
+static void fsearch_frame_close(fsearch_frame_t *pframe)
+{
+    fsearch_dir_close(&pframe->dir);
+    fsearch_ignore_release(pframe->ignore);
+    fsearch_timer_done(&pframe->timer);
+}
 
-    /* Copy path to another variable because strtok_r() 
-       will insert null terminator afrer each token */
-    char found[FSEARCH_FULL_PATH_LEN];
-    strcpy(found, path);
+/* Reports matching entries until a sub directory to enter is found, its
+   path is left in path buffer and its name in the directory entry */
+static int fsearch_frame_next(fsearch_cfg_t *pcfg, fsearch_frame_t *pframe, fsearch_path_t *ppath, size_t *psub_len)
+{
+    const fsearch_entry_t *entry = NULL;
+    size_t length = pframe->length;
 
-    char *saveptr = NULL;
-    size_t i, tabs = 0;
+    ppath->data[length] = '\0';
+    fsearch_timer_skip(&pframe->timer);
 
-    char *ptr = strtok_r(found, "/", &saveptr);
-    while (ptr != NULL)
+    while ((entry = fsearch_read_entry(&pframe->dir, &pframe->timer)) != NULL && !fsearch_search_stopped(pcfg))
     {
-        /* Continue tree drawing from last matching directory */
-        if ((!match_depth && tabs) || (match_depth && tabs >= match_depth))
+        struct stat statbuf;
+        statbuf.st_mode = fsearch_entry_mode(entry);
+
+        /* Unknown type is needed to descend anyway, stat it right away, same for followed links */
+        int have_stat = !statbuf.st_mode || (pcfg->follow && S_ISLNK(statbuf.st_mode));
+        if (have_stat && fsearch_stat_entry(pcfg, &pframe->dir, &pframe->timer, entry, ppath, length, &statbuf) < 0) continue;
+
+        /* Pruned entries are neither reported nor entered */
+        if ((pcfg->exclude_count || pframe->level.ignore != NULL) &&
+            fsearch_check_prune(pcfg, pframe->level.ignore, entry, ppath, length, statbuf.st_mode)) continue;
+
+        /* Type and name checks may save us a stat call */
+        int matched = pframe->report && fsearch_filter_entry(&pcfg->filter, entry->name, entry->name_len, &statbuf);
+        int descend = pframe->recursive && S_ISDIR(statbuf.st_mode);
+
+        /* Stat only if other criteria, output or mount point check needs it */
+        if (((matched && pcfg->need_stat) || (descend && pcfg->one_filesystem)) && !have_stat &&
+            fsearch_stat_entry(pcfg, &pframe->dir, &pframe->timer, entry, ppath, length, &statbuf) < 0) continue;
+
+        matched = matched && fsearch_filter_stat(&pcfg->filter, entry->name, entry->name_len, &statbuf);
+        if (descend && pcfg->one_filesystem) descend = statbuf.st_dev == pframe->level.device;
+        if (!matched && !descend) continue;
+
+        /* Full path is built only for entries we have to print or enter */
+        size_t path_len = fsearch_append_path(ppath, length, entry);
+        if (!path_len)
         {
-            /* Feel depth with '-' character */
-            char suffix[tabs + 1];
-            for (i = 0; i < tabs; i++) suffix[i] = '-';
-            suffix[tabs] = '\0';
-
-            /* Get next token from the path and if its last, 
-               we must display it with the bold text */
-            char *next = strtok_r(NULL, "/", &saveptr);
-            if (!pcfg->criteria || next != NULL) fsearch_printf(pcfg, "|%s%s", suffix, ptr);
-            else fsearch_printf(pcfg, "|%s%s%s%s", suffix, FSEARCH_STR_BOLD, ptr, FSEARCH_STR_RESET);
-
-            tabs += pcfg->indentation;
-            ptr = next;
+            fsearch_log_error(pcfg, entry->name);
             continue;
         }
-        else if (!match_depth)
+
+        /* Other links of a reported inode are skipped */
+        if (matched && pcfg->unique_inodes && statbuf.st_nlink > 1 && !S_ISDIR(statbuf.st_mode))
+        {
+            int status = fsearch_inodes_insert(pcfg->inodes, statbuf.st_dev, statbuf.st_ino);
+            if (status < 0) fsearch_log_error(pcfg, ppath->data);
+            matched = status > 0;
+        }
+
+        /* Reading the file is the most expensive check, do it last */
+        if (matched && fsearch_check_content(pcfg, pframe->dir.fd, entry->name, ppath->data, &statbuf))
         {
-            /* Display directory from the begining of tree */
-            fsearch_printf(pcfg, "%s", ptr);
+            fsearch_timer_phase(&pframe->timer, FSEARCH_PHASE_MATCH);
+            if (pcfg->du != NULL) fsearch_du_add(pcfg->du, pframe->usage, &statbuf);
+            else fsearch_report_match(pcfg, &statbuf, ppath->data, length);
+            fsearch_timer_phase(&pframe->timer, FSEARCH_PHASE_OUTPUT);
         }
 
-        /* Get next sub directory */
-        ptr = strtok_r(NULL, "/", &saveptr);
-        tabs += pcfg->indentation;
+        if (descend)
+        {
+            *psub_len = path_len;
+            return 1;
+        }
+
+        ppath->data[length] = '\0';
     }
+
+    return 0;
+}
+
+int fsearch_scan_directory(fsearch_cfg_t *pcfg, int parent_fd, const char *name, fsearch_path_t *ppath,
+    size_t length, const fsearch_level_t *plevel, fsearch_subdir_cb_t callback, void *ctx)
+{
+    fsearch_frame_t frame;
+    size_t sub_len = 0;
+
+    int status = fsearch_frame_open(pcfg, &frame, parent_fd, name, ppath, length, plevel);
+    if (status <= 0) return status;
+
+    /* Hand sub directory to the traversal strategy */
+    while (fsearch_frame_next(pcfg, &frame, ppath, &sub_len))
+        callback(pcfg, frame.dir.fd, frame.dir.entry.name, ppath, sub_len, &frame.level, ctx);
+
+    ppath->data[length] = '\0';
+    fsearch_frame_close(&frame);
+    return 1;
+}
+
+/* Directory closed to stay within budget is opened again through '..' of
+   its child, or by path if '..' leads elsewhere (e.g. child was a link) */
+static void fsearch_frame_resume(fsearch_cfg_t *pcfg, fsearch_frame_t *pframe, int child_fd, fsearch_path_t *ppath)
+{
+    ppath->data[pframe->length] = '\0';
+    if (fsearch_dir_resume(&pframe->dir, child_fd, "..") == 0) return;
+    if (fsearch_dir_resume(&pframe->dir, AT_FDCWD, ppath->data) == 0) return;
+
+    /* Rest of directory is lost, reading it ends right away */
+    fsearch_log_error(pcfg, ppath->data);
 }
 
 int fsearch_search_files(fsearch_cfg_t *pcfg, const char *pdirectory)
 {
-    DIR *pdir = opendir(pdirectory);
-    if (pdir == NULL) return -1;
+    size_t length = strlen(pdirectory);
+    fsearch_level_t level;
+
+    if (fsearch_level_init(pcfg, &level, pdirectory) < 0) return -1;
 
-    size_t dir_len = strlen(pdirectory);
-    struct dirent *entry = NULL;
+    /* Path grows with depth, one buffer serves the whole walk */
+    fsearch_path_t path = { NULL, 0 };
+    size_t capacity = FSEARCH_FRAMES_MIN;
+    fsearch_frame_t *frames = (fsearch_frame_t*)malloc(capacity * sizeof(fsearch_frame_t));
 
-    while ((entry = readdir(pdir)) != NULL && !__sync_add_and_fetch(pcfg->interrupted, 0))
+    if (fsearch_path_reserve(&path, length) < 0 || frames == NULL)
     {
-        /* Found an entry, but ignore . and .. */
-        if(strcmp(".", entry->d_name) == 0 ||
-           strcmp("..", entry->d_name) == 0)
-           continue;
+        free(path.data);
+        free(frames);
+        errno = ENOMEM;
+        return -1;
+    }
 
-        struct stat statbuf;
-        char path[PATH_MAX];
+    memcpy(path.data, pdirectory, length + 1);
+    int status = fsearch_frame_open(pcfg, &frames[0], AT_FDCWD, pdirectory, &path, length, &level);
+
+    /* Frames below closed ones keep their descriptors, at most fd budget of them */
+    size_t depth = status > 0 ? 1 : 0, closed = 0, sub_len = 0;
 
-        /* Dont add slash twice if directory already contains slash character at the end */
-        const char *slash = pdirectory[dir_len-1] != '/' ? "/" : "";
-        snprintf(path, sizeof(path), "%s%s%s", pdirectory, slash, entry->d_name);
+    while (depth)
+    {
+        fsearch_frame_t *pframe = &frames[depth - 1];
 
-        if (lstat(path, &statbuf) < 0)
+        if (!fsearch_frame_next(pcfg, pframe, &path, &sub_len))
         {
-            fsearch_log_error(pcfg, path);
+            /* Parent is opened again while this directory still holds its '..' */
+            if (closed && closed == depth - 1) fsearch_frame_resume(pcfg, &frames[--closed], pframe->dir.fd, &path);
+            fsearch_frame_close(pframe);
+            depth--;
             continue;
         }
 
-        if (fsearch_check_name(pcfg, entry->d_name) &&
-            fsearch_check_size(pcfg, statbuf.st_size) &&
-            fsearch_check_type(pcfg, statbuf.st_mode) &&
-            fsearch_check_links(pcfg, statbuf.st_nlink) &&
-            fsearch_check_permissions(pcfg, statbuf.st_mode))
+        if (depth == capacity)
         {
-            /* Display path with formatted tree */
-            fsearch_display_path(pcfg, &statbuf, path);
-            pcfg->is_found = 1;
-
-            /* Update status */
-            if (S_ISDIR(statbuf.st_mode)) snprintf(pcfg->last_directory, sizeof(pcfg->last_directory), "%s", path);
-            else snprintf(pcfg->last_directory, sizeof(pcfg->last_directory), "%s", pdirectory);
+            fsearch_frame_t *pframes = (fsearch_frame_t*)realloc(frames, capacity * 2 * sizeof(fsearch_frame_t));
+            if (pframes == NULL)
+            {
+                errno = ENOMEM;
+                fsearch_log_error(pcfg, path.data);
+                continue;
+            }
+
+            frames = pframes;
+            capacity *= 2;
+            pframe = &frames[depth - 1];
         }
 
-        /* Recursive search */
-        if (pcfg->recursive && 
-            S_ISDIR(statbuf.st_mode) && 
-            fsearch_search_files(pcfg, path) < 0)
-                fsearch_log_error(pcfg, pdirectory);
+        /* Oldest directories are read again last, close them first */
+        while (depth - closed >= (size_t)pcfg->fd_budget && closed < depth - 1)
+            fsearch_dir_suspend(&frames[closed++].dir);
+
+        int opened = fsearch_frame_open(pcfg, &frames[depth], pframe->dir.fd,
+            pframe->dir.entry.name, &path, sub_len, &pframe->level);
+
+        if (opened < 0) fsearch_log_error(pcfg, path.data);
+        else if (opened > 0) depth++;
     }
 
-    closedir(pdir);
-    return 1;
-}
\ No newline at end of file
+    int error = errno;
+    free(path.data);
+    free(frames);
+    errno = error;
+    return status;
+}
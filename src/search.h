@@ -11,9 +11,42 @@
 #ifndef __FSEARCH_SEARCH_H__
 #define __FSEARCH_SEARCH_H__
 
+#include <sys/stat.h>
 #include "config.h"
+#include "ignore.h"
+
+#define FSEARCH_FULL_PATH_LEN   (PATH_MAX + NAME_MAX + 1) // +1 for slash
+
+/* Path buffer of a walk, it grows with depth past PATH_MAX */
+typedef struct fsearch_path_ {
+    char *data;
+    size_t capacity;
+} fsearch_path_t;
+
+/* Traversal state of a directory, sub directories inherit it */
+typedef struct fsearch_level_ {
+    fsearch_ignore_t *ignore;       // Ignore rules in effect, owned by ancestors
+    dev_t device;                   // Target directory device (-x)
+    int depth;                      // Depth of directory entries (target entries are 1)
+} fsearch_level_t;
+
+/* Called for every sub directory found while scanning in recursive mode. 
+   Sub directory can be opened relative to dir_fd or using its full path,
+   level and path data are valid during the call only, queued directories
+   must copy them. Path may be grown (and moved) by the callback. */
+typedef void(*fsearch_subdir_cb_t)(fsearch_cfg_t *pcfg, int dir_fd, const char *name, 
+    fsearch_path_t *ppath, size_t length, const fsearch_level_t *plevel, void *ctx);
 
 void fsearch_log_error(fsearch_cfg_t *pcfg, const char *path);
+int fsearch_search_stopped(fsearch_cfg_t *pcfg);
+int fsearch_check_exclude(fsearch_cfg_t *pcfg, const char *name, size_t length);
+int fsearch_check_entry(fsearch_cfg_t *pcfg, const char *name, size_t length, struct stat *pstat);
+int fsearch_check_content(fsearch_cfg_t *pcfg, int dir_fd, const char *name, const char *path, struct stat *pstat);
+void fsearch_report_match(fsearch_cfg_t *pcfg, struct stat *pstat, const char *path, size_t dir_len);
+int fsearch_level_init(fsearch_cfg_t *pcfg, fsearch_level_t *plevel, const char *pdirectory);
+int fsearch_path_reserve(fsearch_path_t *ppath, size_t length);
+int fsearch_scan_directory(fsearch_cfg_t *pcfg, int parent_fd, const char *name, fsearch_path_t *ppath, 
+    size_t length, const fsearch_level_t *plevel, fsearch_subdir_cb_t callback, void *ctx);
 int fsearch_search_files(fsearch_cfg_t *pcfg, const char *pdirectory);
 
 #endif /* __FSEARCH_SEARCH_H__ */
\ No newline at end of file
@@ -0,0 +1,191 @@
+/*
+ *  src/stats.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Search statistics (--stats) collected per thread
+ * and aggregated when search is done
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+#define FSEARCH_STATS_BAR       40
+
+static const char *g_phase_names[FSEARCH_PHASES] = { "open", "read", "stat", "match", "output" };
+static unsigned int g_stats_id = 0;
+
+/* Hot path never locks, each thread finds its block here */
+static __thread fsearch_counters_t *t_counters = NULL;
+static __thread unsigned int t_stats_id = 0;
+
+fsearch_stats_t* fsearch_stats_create(void)
+{
+    fsearch_stats_t *pstats = (fsearch_stats_t*)malloc(sizeof(fsearch_stats_t));
+    if (pstats == NULL) return NULL;
+
+    if (pthread_mutex_init(&pstats->lock, NULL))
+    {
+        free(pstats);
+        return NULL;
+    }
+
+    pstats->id = __sync_add_and_fetch(&g_stats_id, 1);
+    pstats->start = fsearch_stats_clock();
+    pstats->counters = NULL;
+    pstats->inodes = 0;
+    pstats->inode_bytes = 0;
+    return pstats;
+}
+
+void fsearch_stats_destroy(fsearch_stats_t *pstats)
+{
+    if (pstats == NULL) return;
+    fsearch_counters_t *pcounters = pstats->counters;
+
+    while (pcounters != NULL)
+    {
+        fsearch_counters_t *next = pcounters->next;
+        free(pcounters);
+        pcounters = next;
+    }
+
+    pthread_mutex_destroy(&pstats->lock);
+    free(pstats);
+}
+
+fsearch_counters_t* fsearch_stats_local(fsearch_stats_t *pstats)
+{
+    if (pstats == NULL) return NULL;
+    if (t_stats_id == pstats->id) return t_counters;
+
+    /* Block outlives the thread, it is summed up after search */
+    fsearch_counters_t *pcounters = (fsearch_counters_t*)calloc(1, sizeof(fsearch_counters_t));
+    if (pcounters == NULL) return NULL;
+
+    pthread_mutex_lock(&pstats->lock);
+    pcounters->next = pstats->counters;
+    pstats->counters = pcounters;
+    pthread_mutex_unlock(&pstats->lock);
+
+    t_counters = pcounters;
+    t_stats_id = pstats->id;
+    return pcounters;
+}
+
+void fsearch_stats_error(fsearch_stats_t *pstats, int error)
+{
+    fsearch_counters_t *pcounters = fsearch_stats_local(pstats);
+    if (pcounters == NULL) return;
+
+    if (error <= 0 || error >= FSEARCH_STATS_ERRORS) error = FSEARCH_STATS_ERRORS - 1;
+    pcounters->errors[error]++;
+}
+
+void fsearch_stats_inodes(fsearch_stats_t *pstats, uint64_t count, size_t bytes)
+{
+    if (pstats == NULL) return;
+    pstats->inodes = count;
+    pstats->inode_bytes = bytes;
+}
+
+void fsearch_timer_done(fsearch_timer_t *ptimer)
+{
+    if (ptimer->counters == NULL) return;
+    fsearch_timer_phase(ptimer, FSEARCH_PHASE_OPEN);
+
+    int bucket = 0;
+    uint64_t elapsed = ptimer->elapsed;
+    while (elapsed > 1 && bucket < FSEARCH_STATS_BUCKETS - 1) { elapsed >>= 1; bucket++; }
+
+    ptimer->counters->latency[bucket]++;
+    ptimer->counters->directories++;
+}
+
+static const char* fsearch_stats_duration(char *buffer, size_t size, uint64_t ns)
+{
+    if (ns < 1000) snprintf(buffer, size, "%llu ns", (unsigned long long)ns);
+    else if (ns < 1000000) snprintf(buffer, size, "%llu us", (unsigned long long)(ns / 1000));
+    else if (ns < 1000000000) snprintf(buffer, size, "%llu ms", (unsigned long long)(ns / 1000000));
+    else snprintf(buffer, size, "%llu s", (unsigned long long)(ns / 1000000000));
+    return buffer;
+}
+
+void fsearch_stats_print(fsearch_stats_t *pstats, uint64_t matches, size_t written)
+{
+    if (pstats == NULL) return;
+    double elapsed = (fsearch_stats_clock() - pstats->start) / 1e9;
+
+    fsearch_counters_t total;
+    memset(&total, 0, sizeof(total));
+
+    const fsearch_counters_t *pcounters;
+    uint64_t errors = 0, phases = 0, peak = 0;
+    int i, threads = 0;
+
+    pthread_mutex_lock(&pstats->lock);
+    for (pcounters = pstats->counters; pcounters != NULL; pcounters = pcounters->next)
+    {
+        for (i = 0; i < FSEARCH_PHASES; i++) total.phases[i] += pcounters->phases[i];
+        for (i = 0; i < FSEARCH_STATS_BUCKETS; i++) total.latency[i] += pcounters->latency[i];
+        for (i = 0; i < FSEARCH_STATS_ERRORS; i++) total.errors[i] += pcounters->errors[i];
+
+        total.directories += pcounters->directories;
+        total.entries += pcounters->entries;
+        total.stats += pcounters->stats;
+        threads++;
+    }
+    pthread_mutex_unlock(&pstats->lock);
+
+    for (i = 0; i < FSEARCH_STATS_ERRORS; i++) errors += total.errors[i];
+    for (i = 0; i < FSEARCH_PHASES; i++) phases += total.phases[i];
+    for (i = 0; i < FSEARCH_STATS_BUCKETS; i++) if (total.latency[i] > peak) peak = total.latency[i];
+
+    fprintf(stderr, "\nSearch statistics:\n");
+    fprintf(stderr, "  elapsed          %.6f s (%d threads)\n", elapsed, threads);
+    fprintf(stderr, "  directories      %llu\n", (unsigned long long)total.directories);
+    fprintf(stderr, "  entries          %llu\n", (unsigned long long)total.entries);
+    fprintf(stderr, "  stat calls       %llu\n", (unsigned long long)total.stats);
+    fprintf(stderr, "  matches          %llu\n", (unsigned long long)matches);
+    fprintf(stderr, "  bytes written    %zu\n", written);
+    if (pstats->inode_bytes) fprintf(stderr, "  inode set        %llu entries, %zu bytes\n",
+        (unsigned long long)pstats->inodes, pstats->inode_bytes);
+    fprintf(stderr, "  errors           %llu\n", (unsigned long long)errors);
+
+    for (i = 1; i < FSEARCH_STATS_ERRORS; i++)
+    {
+        if (!total.errors[i]) continue;
+        const char *reason = i < FSEARCH_STATS_ERRORS - 1 ? strerror(i) : "Other errors";
+        fprintf(stderr, "    %-30s %llu\n", reason, (unsigned long long)total.errors[i]);
+    }
+
+    /* Phases are summed over all threads */
+    fprintf(stderr, "\nTime per phase:\n");
+    for (i = 0; i < FSEARCH_PHASES; i++)
+    {
+        fprintf(stderr, "  %-16s %.6f s %6.2f%%\n", g_phase_names[i], total.phases[i] / 1e9,
+            phases ? total.phases[i] * 100.0 / phases : 0.0);
+    }
+
+    if (!peak) return;
+    int first = 0, last = FSEARCH_STATS_BUCKETS - 1;
+    while (!total.latency[first]) first++;
+    while (!total.latency[last]) last--;
+
+    fprintf(stderr, "\nDirectory latency (own time, sub directories excluded):\n");
+    for (i = first; i <= last; i++)
+    {
+        char from[32], to[32];
+        int bar = (int)((total.latency[i] * FSEARCH_STATS_BAR + peak - 1) / peak);
+
+        fsearch_stats_duration(from, sizeof(from), 1ULL << i);
+        if (i < FSEARCH_STATS_BUCKETS - 1) fsearch_stats_duration(to, sizeof(to), 1ULL << (i + 1));
+        else snprintf(to, sizeof(to), "...");
+
+        fprintf(stderr, "  %8s - %-8s %10llu %.*s\n", from, to, (unsigned long long)total.latency[i],
+            bar, "########################################");
+    }
+}
@@ -0,0 +1,110 @@
+/*
+ *  src/stats.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Search statistics (--stats) collected per thread
+ * and aggregated when search is done
+ */
+
+#ifndef __FSEARCH_STATS_H__
+#define __FSEARCH_STATS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+
+#define FSEARCH_STATS_ERRORS    134     // Errno values counted one by one, last slot for others
+#define FSEARCH_STATS_BUCKETS   40      // Log2 buckets of nanoseconds, last one is open
+
+typedef enum {
+    FSEARCH_PHASE_OPEN = 0,             // Opening and closing directories
+    FSEARCH_PHASE_READ,                 // Reading directory entries
+    FSEARCH_PHASE_STAT,                 // Stat calls
+    FSEARCH_PHASE_MATCH,                // Name, filter and content checks
+    FSEARCH_PHASE_OUTPUT,               // Printing results, lock wait included
+    FSEARCH_PHASES
+} fsearch_phase_e;
+
+typedef struct fsearch_counters_ {
+    struct fsearch_counters_ *next;     // Counters of other threads
+    uint64_t phases[FSEARCH_PHASES];    // Nanoseconds spent per phase
+    uint64_t latency[FSEARCH_STATS_BUCKETS];
+    uint64_t errors[FSEARCH_STATS_ERRORS];
+    uint64_t directories;
+    uint64_t entries;
+    uint64_t stats;
+} fsearch_counters_t;
+
+typedef struct fsearch_stats_ {
+    pthread_mutex_t lock;               // Protects list of counters
+    fsearch_counters_t *counters;       // One block per thread which took part
+    unsigned int id;                    // Tells thread cached blocks apart
+    uint64_t start;                     // Creation time
+    uint64_t inodes;                    // Entries of visited inode set
+    size_t inode_bytes;                 // Memory taken by the set
+} fsearch_stats_t;
+
+/* Measures own time of one directory, counters are NULL without --stats */
+typedef struct fsearch_timer_ {
+    fsearch_counters_t *counters;
+    uint64_t last;                      // Time of last checkpoint
+    uint64_t elapsed;                   // Time spent in this directory
+} fsearch_timer_t;
+
+fsearch_stats_t* fsearch_stats_create(void);
+void fsearch_stats_destroy(fsearch_stats_t *pstats);
+
+/* Counters of calling thread, allocated on first use */
+fsearch_counters_t* fsearch_stats_local(fsearch_stats_t *pstats);
+void fsearch_stats_error(fsearch_stats_t *pstats, int error);
+void fsearch_stats_inodes(fsearch_stats_t *pstats, uint64_t count, size_t bytes);
+void fsearch_stats_print(fsearch_stats_t *pstats, uint64_t matches, size_t written);
+
+static inline uint64_t fsearch_stats_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Timer calls are inline, they cost a NULL check when stats are off */
+static inline void fsearch_timer_start(fsearch_timer_t *ptimer, fsearch_stats_t *pstats)
+{
+    ptimer->counters = fsearch_stats_local(pstats);
+    ptimer->last = ptimer->counters != NULL ? fsearch_stats_clock() : 0;
+    ptimer->elapsed = 0;
+}
+
+/* Time since last checkpoint goes to the given phase */
+static inline void fsearch_timer_phase(fsearch_timer_t *ptimer, fsearch_phase_e phase)
+{
+    if (ptimer->counters == NULL) return;
+    uint64_t now = fsearch_stats_clock();
+
+    ptimer->counters->phases[phase] += now - ptimer->last;
+    ptimer->elapsed += now - ptimer->last;
+    ptimer->last = now;
+}
+
+/* Time since last checkpoint belongs to someone else (e.g. sub directory) */
+static inline void fsearch_timer_skip(fsearch_timer_t *ptimer)
+{
+    if (ptimer->counters != NULL) ptimer->last = fsearch_stats_clock();
+}
+
+static inline void fsearch_timer_entry(fsearch_timer_t *ptimer)
+{
+    if (ptimer->counters != NULL) ptimer->counters->entries++;
+}
+
+static inline void fsearch_timer_stat(fsearch_timer_t *ptimer)
+{
+    if (ptimer->counters != NULL) ptimer->counters->stats++;
+}
+
+void fsearch_timer_done(fsearch_timer_t *ptimer);
+
+#endif /* __FSEARCH_STATS_H__ */
@@ -0,0 +1,127 @@
+/*
+ *  src/tree.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Incremental tree renderer for indented (-i) output
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "search.h"
+#include "tree.h"
+
+#define FSEARCH_STR_BOLD        "\033[1m"
+#define FSEARCH_STR_RESET       "\033[0m"
+
+/* Every component takes at least one byte and a slash */
+#define FSEARCH_TREE_DEPTH      (FSEARCH_FULL_PATH_LEN / 2 + 1)
+
+typedef struct fsearch_span_ {
+    uint16_t offset;                // Component offset in path
+    uint16_t length;                // Component length
+} fsearch_span_t;
+
+struct fsearch_tree_ {
+    char path[FSEARCH_FULL_PATH_LEN];           // Last directory path
+    fsearch_span_t parts[FSEARCH_TREE_DEPTH];   // Its components, deepest on top
+    size_t depth;                               // Count of components on stack
+    size_t indentation;                         // Dashes per tree level
+};
+
+fsearch_tree_t* fsearch_tree_create(size_t indentation)
+{
+    fsearch_tree_t *ptree = (fsearch_tree_t*)malloc(sizeof(fsearch_tree_t));
+    if (ptree == NULL) return NULL;
+
+    ptree->indentation = indentation;
+    ptree->depth = 0;
+    return ptree;
+}
+
+void fsearch_tree_destroy(fsearch_tree_t *ptree)
+{
+    free(ptree);
+}
+
+static size_t fsearch_tree_put(char *line, size_t pos, size_t max, const char *data, size_t length)
+{
+    if (length > max - pos) length = max - pos;
+    memcpy(&line[pos], data, length);
+    return pos + length;
+}
+
+static int fsearch_tree_line(fsearch_output_t *pout, size_t dashes,
+    const char *name, size_t length, int is_root, int bold)
+{
+    char *line = fsearch_output_reserve(pout, LINE_MAX);
+    if (line == NULL) return -1;
+
+    /* Line is cut at the same width as formatted output */
+    size_t max = LINE_MAX - 1, pos = 0;
+
+    if (!is_root)
+    {
+        line[pos++] = '|';
+        if (dashes > max - pos) dashes = max - pos;
+        memset(&line[pos], '-', dashes);
+        pos += dashes;
+    }
+
+    if (bold) pos = fsearch_tree_put(line, pos, max, FSEARCH_STR_BOLD, sizeof(FSEARCH_STR_BOLD) - 1);
+    pos = fsearch_tree_put(line, pos, max, name, length);
+    if (bold) pos = fsearch_tree_put(line, pos, max, FSEARCH_STR_RESET, sizeof(FSEARCH_STR_RESET) - 1);
+
+    line[pos++] = '\n';
+    fsearch_output_commit(pout, pos);
+    return 0;
+}
+
+int fsearch_tree_render(fsearch_tree_t *ptree, fsearch_output_t *pout,
+    const char *path, size_t dir_len, int is_dir, int bold)
+{
+    size_t pos = 0, index = 0, keep = 0;
+    int shared = 1;
+
+    while (index < FSEARCH_TREE_DEPTH)
+    {
+        while (path[pos] == '/') pos++;
+        if (path[pos] == '\0') break;
+
+        size_t start = pos;
+        while (path[pos] != '/' && path[pos] != '\0') pos++;
+        size_t length = pos - start;
+
+        /* Components shared with last directory are already drawn */
+        shared = shared && index < ptree->depth && ptree->parts[index].length == length &&
+            !memcmp(&ptree->path[ptree->parts[index].offset], &path[start], length);
+
+        if (!shared)
+        {
+            size_t next = pos;
+            while (path[next] == '/') next++;
+
+            if (fsearch_tree_line(pout, index * ptree->indentation, &path[start], length,
+                !index, bold && path[next] == '\0') < 0) return -1;
+        }
+
+        /* Entry at index was compared already, reuse its slot for new stack */
+        if (is_dir || pos <= dir_len)
+        {
+            ptree->parts[index].offset = (uint16_t)start;
+            ptree->parts[index].length = (uint16_t)length;
+            keep = index + 1;
+        }
+
+        index++;
+    }
+
+    size_t end = keep ? ptree->parts[keep - 1].offset + ptree->parts[keep - 1].length : 0;
+    if (end >= sizeof(ptree->path)) keep = end = 0;
+
+    memcpy(ptree->path, path, end);
+    ptree->depth = keep;
+    return 0;
+}
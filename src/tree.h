@@ -0,0 +1,26 @@
+/*
+ *  src/tree.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ *
+ * Incremental tree renderer for indented (-i) output
+ */
+
+#ifndef __FSEARCH_TREE_H__
+#define __FSEARCH_TREE_H__
+
+#include <stddef.h>
+#include "output.h"
+
+typedef struct fsearch_tree_ fsearch_tree_t;
+
+fsearch_tree_t* fsearch_tree_create(size_t indentation);
+void fsearch_tree_destroy(fsearch_tree_t *ptree);
+
+/* Draws components of path not shared with last directory, then the
+   directory part of path (or whole path if is_dir) becomes the last one */
+int fsearch_tree_render(fsearch_tree_t *ptree, fsearch_output_t *pout,
+    const char *path, size_t dir_len, int is_dir, int bold);
+
+#endif /* __FSEARCH_TREE_H__ */
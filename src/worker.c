@@ -0,0 +1,403 @@
+/*
+ *  src/worker.c
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * Parallel directory traversal using worker
+ * threads with work-stealing directory queues
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "worker.h"
+#include "search.h"
+
+#define FSEARCH_DEQUE_SIZE      64
+#define FSEARCH_IDLE_SPINS      64
+#define FSEARCH_IDLE_SLEEP_NS   50000
+
+/* Scanned directory kept open for its queued sub directories */
+typedef struct fsearch_parent_ {
+    struct fsearch_pool_ *pool;
+    int fd;                     // Duplicated descriptor, -1 over fd budget
+    long refs;                  // Queued children and the scanning worker
+} fsearch_parent_t;
+
+typedef struct fsearch_task_ {
+    fsearch_level_t level;      // Inherited traversal state
+    fsearch_parent_t *parent;   // Opened relative to it, by full path if NULL
+    size_t name_offset;         // Directory name in path
+    char path[];                // Full directory path
+} fsearch_task_t;
+
+typedef struct fsearch_deque_ {
+    pthread_mutex_t lock;
+    fsearch_task_t **items;     // Queued directories
+    size_t capacity;            // Allocated item slots
+    size_t head;                // Thieves take from here
+    size_t tail;                // Owner pushes and pops here
+} fsearch_deque_t;
+
+typedef struct fsearch_pool_ {
+    fsearch_cfg_t *pcfg;
+    fsearch_deque_t *deques;    // One deque per worker
+    long pending;               // Queued and in-progress directories
+    long open_fds;              // Descriptors held by parents
+    int count;                  // Count of workers
+} fsearch_pool_t;
+
+typedef struct fsearch_worker_ {
+    fsearch_pool_t *pool;
+    fsearch_parent_t *parent;   // Directory being scanned, created on first push
+    int parent_fd;              // Scan descriptor the parent was duplicated from
+    pthread_t thread;
+    int index;
+} fsearch_worker_t;
+
+static void fsearch_parent_release(fsearch_parent_t *pparent)
+{
+    if (pparent == NULL || __sync_sub_and_fetch(&pparent->refs, 1)) return;
+
+    if (pparent->fd >= 0)
+    {
+        close(pparent->fd);
+        __sync_sub_and_fetch(&pparent->pool->open_fds, 1);
+    }
+
+    free(pparent);
+}
+
+/* Parent of sub directories found in dir_fd, NULL if it can not be created */
+static fsearch_parent_t* fsearch_worker_parent(fsearch_worker_t *pworker, int dir_fd)
+{
+    if (pworker->parent != NULL && pworker->parent_fd == dir_fd) return pworker->parent;
+
+    fsearch_pool_t *pool = pworker->pool;
+    fsearch_parent_t *pparent = (fsearch_parent_t*)malloc(sizeof(fsearch_parent_t));
+    if (pparent == NULL) return NULL;
+
+    pparent->pool = pool;
+    pparent->refs = 1;
+    pparent->fd = -1;
+
+    /* Descriptors are limited like directories kept open by the sequential walk */
+    if (__sync_add_and_fetch(&pool->open_fds, 1) <= pool->pcfg->fd_budget)
+        pparent->fd = fcntl(dir_fd, F_DUPFD_CLOEXEC, 0);
+
+    if (pparent->fd < 0) __sync_sub_and_fetch(&pool->open_fds, 1);
+
+    fsearch_parent_release(pworker->parent);
+    pworker->parent = pparent;
+    pworker->parent_fd = dir_fd;
+    return pparent;
+}
+
+static fsearch_task_t* fsearch_task_create(const char *path, size_t length, size_t name_offset,
+    const fsearch_level_t *plevel, fsearch_parent_t *pparent)
+{
+    fsearch_task_t *ptask = (fsearch_task_t*)malloc(sizeof(fsearch_task_t) + length + 1);
+    if (ptask == NULL) return NULL;
+
+    /* Queued directory keeps inherited ignore rules alive */
+    ptask->level = *plevel;
+    fsearch_ignore_retain(ptask->level.ignore);
+
+    /* Without a descriptor it is opened by full path */
+    ptask->parent = NULL;
+    if (pparent != NULL && pparent->fd >= 0)
+    {
+        __sync_add_and_fetch(&pparent->refs, 1);
+        ptask->parent = pparent;
+    }
+
+    ptask->name_offset = name_offset;
+    memcpy(ptask->path, path, length + 1);
+    return ptask;
+}
+
+static void fsearch_task_free(fsearch_task_t *ptask)
+{
+    fsearch_ignore_release(ptask->level.ignore);
+    fsearch_parent_release(ptask->parent);
+    free(ptask);
+}
+
+static int fsearch_deque_init(fsearch_deque_t *pdeque)
+{
+    pdeque->items = (fsearch_task_t**)malloc(FSEARCH_DEQUE_SIZE * sizeof(fsearch_task_t*));
+    if (pdeque->items == NULL) return -1;
+
+    pdeque->capacity = FSEARCH_DEQUE_SIZE;
+    pdeque->head = pdeque->tail = 0;
+
+    pthread_mutex_init(&pdeque->lock, NULL);
+    return 0;
+}
+
+static void fsearch_deque_destroy(fsearch_deque_t *pdeque)
+{
+    /* Free directories left behind by an interrupted search */
+    while (pdeque->head < pdeque->tail) fsearch_task_free(pdeque->items[pdeque->head++]);
+    pthread_mutex_destroy(&pdeque->lock);
+    free(pdeque->items);
+}
+
+static int fsearch_deque_push(fsearch_deque_t *pdeque, fsearch_task_t *ptask)
+{
+    pthread_mutex_lock(&pdeque->lock);
+
+    if (pdeque->tail == pdeque->capacity)
+    {
+        size_t used = pdeque->tail - pdeque->head;
+
+        /* Reuse slots released by thieves before growing */
+        if (pdeque->head > pdeque->capacity / 2)
+        {
+            memmove(pdeque->items, &pdeque->items[pdeque->head], used * sizeof(fsearch_task_t*));
+        }
+        else
+        {
+            size_t capacity = pdeque->capacity * 2;
+            fsearch_task_t **items = (fsearch_task_t**)realloc(pdeque->items, capacity * sizeof(fsearch_task_t*));
+
+            if (items == NULL)
+            {
+                pthread_mutex_unlock(&pdeque->lock);
+                return -1;
+            }
+
+            memmove(items, &items[pdeque->head], used * sizeof(fsearch_task_t*));
+            pdeque->capacity = capacity;
+            pdeque->items = items;
+        }
+
+        pdeque->head = 0;
+        pdeque->tail = used;
+    }
+
+    pdeque->items[pdeque->tail++] = ptask;
+    pthread_mutex_unlock(&pdeque->lock);
+    return 0;
+}
+
+static fsearch_task_t* fsearch_deque_pop(fsearch_deque_t *pdeque, int fifo)
+{
+    fsearch_task_t *ptask = NULL;
+    pthread_mutex_lock(&pdeque->lock);
+
+    /* Owner takes the most recent directory to keep its working set hot,
+       or the oldest one when shallow matches should come first (--bfs) */
+    if (pdeque->tail > pdeque->head && fifo) ptask = pdeque->items[pdeque->head++];
+    else if (pdeque->tail > pdeque->head) ptask = pdeque->items[--pdeque->tail];
+    if (pdeque->tail == pdeque->head) pdeque->head = pdeque->tail = 0;
+
+    pthread_mutex_unlock(&pdeque->lock);
+    return ptask;
+}
+
+static fsearch_task_t* fsearch_deque_steal(fsearch_deque_t *pdeque)
+{
+    fsearch_task_t *ptask = NULL;
+
+    /* Don't wait for a busy victim, there are other deques to try */
+    if (pthread_mutex_trylock(&pdeque->lock)) return NULL;
+
+    /* Thieves take the oldest directory, usually the largest subtree */
+    if (pdeque->tail > pdeque->head) ptask = pdeque->items[pdeque->head++];
+    if (pdeque->tail == pdeque->head) pdeque->head = pdeque->tail = 0;
+
+    pthread_mutex_unlock(&pdeque->lock);
+    return ptask;
+}
+
+static fsearch_task_t* fsearch_worker_next(fsearch_worker_t *pworker)
+{
+    fsearch_pool_t *pool = pworker->pool;
+    fsearch_task_t *ptask = fsearch_deque_pop(&pool->deques[pworker->index], pool->pcfg->bfs);
+    int i;
+
+    for (i = 1; ptask == NULL && i < pool->count; i++)
+    {
+        int victim = (pworker->index + i) % pool->count;
+        ptask = fsearch_deque_steal(&pool->deques[victim]);
+    }
+
+    return ptask;
+}
+
+static void fsearch_worker_push(fsearch_cfg_t *pcfg, int dir_fd, const char *name, 
+    fsearch_path_t *ppath, size_t length, const fsearch_level_t *plevel, void *ctx)
+{
+    fsearch_worker_t *pworker = (fsearch_worker_t*)ctx;
+    fsearch_pool_t *pool = pworker->pool;
+    fsearch_parent_t *pparent = fsearch_worker_parent(pworker, dir_fd);
+    fsearch_task_t *ptask = NULL;
+
+    /* Path past PATH_MAX can only be opened relative to its parent */
+    if (length < PATH_MAX || (pparent != NULL && pparent->fd >= 0))
+        ptask = fsearch_task_create(ppath->data, length, length - strlen(name), plevel, pparent);
+
+    __sync_add_and_fetch(&pool->pending, 1);
+
+    if (ptask == NULL || fsearch_deque_push(&pool->deques[pworker->index], ptask) < 0)
+    {
+        /* Can not queue directory, search it in place instead */
+        if (ptask != NULL) fsearch_task_free(ptask);
+
+        /* Sub directories found in place get a parent of their own */
+        int parent_fd = pworker->parent_fd;
+        pworker->parent = NULL;
+
+        if (fsearch_scan_directory(pcfg, dir_fd, name, ppath, length, plevel, fsearch_worker_push, ctx) < 0)
+            fsearch_log_error(pcfg, ppath->data);
+
+        fsearch_parent_release(pworker->parent);
+        pworker->parent = pparent;
+        pworker->parent_fd = parent_fd;
+
+        __sync_sub_and_fetch(&pool->pending, 1);
+        ppath->data[length] = '\0';
+    }
+}
+
+/* Drops reference of the scan which is done, queued children keep theirs */
+static void fsearch_worker_done(fsearch_worker_t *pworker)
+{
+    fsearch_parent_release(pworker->parent);
+    pworker->parent = NULL;
+}
+
+static void* fsearch_worker_thread(void *ctx)
+{
+    fsearch_worker_t *pworker = (fsearch_worker_t*)ctx;
+    fsearch_pool_t *pool = pworker->pool;
+    fsearch_cfg_t *pcfg = pool->pcfg;
+    fsearch_path_t path = { NULL, 0 };
+    int idle = 0;
+
+    while (!fsearch_search_stopped(pcfg))
+    {
+        fsearch_task_t *ptask = fsearch_worker_next(pworker);
+        if (ptask == NULL)
+        {
+            /* Nothing queued and nobody is scanning, we are done */
+            if (!__sync_add_and_fetch(&pool->pending, 0)) break;
+
+            if (++idle < FSEARCH_IDLE_SPINS) sched_yield();
+            else
+            {
+                struct timespec ts = { 0, FSEARCH_IDLE_SLEEP_NS };
+                nanosleep(&ts, NULL);
+            }
+
+            continue;
+        }
+
+        /* Path buffer grows with depth, it is kept for next tasks */
+        size_t length = strlen(ptask->path);
+        int status = fsearch_path_reserve(&path, length);
+
+        if (status == 0)
+        {
+            memcpy(path.data, ptask->path, length + 1);
+
+            /* Name is opened relative to its parent, full path when parent was not kept open */
+            int parent_fd = ptask->parent != NULL ? ptask->parent->fd : AT_FDCWD;
+            const char *name = ptask->parent != NULL ? &path.data[ptask->name_offset] : path.data;
+            status = fsearch_scan_directory(pcfg, parent_fd, name, &path, length, &ptask->level, fsearch_worker_push, pworker);
+        }
+
+        if (status < 0) fsearch_log_error(pcfg, ptask->path);
+
+        fsearch_worker_done(pworker);
+        fsearch_task_free(ptask);
+
+        __sync_sub_and_fetch(&pool->pending, 1);
+        idle = 0;
+    }
+
+    free(path.data);
+    return NULL;
+}
+
+int fsearch_search_parallel(fsearch_cfg_t *pcfg, const char *pdirectory)
+{
+    fsearch_pool_t pool;
+    pool.pcfg = pcfg;
+    pool.pending = 0;
+    pool.open_fds = 0;
+    pool.count = pcfg->threads;
+
+    pool.deques = (fsearch_deque_t*)calloc(pool.count, sizeof(fsearch_deque_t));
+    fsearch_worker_t *workers = (fsearch_worker_t*)calloc(pool.count, sizeof(fsearch_worker_t));
+
+    if (pool.deques == NULL || workers == NULL)
+    {
+        free(pool.deques);
+        free(workers);
+        return fsearch_search_files(pcfg, pdirectory);
+    }
+
+    int i, count = 0;
+    for (i = 0; i < pool.count; i++)
+    {
+        if (fsearch_deque_init(&pool.deques[i]) < 0) break;
+        workers[i].pool = &pool;
+        workers[i].index = i;
+        workers[i].parent = NULL;
+        workers[i].parent_fd = -1;
+        count++;
+    }
+
+    fsearch_path_t path = { NULL, 0 };
+    size_t length = strlen(pdirectory);
+    fsearch_level_t level;
+    int status = -1;
+
+    /* Scan the root in place so open errors reach the caller */
+    if (count == pool.count && fsearch_level_init(pcfg, &level, pdirectory) == 0 &&
+        fsearch_path_reserve(&path, length) == 0)
+    {
+        memcpy(path.data, pdirectory, length + 1);
+        status = fsearch_scan_directory(pcfg, AT_FDCWD, pdirectory, &path, length, &level, fsearch_worker_push, &workers[0]);
+        fsearch_worker_done(&workers[0]);
+    }
+
+    free(path.data);
+
+    if (status < 0)
+    {
+        int error = errno;
+        for (i = 0; i < count; i++) fsearch_deque_destroy(&pool.deques[i]);
+        free(pool.deques);
+        free(workers);
+        errno = error;
+        return status;
+    }
+
+    int started = 0;
+    for (i = 0; i < pool.count; i++)
+    {
+        if (pthread_create(&workers[i].thread, NULL, fsearch_worker_thread, &workers[i])) break;
+        started++;
+    }
+
+    /* Could not start any thread, drain the queues here */
+    if (!started) fsearch_worker_thread(&workers[0]);
+    for (i = 0; i < started; i++) pthread_join(workers[i].thread, NULL);
+
+    for (i = 0; i < pool.count; i++) fsearch_deque_destroy(&pool.deques[i]);
+    free(pool.deques);
+    free(workers);
+
+    return status;
+}
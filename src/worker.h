@@ -0,0 +1,18 @@
+/*
+ *  src/worker.h
+ *
+ *  This source is part of "fsearch" project
+ *  2015-2020  Sun Dro (f4tb0y@protonmail.com)
+ * 
+ * Parallel directory traversal using worker
+ * threads with work-stealing directory queues
+ */
+
+#ifndef __FSEARCH_WORKER_H__
+#define __FSEARCH_WORKER_H__
+
+#include "config.h"
+
+int fsearch_search_parallel(fsearch_cfg_t *pcfg, const char *pdirectory);
+
+#endif /* __FSEARCH_WORKER_H__ */